@@ -0,0 +1,232 @@
+#include <string.h>
+
+#include "composite.h"
+
+
+/* Make L fully transparent, with the given blend mode and opacity. */
+void
+layer_init(struct layer *l, enum layer_blend blend, uint8_t opacity)
+{
+  memset(l->used, 0, sizeof(l->used));
+  l->opacity = opacity;
+  l->blend = blend;
+}
+
+
+/* Clear slice A of L before the first voxel is drawn in it. */
+void
+layer_clear_slice(struct layer *l, uint32_t a)
+{
+  size_t base = (size_t)a*PLANAR_SLICE;
+
+  memset(l->px.r + base, 0, PLANAR_SLICE);
+  memset(l->px.g + base, 0, PLANAR_SLICE);
+  memset(l->px.b + base, 0, PLANAR_SLICE);
+  memset(l->alpha + base, 0, PLANAR_SLICE);
+  l->used[a] = 1;
+}
+
+
+/* x/255 rounded, for 0 <= x <= 255*255, in 16 bits so that it vectorises. */
+static inline uint16_t
+div255(uint16_t x)
+{
+  uint16_t t = x + 128;
+  return (t + (t >> 8)) >> 8;
+}
+
+
+/*
+  Slices are merged in runs of up to this many with the same layers in
+  use, which keeps the loops long enough to be worth vectorising while the
+  partial result stays in L1.
+*/
+#define COMPOSITE_RUN 8
+#define COMPOSITE_MAX_LAYERS 32
+
+
+/*
+  Blend N voxels of one plane of a layer, SRC with coverage A, into the
+  partial result ACC. The mode is a constant in each caller, so each one
+  is a plain loop.
+*/
+static inline __attribute__((always_inline)) void
+composite_plane(uint8_t *acc, const uint8_t *src, const uint8_t *a, size_t n,
+                enum layer_blend blend)
+{
+  size_t i;
+
+  switch (blend)
+  {
+  case LAYER_ALPHA:
+    for (i = 0; i < n; ++i)
+      acc[i] = div255(acc[i]*(255 - a[i]) + src[i]*a[i]);
+    break;
+  case LAYER_ADD:
+    for (i = 0; i < n; ++i)
+    {
+      uint16_t v = acc[i] + div255(src[i]*a[i]);
+      acc[i] = v > 255 ? 255 : v;
+    }
+    break;
+  case LAYER_MAX:
+    for (i = 0; i < n; ++i)
+    {
+      uint8_t v = div255(src[i]*a[i]);
+      acc[i] = v > acc[i] ? v : acc[i];
+    }
+    break;
+  case LAYER_MULTIPLY:
+    for (i = 0; i < n; ++i)
+      acc[i] = div255(acc[i]*div255(255*(255 - a[i]) + src[i]*a[i]));
+    break;
+  }
+}
+
+
+/* Blend voxels BASE .. BASE+N-1 of layer L into ACC. */
+static inline __attribute__((always_inline)) void
+composite_run(uint8_t acc[3][COMPOSITE_RUN*PLANAR_SLICE], const struct layer *l,
+              size_t base, size_t n)
+{
+  uint8_t scaled[COMPOSITE_RUN*PLANAR_SLICE];
+  const uint8_t *a = l->alpha + base;
+  size_t i;
+
+  if (l->opacity < 255)
+  {
+    for (i = 0; i < n; ++i)
+      scaled[i] = div255(a[i]*l->opacity);
+    a = scaled;
+  }
+  switch (l->blend)
+  {
+  case LAYER_ALPHA:
+    composite_plane(acc[0], l->px.r + base, a, n, LAYER_ALPHA);
+    composite_plane(acc[1], l->px.g + base, a, n, LAYER_ALPHA);
+    composite_plane(acc[2], l->px.b + base, a, n, LAYER_ALPHA);
+    break;
+  case LAYER_ADD:
+    composite_plane(acc[0], l->px.r + base, a, n, LAYER_ADD);
+    composite_plane(acc[1], l->px.g + base, a, n, LAYER_ADD);
+    composite_plane(acc[2], l->px.b + base, a, n, LAYER_ADD);
+    break;
+  case LAYER_MAX:
+    composite_plane(acc[0], l->px.r + base, a, n, LAYER_MAX);
+    composite_plane(acc[1], l->px.g + base, a, n, LAYER_MAX);
+    composite_plane(acc[2], l->px.b + base, a, n, LAYER_MAX);
+    break;
+  case LAYER_MULTIPLY:
+    composite_plane(acc[0], l->px.r + base, a, n, LAYER_MULTIPLY);
+    composite_plane(acc[1], l->px.g + base, a, n, LAYER_MULTIPLY);
+    composite_plane(acc[2], l->px.b + base, a, n, LAYER_MULTIPLY);
+    break;
+  }
+}
+
+
+/* Bit J set if layer J has anything in slice A. */
+static inline uint32_t
+composite_mask(const struct layer *const *layers, uint32_t num_layers,
+               uint32_t a)
+{
+  uint32_t j, mask = 0;
+
+  for (j = 0; j < num_layers; ++j)
+    if (layers[j]->used[a] && layers[j]->opacity)
+      mask |= 1u << j;
+  return mask;
+}
+
+
+/*
+  The whole merge is built for baseline SSE2 and for AVX2, where the 16-bit
+  arithmetic of the blends runs twice as wide, and picked on the first call
+  as for the interleave.
+*/
+static inline __attribute__((always_inline)) void
+composite_kernel(frame_t *f, const struct layer *const *layers,
+                 uint32_t num_layers)
+{
+  uint8_t acc[3][COMPOSITE_RUN*PLANAR_SLICE];
+  uint32_t a, end, j, mask;
+
+  for (a = 0; a < LEDS_TANG; a = end)
+  {
+    size_t base = (size_t)a*PLANAR_SLICE, n;
+    uint8_t *out = (*f)[base];
+
+    mask = composite_mask(layers, num_layers, a);
+    for (end = a + 1; end < LEDS_TANG && end - a < COMPOSITE_RUN &&
+           composite_mask(layers, num_layers, end) == mask; ++end)
+      ;
+    n = (size_t)(end - a)*PLANAR_SLICE;
+    if (!mask)
+    {
+      memset(out, 0, 3*n);
+      continue;
+    }
+    memset(acc, 0, sizeof(acc));
+    for (j = 0; j < num_layers; ++j)
+      if (mask & (1u << j))
+        composite_run(acc, layers[j], base, n);
+    planar_interleave_n(out, acc[0], acc[1], acc[2], n);
+  }
+}
+
+
+static void
+composite_generic(frame_t *f, const struct layer *const *layers,
+                  uint32_t num_layers)
+{
+  composite_kernel(f, layers, num_layers);
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+static __attribute__((target("avx2"))) void
+composite_avx2(frame_t *f, const struct layer *const *layers,
+               uint32_t num_layers)
+{
+  composite_kernel(f, layers, num_layers);
+}
+
+#endif
+
+
+static void composite_select(frame_t *f, const struct layer *const *layers,
+                             uint32_t num_layers);
+
+static void (*composite_fn)(frame_t *, const struct layer *const *,
+                            uint32_t) = composite_select;
+
+
+static void
+composite_select(frame_t *f, const struct layer *const *layers,
+                 uint32_t num_layers)
+{
+  void (*fn)(frame_t *, const struct layer *const *, uint32_t) =
+    composite_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    fn = composite_avx2;
+#endif
+  composite_fn = fn;
+  fn(f, layers, num_layers);
+}
+
+
+/*
+  Merge the NUM_LAYERS (at most 32) LAYERS, bottom first, over black into
+  F.
+*/
+void
+composite(frame_t *f, const struct layer *const *layers, uint32_t num_layers)
+{
+  if (num_layers > COMPOSITE_MAX_LAYERS)
+    num_layers = COMPOSITE_MAX_LAYERS;
+  composite_fn(f, layers, num_layers);
+}
@@ -0,0 +1,66 @@
+#ifndef COMPOSITE_H
+#define COMPOSITE_H
+
+#include "planar.h"
+
+/*
+  Layer compositor.
+
+  Each layer is a planar frame with a coverage (alpha) plane, an opacity
+  and a blend mode. Layers are drawn independently, in any order, and
+  composite() merges them (up to 32) bottom to top over black into a frame_t in a
+  single pass, a few tangential slices at a time, so that the partial result
+  stays in L1 and goes straight through the interleave. Slices a layer has
+  nothing in are skipped for that layer, and slices no layer has anything
+  in are just cleared.
+
+  Blend modes, with s the layer colour, d the colour below and a the
+  coverage times opacity (all 0..255):
+    LAYER_ALPHA     d + (s - d)*a
+    LAYER_ADD       d + s*a, saturating
+    LAYER_MAX       max(d, s*a)
+    LAYER_MULTIPLY  d*(1 - a + s*a)
+*/
+
+enum layer_blend {
+  LAYER_ALPHA,
+  LAYER_ADD,
+  LAYER_MAX,
+  LAYER_MULTIPLY
+};
+
+struct layer {
+  struct planar_frame px;
+  /* Coverage of each voxel, 0 for none (the default) to 255. */
+  uint8_t alpha[PLANAR_VOXELS];
+  /*
+    Non-zero for the tangential slices that have anything in them. The
+    others are not even cleared: a slice is cleared when it is first drawn
+    in, so that an empty layer costs nothing.
+  */
+  uint8_t used[LEDS_TANG];
+  uint8_t opacity;
+  enum layer_blend blend;
+};
+
+
+extern void layer_clear_slice(struct layer *l, uint32_t a);
+
+
+/* Draw a voxel of the layer, fully covered. */
+static inline void
+layer_setpix(struct layer *l, uint32_t x, uint32_t y, uint32_t a,
+             uint8_t r, uint8_t g, uint8_t b)
+{
+  if (!l->used[a])
+    layer_clear_slice(l, a);
+  planar_setpix(&l->px, x, y, a, r, g, b);
+  l->alpha[y+x*LEDS_Y+a*PLANAR_SLICE] = 255;
+}
+
+extern void layer_init(struct layer *l, enum layer_blend blend,
+                       uint8_t opacity);
+extern void composite(frame_t *f, const struct layer *const *layers,
+                      uint32_t num_layers);
+
+#endif  /* COMPOSITE_H */
@@ -0,0 +1,34 @@
+#include "fixpoint.h"
+
+
+#ifndef LEDTORUS_FIXED_POINT
+int fixed_point_enabled = 0;
+#endif
+
+
+/*
+  Fifth-order polynomial, exact at 0 and at +/- a quarter turn, with zero
+  slope at the latter. Max. error is 4e-4, well below what shows in 8-bit
+  colour.
+
+    sin(pi/2*z) ~= A*z - B*z**3 + C*z**5, -1 <= z <= 1
+*/
+fix16_t
+fix16_sin_turn(uint32_t angle)
+{
+  static const int64_t A = 102944;    /* pi/2 */
+  static const int64_t B = 42047;     /* pi - 5/2 */
+  static const int64_t C = 4640;      /* pi/2 - 3/2 */
+  int32_t x = (int32_t)angle;
+  int64_t z, z2, r;
+
+  /* Reflect the 2nd and 3rd quarters into the 1st and 4th. */
+  if ((x ^ (int32_t)((uint32_t)x << 1)) < 0)
+    x = (int32_t)(((uint32_t)1 << 31) - (uint32_t)x);
+  /* Now -2**30 <= x <= 2**30; scale to Q16 with 1.0 = a quarter turn. */
+  z = x >> 14;
+  z2 = (z * z) >> 16;
+  r = B - ((C * z2) >> 16);
+  r = A - ((r * z2) >> 16);
+  return (fix16_t)((r * z) >> 16);
+}
@@ -0,0 +1,63 @@
+#ifndef FIXPOINT_H
+#define FIXPOINT_H
+
+#include <stdint.h>
+
+/*
+  Q16.16 fixed-point arithmetic, for the parts of the animations that are
+  too expensive in float on the torus firmware (which has no FPU).
+
+  simplex_noise_3d(), hsv2rgb_f() and torus_polar2rect() keep their float
+  interfaces, but compute in fixed point when USE_FIXED_POINT is true. When
+  building for the firmware, define LEDTORUS_FIXED_POINT to make that
+  permanent. On the host it is a run-time switch, so that the two versions
+  can be compared (see ledtorus_anim --compare).
+*/
+
+typedef int32_t fix16_t;
+
+#define FIX16_ONE 65536
+#define FIX16_HALF 32768
+
+#ifdef LEDTORUS_FIXED_POINT
+#define USE_FIXED_POINT 1
+#else
+extern int fixed_point_enabled;
+#define USE_FIXED_POINT fixed_point_enabled
+#endif
+
+
+static inline fix16_t
+fix16_from_float(float x)
+{
+  return (fix16_t)(x * (float)FIX16_ONE + (x < 0.0f ? -0.5f : 0.5f));
+}
+
+
+static inline float
+fix16_to_float(fix16_t x)
+{
+  return (float)x * (1.0f/(float)FIX16_ONE);
+}
+
+
+static inline fix16_t
+fix16_mul(fix16_t a, fix16_t b)
+{
+  return (fix16_t)(((int64_t)a * b) >> 16);
+}
+
+
+/*
+  Sine and cosine of an angle given in 1/2**32 of a full turn, so that the
+  angle wraps around for free.
+*/
+extern fix16_t fix16_sin_turn(uint32_t angle);
+
+static inline fix16_t
+fix16_cos_turn(uint32_t angle)
+{
+  return fix16_sin_turn(angle + ((uint32_t)1 << 30));
+}
+
+#endif  /* FIXPOINT_H */
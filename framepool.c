@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "framepool.h"
+#include "trace.h"
+
+
+/*
+  Frame-parallel rendering.
+
+  Animations flagged ANIM_STATELESS are pure functions of the frame number,
+  so frames N..N+depth-1 can be rendered at the same time by different
+  threads. Each worker takes the next unassigned frame number, as long as it
+  fits in the reorder buffer, and renders it into its slot. The consumer
+  takes the frames out strictly in order, which frees the slot for frame
+  N+depth.
+*/
+
+
+static void *
+frame_pool_worker(void *arg)
+{
+  struct frame_pool *pool = arg;
+
+  trace_thread_name("frame worker");
+  pthread_mutex_lock(&pool->mutex);
+  for (;;)
+  {
+    uint32_t n, slot, res;
+    uint64_t t_start;
+
+    while (!pool->stop &&
+           (pool->next_assign - pool->next_emit >= pool->depth ||
+            pool->next_assign >= pool->end))
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+    if (pool->stop)
+      break;
+    n = pool->next_assign++;
+    slot = n % pool->depth;
+    pthread_mutex_unlock(&pool->mutex);
+
+    t_start = trace_now();
+    res = pool->anim->nextframe(&pool->slots[slot], n, pool->data);
+    trace_span("render", t_start, trace_now(), n);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->slot_res[slot] = res;
+    pool->slot_done[slot] = 1;
+    pthread_cond_broadcast(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+
+/*
+  Start rendering frames FIRST, FIRST+1, ... (up to, not including, END) with
+  NUM_THREADS threads. Returns NULL if no thread could be started.
+*/
+struct frame_pool *
+frame_pool_start(const struct ledtorus_anim *anim, union anim_data *data,
+                 uint32_t num_threads, uint32_t first, uint32_t end)
+{
+  struct frame_pool *pool = calloc(1, sizeof(*pool));
+  uint32_t i;
+
+  pool->anim = anim;
+  pool->data = data;
+  pool->depth = 2*num_threads;
+  pool->threads = calloc(num_threads, sizeof(*pool->threads));
+  pool->slots = malloc(pool->depth*sizeof(frame_t));
+  pool->slot_res = calloc(pool->depth, sizeof(*pool->slot_res));
+  pool->slot_done = calloc(pool->depth, sizeof(*pool->slot_done));
+  if (!pool->threads || !pool->slots || !pool->slot_res || !pool->slot_done)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  pool->next_assign = pool->next_emit = first;
+  pool->end = end;
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  for (i = 0; i < num_threads; ++i)
+  {
+    if (pthread_create(&pool->threads[i], NULL, frame_pool_worker, pool))
+      break;
+    ++pool->num_threads;
+  }
+  if (pool->num_threads == 0)
+  {
+    frame_pool_stop(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+
+/* Get the next frame, in order. Returns the nextframe() result for it. */
+uint32_t
+frame_pool_get(struct frame_pool *pool, frame_t *f)
+{
+  uint32_t slot, res;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->next_emit >= pool->end)
+  {
+    /* Past what the workers were asked to do; render it ourselves. */
+    uint32_t n = pool->next_emit++;
+    pthread_mutex_unlock(&pool->mutex);
+    return pool->anim->nextframe(f, n, pool->data);
+  }
+  slot = pool->next_emit % pool->depth;
+  while (!pool->slot_done[slot])
+    pthread_cond_wait(&pool->done_cond, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+
+  /* The slot is ours until next_emit moves past it. */
+  memcpy(f, &pool->slots[slot], sizeof(frame_t));
+  res = pool->slot_res[slot];
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->slot_done[slot] = 0;
+  ++pool->next_emit;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  return res;
+}
+
+
+void
+frame_pool_stop(struct frame_pool *pool)
+{
+  uint32_t i;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (i = 0; i < pool->num_threads; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool->slot_done);
+  free(pool->slot_res);
+  free(pool->slots);
+  free(pool->threads);
+  free(pool);
+}
+
+
+uint32_t
+frame_pool_default_threads(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (uint32_t)n : 1;
+}
@@ -0,0 +1,40 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <pthread.h>
+
+#include "ledtorus_anim.h"
+
+/*
+  Pool of threads rendering consecutive frames of a stateless animation
+  concurrently, with a reorder buffer so that frames are handed out in order.
+*/
+struct frame_pool {
+  const struct ledtorus_anim *anim;
+  union anim_data *data;
+  uint32_t num_threads;
+  pthread_t *threads;
+  /* Reorder buffer; frame N is rendered into slot N % depth. */
+  uint32_t depth;
+  frame_t *slots;
+  uint32_t *slot_res;
+  uint8_t *slot_done;
+  /* Next frame to hand to a worker, next frame to return, frame limit. */
+  uint32_t next_assign;
+  uint32_t next_emit;
+  uint32_t end;
+  int stop;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+};
+
+extern struct frame_pool *frame_pool_start(const struct ledtorus_anim *anim,
+                                           union anim_data *data,
+                                           uint32_t num_threads,
+                                           uint32_t first, uint32_t end);
+extern uint32_t frame_pool_get(struct frame_pool *pool, frame_t *f);
+extern void frame_pool_stop(struct frame_pool *pool);
+extern uint32_t frame_pool_default_threads(void);
+
+#endif  /* FRAMEPOOL_H */
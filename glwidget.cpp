@@ -42,24 +42,67 @@
 #include <QtOpenGL>
 
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "glwidget.h"
 #include "ledtorus.h"
 #include "io.h"
+#include "trace.h"
 
 #ifndef GL_MULTISAMPLE
 #define GL_MULTISAMPLE  0x809D
 #endif
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+
+/*
+  Timer query entry points. These are not in the GL 1.1 headers, so they are
+  looked up at run time (GL 3.3, ARB_timer_query or EXT_timer_query).
+*/
+typedef void (APIENTRY *gen_queries_t)(GLsizei n, GLuint *ids);
+typedef void (APIENTRY *begin_query_t)(GLenum target, GLuint id);
+typedef void (APIENTRY *end_query_t)(GLenum target);
+typedef void (APIENTRY *get_query_objectiv_t)(GLuint id, GLenum pname,
+                                              GLint *params);
+typedef void (APIENTRY *get_query_objectui64v_t)(GLuint id, GLenum pname,
+                                                 uint64_t *params);
+static gen_queries_t gl_gen_queries;
+static begin_query_t gl_begin_query;
+static end_query_t gl_end_query;
+static get_query_objectiv_t gl_get_query_objectiv;
+static get_query_objectui64v_t gl_get_query_objectui64v;
+
+static QGLFormat vsync_format()
+{
+    QGLFormat format(QGL::SampleBuffers);
+    format.setSwapInterval(1);
+    return format;
+}
 
 GLWidget::GLWidget(QWidget *parent)
-    : QGLWidget(QGLFormat(QGL::SampleBuffers), parent), frame_counter(0)
+    : QGLWidget(vsync_format(), parent), interpolate(false),
+      last_traced_frame(~(uint64_t)0), have_timer_query(false),
+      timer_query_next(0), timer_query_pending(0)
 {
     xRot = 0;
     yRot = 0;
     zRot = 0;
+    /*
+      Redraw as fast as the event loop allows; with vsync, the buffer swap
+      in paintGL() then paces us to the display refresh rate.
+    */
     frame_timer.setSingleShot(false);
     connect(&frame_timer, SIGNAL(timeout()), this, SLOT(new_frame()));
-    frame_timer.start((1000 + FRAMERATE/2) / FRAMERATE);
+    frame_timer.start(0);
+    camera_clock.start();
 }
 
 GLWidget::~GLWidget()
@@ -114,9 +157,13 @@ void GLWidget::setZRotation(int angle)
     }
 }
 
+void GLWidget::setInterpolation(bool on)
+{
+    interpolate = on;
+}
+
 void GLWidget::new_frame()
 {
-    ++frame_counter;
     updateGL();
 }
 
@@ -134,23 +181,132 @@ void GLWidget::initializeGL()
     glEnable(GL_MULTISAMPLE);
     static GLfloat lightPosition[4] = { 0.5, 5.0, 7.0, 1.0 };
     glLightfv(GL_LIGHT0, GL_POSITION, lightPosition);
+
+    /* We swap ourselves in paintGL(), so the swap can be traced. */
+    setAutoBufferSwap(false);
+    /* Without vsync, do not spin; redraw at a typical refresh rate. */
+    if (format().swapInterval() < 1)
+        frame_timer.setInterval(1000 / 60);
+    if (trace_enabled)
+        initTimerQueries();
+}
+
+void GLWidget::initTimerQueries()
+{
+    const char *version = (const char *)glGetString(GL_VERSION);
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    int major = 0, minor = 0;
+    const char *suffix = "";
+
+    if (version)
+        sscanf(version, "%d.%d", &major, &minor);
+    if (major > 3 || (major == 3 && minor >= 3) ||
+        (extensions && strstr(extensions, "GL_ARB_timer_query")))
+        suffix = "";
+    else if (extensions && strstr(extensions, "GL_EXT_timer_query"))
+        suffix = "EXT";
+    else
+        return;
+
+    const QGLContext *ctx = context();
+    gl_gen_queries = (gen_queries_t)ctx->getProcAddress("glGenQueries");
+    gl_begin_query = (begin_query_t)ctx->getProcAddress("glBeginQuery");
+    gl_end_query = (end_query_t)ctx->getProcAddress("glEndQuery");
+    gl_get_query_objectiv =
+        (get_query_objectiv_t)ctx->getProcAddress("glGetQueryObjectiv");
+    gl_get_query_objectui64v = (get_query_objectui64v_t)
+        ctx->getProcAddress(QString("glGetQueryObjectui64v") + suffix);
+    if (!gl_gen_queries || !gl_begin_query || !gl_end_query ||
+        !gl_get_query_objectiv || !gl_get_query_objectui64v)
+        return;
+
+    gl_gen_queries(NUM_TIMER_QUERIES, timer_queries);
+    have_timer_query = true;
+}
+
+/*
+  Emit GPU spans for the timer queries whose results are available. The
+  queries are used round-robin and only read back once ready, so we never
+  stall the pipeline waiting for the GPU; when all of them are still
+  pending, paintGL() skips timing that frame instead.
+*/
+void GLWidget::collectTimerQueries()
+{
+    while (timer_query_pending > 0) {
+        int idx = (timer_query_next + NUM_TIMER_QUERIES - timer_query_pending)
+            % NUM_TIMER_QUERIES;
+        GLint available = 0;
+        uint64_t elapsed_ns = 0;
+
+        gl_get_query_objectiv(timer_queries[idx], GL_QUERY_RESULT_AVAILABLE,
+                              &available);
+        if (!available)
+            break;
+        gl_get_query_objectui64v(timer_queries[idx], GL_QUERY_RESULT,
+                                 &elapsed_ns);
+        trace_span_tid(TRACE_TID_GPU, "gpu_draw", timer_query_start[idx],
+                       timer_query_start[idx] + elapsed_ns,
+                       timer_query_frame[idx]);
+        --timer_query_pending;
+    }
 }
 
 void GLWidget::paintGL()
 {
+    struct frame_stamp stamp;
+    uint64_t t_start = trace_now();
+    int query = timer_query_next;
+    bool timed = false;
+
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glLoadIdentity();
     glTranslatef(0.0, 0.0, -10.0);
-    int x = xRot + 80*sin(frame_counter / 20.0);
-    qNormalizeAngle(x);
-    int y = yRot + 65*cos(frame_counter / 35.0);
-    qNormalizeAngle(y);
-    int z = zRot + 40*sin(frame_counter / 55.0);
-    qNormalizeAngle(z);
+    /*
+      Camera motion follows real time, so it is smooth at any redraw rate.
+      The phase is in units of LED frames, as the motion was tuned that way.
+    */
+    double phase = camera_clock.nsecsElapsed() * (FRAMERATE / 1e9);
+    double x = xRot + 80*sin(phase / 20.0);
+    double y = yRot + 65*cos(phase / 35.0);
+    double z = zRot + 40*sin(phase / 55.0);
     glRotatef(x / 16.0, 1.0, 0.0, 0.0);
     glRotatef(y / 16.0, 0.0, 1.0, 0.0);
     glRotatef(z / 16.0, 0.0, 0.0, 1.0);
-    draw_ledtorus();
+    if (have_timer_query) {
+        collectTimerQueries();
+        timed = timer_query_pending < NUM_TIMER_QUERIES;
+    }
+    if (timed) {
+        timer_query_start[query] = trace_now();
+        gl_begin_query(GL_TIME_ELAPSED, timer_queries[query]);
+    }
+    draw_ledtorus(interpolate, &stamp);
+    if (timed) {
+        gl_end_query(GL_TIME_ELAPSED);
+        timer_query_frame[query] = stamp.frame_id;
+        timer_query_next = (query + 1) % NUM_TIMER_QUERIES;
+        ++timer_query_pending;
+    }
+
+    uint64_t t_draw = trace_now();
+    swapBuffers();
+    if (trace_enabled) {
+        /*
+          Wait for the swap to actually happen, so that the time we record is
+          close to when the frame reaches the screen.
+        */
+        glFinish();
+        uint64_t t_swap = trace_now();
+        trace_span("draw", t_start, t_draw, stamp.frame_id);
+        trace_span("swap", t_draw, t_swap, stamp.frame_id);
+        if (stamp.magic == FRAME_STAMP_MAGIC &&
+            stamp.frame_id != last_traced_frame) {
+            trace_flow(1, t_draw, stamp.frame_id);
+            trace_counter("latency_ms", t_swap,
+                          (double)(t_swap - stamp.done_ns) / 1e6);
+            last_traced_frame = stamp.frame_id;
+        }
+    }
 }
 
 void GLWidget::resizeGL(int width, int height)
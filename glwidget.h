@@ -45,6 +45,7 @@
 
 #include <QGLWidget>
 #include <QTimer>
+#include <QElapsedTimer>
 
 class GLWidget : public QGLWidget
 {
@@ -56,11 +57,13 @@ public:
 
     QSize minimumSizeHint() const;
     QSize sizeHint() const;
+    bool interpolation() const { return interpolate; }
 
 public slots:
     void setXRotation(int angle);
     void setYRotation(int angle);
     void setZRotation(int angle);
+    void setInterpolation(bool on);
 
 private slots:
     void new_frame();
@@ -78,12 +81,27 @@ protected:
     void mouseMoveEvent(QMouseEvent *event);
 
 private:
+    void initTimerQueries();
+    void collectTimerQueries();
+
     int xRot;
     int yRot;
     int zRot;
     QPoint lastPos;
     QTimer frame_timer;
-    uint64_t frame_counter;
+    QElapsedTimer camera_clock;
+    /* Crossfade between the two most recent LED frames. */
+    bool interpolate;
+    uint64_t last_traced_frame;
+
+    /* GL_TIME_ELAPSED queries measuring GPU draw time, when tracing. */
+    enum { NUM_TIMER_QUERIES = 4 };
+    bool have_timer_query;
+    GLuint timer_queries[NUM_TIMER_QUERIES];
+    uint64_t timer_query_start[NUM_TIMER_QUERIES];
+    uint64_t timer_query_frame[NUM_TIMER_QUERIES];
+    int timer_query_next;
+    int timer_query_pending;
 };
 
 #endif
@@ -0,0 +1,268 @@
+#include <string.h>
+
+#include "grid.h"
+#include "slicepool.h"
+
+
+/*
+  Offsets of the 6 face neighbours, and of the 3x3x3 block around a cell
+  (the cell itself included, as the stencils subtract it anyway).
+*/
+static const int32_t grid_faces[6] = {
+  -GRID_DY, GRID_DY, -GRID_DX, GRID_DX, -GRID_DA, GRID_DA
+};
+
+#define GRID_ROW(d) (d) - GRID_DY, (d), (d) + GRID_DY
+#define GRID_PLANE(d) \
+  GRID_ROW((d) - GRID_DX), GRID_ROW(d), GRID_ROW((d) + GRID_DX)
+static const int32_t grid_block[27] = {
+  GRID_PLANE(-GRID_DA), GRID_PLANE(0), GRID_PLANE(GRID_DA)
+};
+
+/*
+  The stencils run over this many slices at a time, so that the neighbour
+  sums stay in L1.
+*/
+#define GRID_CHUNK_SLICES 8
+#define GRID_CHUNK (GRID_CHUNK_SLICES*GRID_SLICE)
+
+
+void
+grid_init(struct grid *g, uint32_t num_fields, enum grid_edge edge)
+{
+  memset(g->buf, 0, sizeof(g->buf));
+  g->cur = 0;
+  g->num_fields = num_fields > GRID_MAX_FIELDS ? GRID_MAX_FIELDS : num_fields;
+  g->edge = edge;
+}
+
+
+/* Fill in the padding of field F, as described in grid.h. */
+static void
+grid_pad(float *f, enum grid_edge edge)
+{
+  uint32_t a, x;
+
+  f += GRID_MARGIN;
+  for (a = 1; a <= LEDS_TANG; ++a)
+  {
+    float *s = f + a*GRID_DA;
+
+    for (x = 1; x <= LEDS_X; ++x)
+    {
+      float *col = s + x*GRID_DX;
+      if (edge == GRID_EDGE_CLAMP)
+      {
+        col[0] = col[GRID_DY];
+        col[(LEDS_Y+1)*GRID_DY] = col[LEDS_Y*GRID_DY];
+      }
+      else
+        col[0] = col[(LEDS_Y+1)*GRID_DY] = 0.0f;
+    }
+    if (edge == GRID_EDGE_CLAMP)
+    {
+      memcpy(s, s + GRID_DX, GRID_PY*sizeof(*s));
+      memcpy(s + (LEDS_X+1)*GRID_DX, s + LEDS_X*GRID_DX, GRID_PY*sizeof(*s));
+    }
+    else
+    {
+      memset(s, 0, GRID_PY*sizeof(*s));
+      memset(s + (LEDS_X+1)*GRID_DX, 0, GRID_PY*sizeof(*s));
+    }
+  }
+  memcpy(f, f + LEDS_TANG*GRID_DA, GRID_SLICE*sizeof(*f));
+  memcpy(f + (LEDS_TANG+1)*GRID_DA, f + GRID_DA, GRID_SLICE*sizeof(*f));
+}
+
+
+/* SUM[i] = sum over k of SRC[i + OFF[k]], for 0 <= i < N. */
+static inline __attribute__((always_inline)) void
+grid_sum(const float *src, const int32_t *off, uint32_t num_off, float *sum,
+         uint32_t n)
+{
+  uint32_t i, k;
+
+  for (i = 0; i < n; ++i)
+    sum[i] = (src + off[0])[i];
+  for (k = 1; k < num_off; ++k)
+  {
+    const float *s = src + off[k];
+    for (i = 0; i < n; ++i)
+      sum[i] += s[i];
+  }
+}
+
+
+/*
+  One step of rule P->rule for the cells of slices A_BEGIN <= a < A_END,
+  from CUR to NEXT. This computes the padding cells within the slices too,
+  which is cheaper than skipping them; grid_pad() overwrites them before
+  they are used.
+*/
+static inline __attribute__((always_inline)) void
+grid_sweep_kernel(const struct grid_params *p, float *const *cur,
+                  float *const *next, uint32_t a_begin, uint32_t a_end)
+{
+  float s0[GRID_CHUNK] __attribute__((aligned(64)));
+  float s1[GRID_CHUNK] __attribute__((aligned(64)));
+  uint32_t a, i;
+
+  for (a = a_begin; a < a_end; a += GRID_CHUNK_SLICES)
+  {
+    uint32_t slices = a_end - a < GRID_CHUNK_SLICES ? a_end - a :
+      GRID_CHUNK_SLICES;
+    uint32_t n = slices*GRID_SLICE;
+    size_t base = GRID_MARGIN + (size_t)(a + 1)*GRID_DA;
+    const float *u = cur[0] + base, *v = cur[1] + base;
+    float *nu = next[0] + base, *nv = next[1] + base;
+
+    switch (p->rule)
+    {
+    case GRID_HEAT:
+    {
+      float d = p->diffuse[0], keep = 1.0f - p->decay;
+
+      grid_sum(u, grid_faces, 6, s0, n);
+      for (i = 0; i < n; ++i)
+        nu[i] = (u[i] + d*(s0[i] - 6.0f*u[i]))*keep;
+      break;
+    }
+    case GRID_GRAY_SCOTT:
+    {
+      float du = p->diffuse[0], dv = p->diffuse[1];
+      float feed = p->feed, fk = p->feed + p->kill;
+
+      grid_sum(u, grid_faces, 6, s0, n);
+      grid_sum(v, grid_faces, 6, s1, n);
+      for (i = 0; i < n; ++i)
+      {
+        float uvv = u[i]*v[i]*v[i];
+        nu[i] = u[i] + du*(s0[i] - 6.0f*u[i]) - uvv + feed*(1.0f - u[i]);
+        nv[i] = v[i] + dv*(s1[i] - 6.0f*v[i]) + uvv - fk*v[i];
+      }
+      break;
+    }
+    case GRID_LIFE:
+    {
+      uint32_t birth = p->birth, survive = p->survive;
+
+      grid_sum(u, grid_block, 27, s0, n);
+      for (i = 0; i < n; ++i)
+      {
+        uint32_t alive = u[i] > 0.5f;
+        uint32_t count = (uint32_t)(s0[i] - u[i] + 0.5f);
+        uint32_t rule = alive ? survive : birth;
+        nu[i] = (float)((rule >> count) & 1);
+      }
+      break;
+    }
+    }
+  }
+}
+
+
+static void
+grid_sweep_generic(const struct grid_params *p, float *const *cur,
+                   float *const *next, uint32_t a_begin, uint32_t a_end)
+{
+  grid_sweep_kernel(p, cur, next, a_begin, a_end);
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+static __attribute__((target("avx2"))) void
+grid_sweep_avx2(const struct grid_params *p, float *const *cur,
+                float *const *next, uint32_t a_begin, uint32_t a_end)
+{
+  grid_sweep_kernel(p, cur, next, a_begin, a_end);
+}
+
+#endif
+
+
+static void grid_sweep_select(const struct grid_params *p, float *const *cur,
+                              float *const *next, uint32_t a_begin,
+                              uint32_t a_end);
+
+static void (*grid_sweep_fn)(const struct grid_params *, float *const *,
+                             float *const *, uint32_t, uint32_t) =
+  grid_sweep_select;
+
+
+static void
+grid_sweep_select(const struct grid_params *p, float *const *cur,
+                  float *const *next, uint32_t a_begin, uint32_t a_end)
+{
+  void (*fn)(const struct grid_params *, float *const *, float *const *,
+             uint32_t, uint32_t) = grid_sweep_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    fn = grid_sweep_avx2;
+#endif
+  grid_sweep_fn = fn;
+  fn(p, cur, next, a_begin, a_end);
+}
+
+
+struct grid_job {
+  const struct grid_params *p;
+  float *cur[GRID_MAX_FIELDS];
+  float *next[GRID_MAX_FIELDS];
+};
+
+static void
+grid_sweep_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                  struct slice_worker *w __attribute__((unused)))
+{
+  const struct grid_job *job = arg;
+
+  grid_sweep_fn(job->p, job->cur, job->next, a_begin, a_end);
+}
+
+
+/*
+  Run SUBSTEPS steps of rule P. With GRID_PARALLEL in FLAGS, each step is
+  spread over the slice pool.
+*/
+void
+grid_step(struct grid *g, const struct grid_params *p, uint32_t substeps,
+          uint32_t flags)
+{
+  struct grid_job job;
+  uint32_t s, i;
+
+  job.p = p;
+  for (s = 0; s < substeps; ++s)
+  {
+    for (i = 0; i < GRID_MAX_FIELDS; ++i)
+    {
+      job.cur[i] = g->buf[g->cur][i];
+      job.next[i] = g->buf[g->cur ^ 1][i];
+      if (i < g->num_fields)
+        grid_pad(job.cur[i], g->edge);
+    }
+    if (flags & GRID_PARALLEL)
+      parallel_for_slices(grid_sweep_slices, &job);
+    else
+      grid_sweep_fn(p, job.cur, job.next, 0, LEDS_TANG);
+    g->cur ^= 1;
+  }
+}
+
+
+/*
+  Copy the LEDS_X*LEDS_Y voxels of slice A of field FIELD to V, in the order
+  of a frame_t, eg. for palette_map().
+*/
+void
+grid_get_slice(struct grid *g, uint32_t field, uint32_t a, float *v)
+{
+  const float *f = grid_field(g, field);
+  uint32_t x;
+
+  for (x = 0; x < LEDS_X; ++x)
+    memcpy(v + x*LEDS_Y, f + GRID_IDX(x, 0, a), LEDS_Y*sizeof(*v));
+}
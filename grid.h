@@ -0,0 +1,102 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include "ledtorus_anim.h"
+
+/*
+  Simulations on the LED lattice: cellular automata, diffusion and
+  reaction-diffusion.
+
+  A grid holds up to GRID_MAX_FIELDS float fields over the voxels, twice:
+  each step reads the current buffers and writes the other ones, which then
+  become current. Each field is stored with one cell of padding all around,
+  so that every neighbour of a voxel is at a fixed offset (GRID_DY, GRID_DX,
+  GRID_DA) from it. Before each step the padding is filled in: the slices
+  before the first and after the last are copies of the last and first, so
+  that the tangential direction wraps around as the torus does, and the
+  cells outside in x and y are zero or copies of the nearest voxel, as
+  given by the edge mode. The stencils then run over whole slices as plain
+  loops, without any wrap or edge tests.
+*/
+
+#define GRID_MAX_FIELDS 2
+#define GRID_PY (LEDS_Y+2)
+#define GRID_PX (LEDS_X+2)
+#define GRID_SLICE (GRID_PY*GRID_PX)
+/* Offsets of the neighbours of a cell. */
+#define GRID_DY 1
+#define GRID_DX GRID_PY
+#define GRID_DA GRID_SLICE
+/*
+  Cells before and after the padded slices, so that the diagonal neighbours
+  of the padding cells can be read too (they are never written).
+*/
+#define GRID_MARGIN 16
+#define GRID_CELLS (GRID_SLICE*(LEDS_TANG+2) + 2*GRID_MARGIN)
+
+/* Index of voxel (x, y, a) in a field. */
+#define GRID_IDX(x, y, a) \
+  (GRID_MARGIN + ((y)+1)*GRID_DY + ((x)+1)*GRID_DX + ((a)+1)*GRID_DA)
+
+enum grid_edge {
+  /* Outside is zero (eg. cold walls, dead cells). */
+  GRID_EDGE_ZERO,
+  /* Outside is a copy of the nearest voxel: nothing flows out. */
+  GRID_EDGE_CLAMP
+};
+
+enum grid_rule {
+  /*
+    Field 0 diffuses with rate diffuse[0] (at most 1/6), and decays by the
+    fraction decay each step.
+  */
+  GRID_HEAT,
+  /*
+    Gray-Scott reaction-diffusion of u (field 0) and v (field 1):
+      u' = u + diffuse[0]*lap(u) - u*v*v + feed*(1 - u)
+      v' = v + diffuse[1]*lap(v) + u*v*v - (feed + kill)*v
+  */
+  GRID_GRAY_SCOTT,
+  /*
+    Cellular automaton over the 26 neighbours: field 0 is 1 for live cells,
+    0 for dead ones. A dead cell with n live neighbours comes alive if bit n
+    of birth is set, a live one stays alive if bit n of survive is set.
+  */
+  GRID_LIFE
+};
+
+struct grid_params {
+  enum grid_rule rule;
+  float diffuse[GRID_MAX_FIELDS];
+  float decay;
+  float feed, kill;
+  uint32_t birth, survive;
+};
+
+struct grid {
+  float buf[2][GRID_MAX_FIELDS][GRID_CELLS];
+  /* Index of the current buffers in buf[]. */
+  uint32_t cur;
+  uint32_t num_fields;
+  enum grid_edge edge;
+};
+
+/* Sweep the slices in parallel with parallel_for_slices(). */
+#define GRID_PARALLEL 1
+
+
+/* The current values of field FIELD, indexed with GRID_IDX(). */
+static inline float *
+grid_field(struct grid *g, uint32_t field)
+{
+  return g->buf[g->cur][field];
+}
+
+extern void grid_init(struct grid *g, uint32_t num_fields,
+                      enum grid_edge edge);
+extern void grid_step(struct grid *g, const struct grid_params *p,
+                      uint32_t substeps, uint32_t flags);
+extern void grid_get_slice(struct grid *g, uint32_t field, uint32_t a,
+                           float *v);
+
+#endif  /* GRID_H */
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 
 #include "io.h"
+#include "trace.h"
 
 #define FRAMES 4
 
@@ -36,6 +37,8 @@ static int num_ready_frames= 0;
 static int first_free_frame= 0;
 static int last_free_frame= FRAMES-1;
 uint8_t frames[FRAMES][3*LEDS_X*LEDS_Y*LEDS_TANG];
+/* Generator stamp of each frame in the fifo, zero if the stream has none. */
+static struct frame_stamp frame_stamps[FRAMES];
 
 pthread_mutex_t frames_mutex= PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t frames_cond= PTHREAD_COND_INITIALIZER;
@@ -89,10 +92,13 @@ io_thread_handler(void *app_data __attribute__((unused)))
 {
   /* Frame format is raw framebuffer data padded to multiple of 512 bytes. */
   uint8_t buf[(3*LEDS_X*LEDS_Y*LEDS_TANG+511)/512*512];
+  struct frame_stamp stamp;
 
+  trace_thread_name("io");
   for (;;)
   {
     unsigned sofar= 0;
+    uint64_t t_read= trace_now();
     while (sofar < sizeof(buf))
     {
       ssize_t res= read(0, &(buf[sofar]), sizeof(buf) - sofar);
@@ -117,9 +123,23 @@ io_thread_handler(void *app_data __attribute__((unused)))
       sofar+= res;
     }
 
+    memset(&stamp, 0, sizeof(stamp));
+    if (sizeof(buf) - 3*LEDS_X*LEDS_Y*LEDS_TANG >= sizeof(stamp))
+    {
+      memcpy(&stamp, &buf[3*LEDS_X*LEDS_Y*LEDS_TANG], sizeof(stamp));
+      if (stamp.magic != FRAME_STAMP_MAGIC)
+        memset(&stamp, 0, sizeof(stamp));
+    }
+    uint64_t t_wait= trace_now();
+    trace_span("read", t_read, t_wait, stamp.frame_id);
+
     int slot= get_free_slot();
+    uint64_t t_slot= trace_now();
+    trace_span("ring_wait", t_wait, t_slot, stamp.frame_id);
     memcpy(frames[slot], buf, 3*LEDS_X*LEDS_Y*LEDS_TANG);
+    frame_stamps[slot]= stamp;
     slot_ready();
+    trace_span("ring_put", t_slot, trace_now(), stamp.frame_id);
   }
 
   return NULL;
@@ -127,6 +147,7 @@ io_thread_handler(void *app_data __attribute__((unused)))
 
 
 static uint8_t current_frame[3*LEDS_X*LEDS_Y*LEDS_TANG];
+static struct frame_info current_info;
 static pthread_mutex_t current_frame_mutex= PTHREAD_MUTEX_INITIALIZER;
 
 /*
@@ -146,13 +167,25 @@ framerate_thread_handler(void *app_data __attribute__((unused)))
     exit(1);
   }
   uint64_t frame= 0;
+  trace_thread_name("framerate");
   for (;;)
   {
+    uint64_t t_wait= trace_now();
     int slot= get_ready_slot();
+    uint64_t t_slot= trace_now();
     pthread_mutex_lock(&current_frame_mutex);
     memcpy(current_frame, &(frames[slot]), sizeof(frames[slot]));
+    uint64_t frame_id= frame_stamps[slot].frame_id;
+    current_info.stamp= frame_stamps[slot];
+    ++current_info.seq;
+    current_info.shown_ns= trace_now();
     pthread_mutex_unlock(&current_frame_mutex);
     release_slot();
+    if (trace_enabled)
+    {
+      trace_span("ring_get", t_wait, t_slot, frame_id);
+      trace_span("publish", t_slot, trace_now(), frame_id);
+    }
 
     ++frame;
 
@@ -188,9 +221,11 @@ framerate_thread_handler(void *app_data __attribute__((unused)))
 }
 
 const uint8_t *
-get_current_frame()
+get_current_frame(struct frame_info *info)
 {
   pthread_mutex_lock(&current_frame_mutex);
+  if (info)
+    *info= current_info;
   return &(current_frame[0]);
 }
 
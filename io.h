@@ -1,5 +1,7 @@
 #include <stdint.h>
 
+#include "trace.h"
+
 #define LEDS_X 7
 #define LEDS_Y 8
 #define LEDS_TANG 205
@@ -9,5 +11,13 @@
 
 void start_io_threads();
 
-const uint8_t *get_current_frame();
+struct frame_info {
+  /* Incremented every time a new frame becomes current (first is 1). */
+  uint64_t seq;
+  /* CLOCK_MONOTONIC time at which the frame became current. */
+  uint64_t shown_ns;
+  struct frame_stamp stamp;
+};
+
+const uint8_t *get_current_frame(struct frame_info *info);
 void release_frame();
@@ -3,10 +3,12 @@ INCLUDEPATH += ../shared
 
 HEADERS       = glwidget.h \
                 window.h \
-                io.h
+                io.h \
+                trace.h
 SOURCES       = glwidget.cpp \
                 main.cpp \
                 window.cpp \
                 ledtorus.cpp \
-                io.cpp
+                io.cpp \
+                trace.c
 QT           += opengl
@@ -2,6 +2,7 @@
 #include <stdio.h>
 
 #include <QGLWidget>
+#include <QGLBuffer>
 #include <QVector3D>
 
 #include <qmath.h>
@@ -10,6 +11,7 @@
 
 #include "io.h"
 #include "ledtorus.h"
+#include "trace.h"
 
 
 /*
@@ -27,6 +29,22 @@ static float torus_line_vertices[2*3*LEDS_X*LEDS_Y*LEDS_TANG];
 /* Indices into framebuf/torus_line_vertices. */
 static uint16_t torus_line_indices[2*LEDS_X*LEDS_Y*LEDS_TANG];
 
+/*
+  GPU-side copies. The geometry is uploaded once. The colours are uploaded
+  only when a new LED frame becomes current, alternating between two buffers
+  so that the previous frame stays available for crossfading. Redrawing the
+  same LED frame (eg. at the display refresh rate) thus costs no CPU work.
+*/
+static QGLBuffer vertex_buffer(QGLBuffer::VertexBuffer);
+static QGLBuffer index_buffer(QGLBuffer::IndexBuffer);
+static QGLBuffer colour_buffers[2];
+/* Which of colour_buffers holds the current frame. */
+static int cur_colours = 0;
+static bool have_prev_colours = false;
+/* io sequence number of the frame in colour_buffers[cur_colours]. */
+static uint64_t cur_seq = 0;
+static uint64_t cur_shown_ns = 0;
+
 
 static QVector<QVector3D> vertices;
 static QVector<QVector3D> normals;
@@ -110,7 +128,27 @@ build_geometry()
     }
   }
 
-  cnt_torus_lines = 2*LEDS_X*LEDS_Y*LEDS_TANG;
+  cnt_torus_lines = p - torus_line_indices;
+
+  vertex_buffer.create();
+  vertex_buffer.setUsagePattern(QGLBuffer::StaticDraw);
+  vertex_buffer.bind();
+  vertex_buffer.allocate(torus_line_vertices, sizeof(torus_line_vertices));
+  vertex_buffer.release();
+  index_buffer.create();
+  index_buffer.setUsagePattern(QGLBuffer::StaticDraw);
+  index_buffer.bind();
+  index_buffer.allocate(torus_line_indices,
+                        cnt_torus_lines*sizeof(torus_line_indices[0]));
+  index_buffer.release();
+  for (int i= 0; i < 2; ++i)
+  {
+    colour_buffers[i].create();
+    colour_buffers[i].setUsagePattern(QGLBuffer::DynamicDraw);
+    colour_buffers[i].bind();
+    colour_buffers[i].allocate(framebuf, sizeof(framebuf));
+    colour_buffers[i].release();
+  }
 }
 
 
@@ -118,12 +156,17 @@ static uint8_t
 gamma_correct(uint8_t rgb_component)
 {
   static const float gamma = 0.6f;
-  static float normalise = 0.0f;
-  if (rgb_component == 0)
-    return 0;
-  if (normalise == 0.0f)
-    normalise = 255.0f / powf(255.0f, gamma);
-  return (uint8_t)roundf(normalise*powf(rgb_component, gamma));
+  static uint8_t table[256];
+  static bool table_ready = false;
+  if (!table_ready)
+  {
+    float normalise = 255.0f / powf(255.0f, gamma);
+    table[0] = 0;
+    for (int i= 1; i < 256; ++i)
+      table[i] = (uint8_t)roundf(normalise*powf(i, gamma));
+    table_ready = true;
+  }
+  return table[rgb_component];
 }
 
 
@@ -143,23 +186,92 @@ get_led_colours(const uint8_t *frame)
   memcpy(&framebuf[j], &framebuf[0], 4*LEDS_X*LEDS_Y*LEDS_TANG);
 }
 
-void
-draw_ledtorus()
+/*
+  Upload the colours of the current LED frame, if it changed since last time.
+*/
+static void
+update_led_colours(struct frame_stamp *stamp)
 {
+  struct frame_info info;
   const uint8_t *frame;
+  uint64_t t_start;
+
+  t_start= trace_now();
+  frame= get_current_frame(&info);
+  *stamp= info.stamp;
+  if (info.seq == cur_seq)
+  {
+    release_frame();
+    return;
+  }
+  get_led_colours(frame);
+  release_frame();
+
+  have_prev_colours= (cur_seq != 0);
+  cur_colours= 1 - cur_colours;
+  cur_seq= info.seq;
+  cur_shown_ns= info.shown_ns;
+  colour_buffers[cur_colours].bind();
+  colour_buffers[cur_colours].write(0, framebuf, sizeof(framebuf));
+  colour_buffers[cur_colours].release();
+  trace_span("colours", t_start, trace_now(), stamp->frame_id);
+}
+
+
+static void
+draw_led_lines(int buffer)
+{
+  colour_buffers[buffer].bind();
+  glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+  colour_buffers[buffer].release();
+  glDrawElements(GL_LINES, cnt_torus_lines, GL_UNSIGNED_SHORT, 0);
+}
+
+
+/*
+  Draw the torus. With INTERPOLATE set, crossfade from the previous to the
+  current LED frame over one frame period, in the blend stage. This makes
+  the displayed LEDs lag one frame behind, in exchange for smooth motion at
+  display rates above FRAMERATE.
+*/
+void
+draw_ledtorus(bool interpolate, struct frame_stamp *stamp)
+{
+  update_led_colours(stamp);
 
   glDisable(GL_LIGHTING);
   glEnable(GL_BLEND);
-  glBlendFunc(GL_ONE, GL_ONE);
-  glVertexPointer(3, GL_FLOAT, 0, torus_line_vertices);
+  vertex_buffer.bind();
+  glVertexPointer(3, GL_FLOAT, 0, 0);
+  vertex_buffer.release();
   glEnableClientState(GL_VERTEX_ARRAY);
-  frame= get_current_frame();
-  get_led_colours(frame);
-  release_frame();
-  glColorPointer(4, GL_UNSIGNED_BYTE, 0, framebuf);
   glEnableClientState(GL_COLOR_ARRAY);
   glLineWidth(4.0);
-  glDrawElements(GL_LINES, cnt_torus_lines, GL_UNSIGNED_SHORT, torus_line_indices);
+  index_buffer.bind();
+
+  float mix = 1.0f;
+  if (interpolate && have_prev_colours)
+  {
+    mix = (float)(trace_now() - cur_shown_ns) * (FRAMERATE / 1e9f);
+    if (mix > 1.0f)
+      mix = 1.0f;
+  }
+  if (mix < 1.0f)
+  {
+    /* Additive blend of both frames, weighted by the constant alpha. */
+    glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE);
+    glBlendColor(0.0f, 0.0f, 0.0f, 1.0f - mix);
+    draw_led_lines(1 - cur_colours);
+    glBlendColor(0.0f, 0.0f, 0.0f, mix);
+    draw_led_lines(cur_colours);
+  }
+  else
+  {
+    glBlendFunc(GL_ONE, GL_ONE);
+    draw_led_lines(cur_colours);
+  }
+
+  index_buffer.release();
   glDisableClientState(GL_COLOR_ARRAY);
   glDisableClientState(GL_VERTEX_ARRAY);
   glDisable(GL_BLEND);
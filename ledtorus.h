@@ -1,4 +1,5 @@
 extern int side_length;
 
 void build_geometry();
-void draw_ledtorus();
+struct frame_stamp;
+void draw_ledtorus(bool interpolate, struct frame_stamp *stamp);
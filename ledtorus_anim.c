@@ -7,11 +7,28 @@
 #include <stdio.h>
 #include <math.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "ledtorus_anim.h"
 #include "rubberduck.h"
 #include "simplex_noise.h"
-#include "colours.h"
+#include "trace.h"
+#include "player.h"
+#include "framepool.h"
+#include "slicepool.h"
+#include "sdf.h"
+#include "particles.h"
+#include "splat.h"
+#include "rng.h"
+#include "snapshot.h"
+#include "output.h"
+#include "planar.h"
+#include "composite.h"
+#include "vm.h"
+#include "grid.h"
+#include "palette.h"
 
 
 /*
@@ -50,6 +67,12 @@ static inline struct hsv3 mk_hsv3_f(float h, float s, float v)
 /* Number of migrating dots along one side of the migrating plane. */
 #define MIG_SIDE LEDS_Y
 
+/* Upper limit on the keyframe interval of simplex_noise3_kf. */
+#define NOISE3_KF_MAX_INTERVAL 16
+
+/* Number of particles in the curl_noise flow field. */
+#define CURL_PARTICLES 3000
+
 
 /*
   Union with state data for all animations that need one. This way, a single
@@ -58,38 +81,98 @@ static inline struct hsv3 mk_hsv3_f(float h, float s, float v)
 union anim_data {
   struct st_fireworks {
     uint32_t num_phase1;
-    uint32_t num_phase2;
     struct {
       float x[3],y[3],z[3],vx,vy,vz,s;
       struct hsv3 col;
       uint32_t base_frame, delay;
       float gl_base, gl_period, gl_amp;
     } p1[10];
-    struct {
-      float x,y,z,vx,vy,vz,hue;
-      struct hsv3 col;
-      uint32_t base_frame, delay;
-      float fade_factor;
-    } p2[300];
+    /* The sparks of exploded rockets. */
+    struct particle_set embers;
+    struct splat_buffer hdr;
+    struct rng rng;
   } fireworks;
 
-  struct st_migrating_dots {
-    struct {
-      float x,y,z,v, hue, sat, val, new_hue, new_sat, new_val;
-      int target, delay;
-    } dots[MIG_SIDE*MIG_SIDE];
-    /* 0/1 is bottom/top, 2/3 is left/right, 4/5 is front/back. */
-    int32_t start_plane, end_plane;
-    uint32_t base_frame;
-    uint32_t wait;
-    uint32_t stage1;
-    int text_idx;
-  } migrating_dots[3];
+  struct {
+    struct st_migrating_dots {
+      struct {
+        float x,y,z,v, hue, sat, val, new_hue, new_sat, new_val;
+        int target, delay;
+      } dots[MIG_SIDE*MIG_SIDE];
+      /* 0/1 is bottom/top, 2/3 is left/right, 4/5 is front/back. */
+      int32_t start_plane, end_plane;
+      uint32_t base_frame;
+      uint32_t wait;
+      uint32_t stage1;
+      int text_idx;
+    } section[3];
+    struct splat_buffer hdr;
+    struct rng rng;
+  } migrating_dots;
 
   struct st_rubberduck rubberduck;
+
+  struct st_simplex_noise3_kf {
+    /*
+      Keyframes of the coarse samples of the field (as in
+      ut_coarse_field.samples), at frames k0-interval, k0, k0+interval and
+      k0+2*interval. Ring buffer starting at key[first].
+    */
+    float key[4][LEDS_X][LEDS_TANG*LEDS_Y];
+    uint32_t first;
+    uint32_t k0;
+    uint32_t have_keys;
+    uint32_t interval;
+    /* Smallest interval found to be too long, for no doubling back. */
+    uint32_t failed_interval;
+    float max_error;
+  } simplex_noise3_kf;
+
+  struct st_curl_noise {
+    /* Positions in the coordinates of torus_polar2rect(), y is vertical. */
+    float x[CURL_PARTICLES], y[CURL_PARTICLES], z[CURL_PARTICLES];
+    float hue[CURL_PARTICLES];
+    uint32_t age[CURL_PARTICLES], lifetime[CURL_PARTICLES];
+    struct rng rng;
+  } curl_noise;
+
+  struct vm_program shader;
+
+  struct st_heat {
+    struct grid g;
+    struct palette pal;
+  } heat;
+
+  struct st_gray_scott {
+    struct grid g;
+    /* The default palette, faded in from black. */
+    struct palette pal;
+    struct rng rng;
+  } gray_scott;
+
+  struct st_life3d {
+    struct grid g;
+    /* Brightness of each voxel, fading out after the cell dies. */
+    float glow[LEDS_TANG][LEDS_X][LEDS_Y];
+    /*
+      Live cells in the last two generations, and generations in a row
+      that repeated one of them.
+    */
+    uint32_t population[2], stale;
+    struct rng rng;
+  } life3d;
 };
 
-struct ledtorus_anim;
+
+static struct torus_xz
+ut_polar2rect_float(float x, float a)
+{
+  struct torus_xz res;
+  float angle = a * (F_PI*2.0f/(float)LEDS_TANG);
+  res.x = (x+2.58f)*cosf(angle);
+  res.z = (x+2.58f)*sinf(angle);
+  return res;
+}
 
 
 /*
@@ -99,30 +182,126 @@ struct ledtorus_anim;
 struct torus_xz torus_polar2rect(float x, float a)
 {
   struct torus_xz res;
-  float angle = a * (F_PI*2.0f/(float)LEDS_TANG);
-  res.x = (x+2.58f)*cosf(angle);
-  res.z = (x+2.58f)*sinf(angle);
+  if (USE_FIXED_POINT)
+  {
+    struct torus_xz_fix res_fix =
+      torus_polar2rect_fix(fix16_from_float(x), fix16_from_float(a));
+    res.x = fix16_to_float(res_fix.x);
+    res.z = fix16_to_float(res_fix.z);
+    return res;
+  }
+  return ut_polar2rect_float(x, a);
+}
+
+
+struct torus_xz_fix torus_polar2rect_fix(fix16_t x, fix16_t a)
+{
+  /* One slice is 2**32/LEDS_TANG in the units of fix16_sin_turn(). */
+  static const int64_t slice_angle = ((uint64_t)1 << 32)/LEDS_TANG;
+  struct torus_xz_fix res;
+  uint32_t angle = (uint32_t)((a * slice_angle) >> 16);
+  /* x + 2.58 */
+  fix16_t r = x + 169083;
+  res.x = fix16_mul(r, fix16_cos_turn(angle));
+  res.z = fix16_mul(r, fix16_sin_turn(angle));
   return res;
 }
 
 
+struct torus_tables torus_tab[2];
+int torus_tab_ready[2];
+
+/*
+  Fill in the tables for float (FIXED 0) or fixed-point (FIXED 1) mode. Only
+  rect[] differs between the two; it follows the mode of torus_polar2rect()
+  so that the tables never change what either mode renders.
+*/
+static void
+ut_build_torus_tables(int fixed)
+{
+  struct torus_tables *t = &torus_tab[fixed];
+  uint32_t x, a;
+
+  for (a = 0; a < LEDS_TANG; ++a)
+  {
+    t->cos_a[a] = cosf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
+    t->sin_a[a] = sinf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
+    for (x = 0; x < LEDS_X; ++x)
+    {
+      if (fixed)
+      {
+        struct torus_xz_fix r =
+          torus_polar2rect_fix(fix16_from_float((float)x), fix16_from_float((float)a));
+        t->rect[a][x].x = fix16_to_float(r.x);
+        t->rect[a][x].z = fix16_to_float(r.z);
+      }
+      else
+        t->rect[a][x] = ut_polar2rect_float((float)x, (float)a);
+    }
+  }
+  __atomic_store_n(&torus_tab_ready[fixed], 1, __ATOMIC_RELEASE);
+}
+
+
+static void
+ut_build_torus_tables_float(void)
+{
+  ut_build_torus_tables(0);
+}
+
+
+static void
+ut_build_torus_tables_fix(void)
+{
+  ut_build_torus_tables(1);
+}
+
+
+/* Slow path of torus_tables(); safe to call from several threads at once. */
+void
+torus_tables_build(int fixed)
+{
+  static pthread_once_t once[2] = { PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT };
+  pthread_once(&once[fixed], fixed ? ut_build_torus_tables_fix :
+               ut_build_torus_tables_float);
+}
+
+
+/*
+  Each animation instance seeds its own generator from anim_seed and its
+  name, so a given seed always gives the same course.
+*/
+uint64_t anim_seed = 1;
+
+static void
+ut_rng_init(struct rng *r, const struct ledtorus_anim *self)
+{
+  /* FNV-1a of the name. */
+  uint64_t h = 0xcbf29ce484222325ULL;
+  const char *p;
+
+  for (p = self->name; *p; ++p)
+    h = (h ^ (uint8_t)*p) * 0x100000001b3ULL;
+  rng_seed(r, anim_seed ^ h);
+}
+
 /* Random integer 0 <= x < N. */
 static int
-irand(int n)
+irand(struct rng *r, int n)
 {
-  return rand() / (RAND_MAX/n+1);
+  return (int)rng_below(r, (uint32_t)n);
 }
 
-/* Random float 0 <= x <= N. */
+/* Random float 0 <= x < N. */
 static float
-drand(float n)
+drand(struct rng *r, float n)
 {
-  return (float)rand() / ((float)RAND_MAX/n);
+  return rng_float(r)*n;
 }
 
 /* Random unit vector of length a, uniform distribution in angular space. */
 static void
-vrand(float a, float *x, float *y, float *z)
+vrand(struct rng *r, float a, float *x, float *y, float *z)
 {
   /*
     Sample a random direction uniformly.
@@ -130,15 +309,75 @@ vrand(float a, float *x, float *y, float *z)
     Uses the fact that cylinder projection of the sphere is area preserving,
     so sample uniformly the cylinder, and project onto the sphere.
   */
-  float v = drand(2.0f*F_PI);
-  float u = drand(2.0f) - 1.0f;
-  float r = sqrtf(1.0f - u*u);
-  *x = a*r*cosf(v);
-  *y = a*r*sinf(v);
+  float v = drand(r, 2.0f*F_PI);
+  float u = drand(r, 2.0f) - 1.0f;
+  float rho = sqrtf(1.0f - u*u);
+  *x = a*rho*cosf(v);
+  *y = a*rho*sinf(v);
   *z = a*u;
 }
 
 
+/* Fixed-point (0.1 + 255.8*X), as used for rounding in hsv2rgb_f(). */
+static inline uint8_t
+ut_fix16_to_u8(fix16_t x)
+{
+  return (uint8_t)((FIX16_ONE + 2558*(int64_t)x) / (10*FIX16_ONE));
+}
+
+
+static struct colour3
+hsv2rgb_fix(fix16_t h, fix16_t s, fix16_t v)
+{
+  struct colour3 x;
+  fix16_t c, m, r, g, b;
+
+  c = fix16_mul(v, s);
+  h *= 6;
+  if (h < FIX16_ONE)
+  {
+    r = c;
+    g = fix16_mul(c, h);
+    b = 0;
+  }
+  else if (h < 2*FIX16_ONE)
+  {
+    r = fix16_mul(c, 2*FIX16_ONE - h);
+    g = c;
+    b = 0;
+  }
+  else if (h < 3*FIX16_ONE)
+  {
+    r = 0;
+    g = c;
+    b = fix16_mul(c, h - 2*FIX16_ONE);
+  }
+  else if (h < 4*FIX16_ONE)
+  {
+    r = 0;
+    g = fix16_mul(c, 4*FIX16_ONE - h);
+    b = c;
+  }
+  else if (h < 5*FIX16_ONE)
+  {
+    r = fix16_mul(c, h - 4*FIX16_ONE);
+    g = 0;
+    b = c;
+  }
+  else
+  {
+    r = c;
+    g = 0;
+    b = fix16_mul(c, 6*FIX16_ONE - h);
+  }
+  m = v - c;
+  x.r = ut_fix16_to_u8(r + m);
+  x.g = ut_fix16_to_u8(g + m);
+  x.b = ut_fix16_to_u8(b + m);
+  return x;
+}
+
+
 static struct colour3
 hsv2rgb_f(float h, float s, float v)
 {
@@ -146,6 +385,9 @@ hsv2rgb_f(float h, float s, float v)
   struct colour3 x;
   float c, m, r, g, b;
 
+  if (USE_FIXED_POINT)
+    return hsv2rgb_fix(fix16_from_float(h), fix16_from_float(s),
+                       fix16_from_float(v));
   c = v * s;
   h *= 6.0f;
   if (h < 1.0f)
@@ -355,7 +597,7 @@ g_text(frame_t *f, const char *text, uint32_t x, uint32_t a,
 
 
 void
-envelope(frame_t *f, uint32_t c)
+envelope(struct layer *l, uint32_t c)
 {
   uint32_t a, i;
   uint32_t c2;
@@ -371,33 +613,38 @@ envelope(frame_t *f, uint32_t c)
 
   for (a = 0; a < LEDS_TANG; ++a)
   {
-    setpix(f, 1, 1, a, 0, 0, c_b);
-    setpix(f, 1, 6, a, 0, 0, c_b);
-    setpix(f, 6, 1, a, 0, 0, c_b);
-    setpix(f, 6, 6, a, 0, 0, c_b);
+    layer_setpix(l, 1, 1, a, 0, 0, c_b);
+    layer_setpix(l, 1, 6, a, 0, 0, c_b);
+    layer_setpix(l, 6, 1, a, 0, 0, c_b);
+    layer_setpix(l, 6, 6, a, 0, 0, c_b);
     for (i = 0; i < 4; ++i)
     {
-      setpix(f, 0, i+2, a, 0, 0, c_b);
-      setpix(f, 6, i+2, a, 0, 0, c_b);
-      setpix(f, i+2, 0, a, 0, 0, c_b);
-      setpix(f, i+2, 7, a, 0, 0, c_b);
+      layer_setpix(l, 0, i+2, a, 0, 0, c_b);
+      layer_setpix(l, 6, i+2, a, 0, 0, c_b);
+      layer_setpix(l, i+2, 0, a, 0, 0, c_b);
+      layer_setpix(l, i+2, 7, a, 0, 0, c_b);
     }
   }
 }
 
 
-static void
-an_ghost(frame_t *f, uint32_t c, void *st __attribute__((unused)))
+static uint32_t
+an_ghost(frame_t *f, uint32_t c,
+         union anim_data *data __attribute__((unused)))
 {
   uint32_t a, x;
   float ph;
   uint32_t skip;
+  struct layer env, wave;
+  const struct layer *layers[2] = { &env, &wave };
 
   ph = (float)c * 0.29f;
   skip = (c % 128) < 64;
 
-  cls(f);
-  envelope(f, c);
+  /* The wave is drawn over the envelope. */
+  layer_init(&env, LAYER_ALPHA, 255);
+  layer_init(&wave, LAYER_ALPHA, 255);
+  envelope(&env, c);
   for (x = 0; x < LEDS_X; ++x)
   {
     float w = (float)x * 0.31f + ph;
@@ -413,15 +660,19 @@ an_ghost(frame_t *f, uint32_t c, void *st __attribute__((unused)))
       {
         struct colour3 col;
         col = hsv2rgb_f((float)a*(1.0f/(float)LEDS_TANG), 0.9f, 0.9f);
-        setpix(f, x, i_y, a, col.r, col.g, col.b);
+        layer_setpix(&wave, x, i_y, a, col.r, col.g, col.b);
       }
     }
   }
+  composite(f, layers, 2);
+
+  return 0;
 }
 
 
-static void
-an_test(frame_t *f, uint32_t c, void *st __attribute__((unused)))
+static uint32_t
+an_test(frame_t *f, uint32_t c,
+        union anim_data *data __attribute__((unused)))
 {
   uint32_t x, y, a;
   uint8_t c_r = ((c+5) & 1) ? 255 : 0;
@@ -438,12 +689,14 @@ an_test(frame_t *f, uint32_t c, void *st __attribute__((unused)))
       }
     }
   }
+
+  return 0;
 }
 
 
-static void
+static uint32_t
 an_test2(frame_t *f, uint32_t c __attribute__((unused)),
-         void *st __attribute__((unused)))
+         union anim_data *data __attribute__((unused)))
 {
   uint32_t x, y, a;
 
@@ -461,6 +714,8 @@ an_test2(frame_t *f, uint32_t c __attribute__((unused)),
       }
     }
   }
+
+  return 0;
 }
 
 
@@ -485,8 +740,9 @@ float_to_str(char *buf, float x, uint32_t dig_before, uint32_t dig_after)
   sprintf(buf, "%*.*f", dig_before+dig_after+1, dig_after, (double)x);
 }
 
-static void
-an_supply_voltage(frame_t *f, uint32_t c, void *st __attribute__((unused)))
+static uint32_t
+an_supply_voltage(frame_t *f, uint32_t c,
+                  union anim_data *data __attribute__((unused)))
 {
   char buf[50];
   static float voltage = 0.0f;
@@ -507,335 +763,680 @@ an_supply_voltage(frame_t *f, uint32_t c, void *st __attribute__((unused)))
     stretch = 1.0f;
   a = (2*c)%LEDS_TANG;
   g_text(f, buf, 4, a, 255, 100, 20, stretch);
+
+  return 0;
 }
 
 
+/* Arguments for the parallel_for_slices() part of an animation. */
+struct ut_slice_job {
+  frame_t *f;
+  uint32_t c;
+};
+
+
+/*
+  The noise animations evaluate simplex_noise_3d_n() in batches, laid out in
+  the slice worker's scratch memory.
+*/
+#define UT_NOISE_SLICES 32
+#define UT_NOISE_POINTS (UT_NOISE_SLICES*LEDS_X*LEDS_Y)
+
+struct ut_noise_scratch {
+  float x[UT_NOISE_POINTS];
+  float y[UT_NOISE_POINTS];
+  float z[UT_NOISE_POINTS];
+  float v[UT_NOISE_POINTS];
+  /* Positions and results of ut_coarse_sample(). */
+  float bx[UT_NOISE_POINTS];
+  float by[UT_NOISE_POINTS];
+  float bz[UT_NOISE_POINTS];
+  float sum[UT_NOISE_POINTS];
+};
+typedef char ut_noise_scratch_fits[
+  sizeof(struct ut_noise_scratch) <= SLICE_SCRATCH_SIZE ? 1 : -1];
+
+
+/*
+  Coarse tangential sampling of smooth scalar fields.
+
+  Along the tangential direction, the voxels are spaced 0.08 (innermost) to
+  0.26 (outermost) of the radial and vertical LED spacing. A smooth field
+  evaluated at every voxel is thus oversampled several times. Instead,
+  ut_coarse_sample() evaluates the field at NUM[x] equally spaced angles
+  for each x, chosen to give a tangential spacing of about SPACING, and
+  ut_coarse_value() reconstructs any voxel by linear or cubic (Catmull-Rom)
+  interpolation, wrapping around at LEDS_TANG. At a spacing of 1, this is
+  about 6 times fewer field evaluations.
+*/
+enum ut_upsample { UT_UPSAMPLE_LINEAR, UT_UPSAMPLE_CUBIC };
+
+/*
+  A scalar field at the N points (PX[i], PY[i], PZ[i]), in the coordinates
+  of torus_polar2rect() with y vertical. May use S->x, S->y, S->z and S->v
+  as temporaries.
+*/
+typedef void (*ut_field_fn)(void *arg, const float *px, const float *py,
+                            const float *pz, float *out, uint32_t n,
+                            struct ut_noise_scratch *s);
+
+struct ut_coarse_field {
+  ut_field_fn fn;
+  void *arg;
+  enum ut_upsample mode;
+  /* Samples per revolution for each x. */
+  uint32_t num[LEDS_X];
+  /* Sample k of column x is samples[x][k*LEDS_Y + y]. */
+  float samples[LEDS_X][LEDS_TANG*LEDS_Y];
+};
+
+
 static void
-an_simplex_noise1(frame_t *f, uint32_t c, void *st __attribute__((unused)))
+ut_coarse_init(struct ut_coarse_field *cf, ut_field_fn fn, void *arg,
+               float spacing, enum ut_upsample mode)
 {
-  uint32_t x, y, a;
+  uint32_t x;
 
-  cls(f);
-  for (a = 0; a < LEDS_TANG; a += 4)
+  cf->fn = fn;
+  cf->arg = arg;
+  cf->mode = mode;
+  for (x = 0; x < LEDS_X; ++x)
   {
-    for (x = 0; x < LEDS_X; ++x)
-    {
-      for (y = 0; y < LEDS_Y; ++y)
-      {
-        float sn;
-        float nx, ny, nz;
-
-        nx = (((float)x+2.58f)*0.06f)*cosf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
-        nz = (((float)x+2.58f)*0.06f)*sinf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
-        ny = (float)y*0.06f;
-        nx = nx + (float)c*0.02f;
-        ny = ny + (float)c*0.007f;
-        nz = nz + (float)c*0.005f;
-        //sn = simplex_noise_3d((float)x*0.2f, (float)y*0.2f, (float)(a+5*c)*0.012f);
-        sn = 0.5f*(1.0f+simplex_noise_3d(nx, ny, nz));
-/*
-        if (sn >= 0.0f && sn <= 1.0f)
-        {
-          struct colour3 col3;
-          col3 = hsv2rgb_f(sn, 1.0f, 1.0f);
-          setpix(f, x, y, a, col3.r, col3.g, col3.b);
-        }
-*/
-        if (sn >= 0.4f)
-        {
-          float fi;
-          uint32_t i;
-          fi = (sn-0.3f)*(256/0.5f);
-          if (fi < 0)
-            i = 0;
-          else if (fi > 255)
-            i = 255;
-          else
-            i = (uint32_t)fi;
-          setpix(f, x, y, a, colour_gradient_blue_green_gold[i][0],
-                 colour_gradient_blue_green_gold[i][1],
-                 colour_gradient_blue_green_gold[i][2]);
-        }
-      }
-    }
+    float circumference = 2.0f*F_PI*((float)x + 2.58f);
+    uint32_t num = (uint32_t)ceilf(circumference/spacing);
+    /* At least 4 for the cubic, and no point in more than the voxels. */
+    cf->num[x] = (num < 4 ? 4 : (num > LEDS_TANG ? LEDS_TANG : num));
   }
 }
 
 
+/* Position of coarse sample K of column X, in fractional slices. */
+static inline float
+ut_coarse_angle(const struct ut_coarse_field *cf, uint32_t x, uint32_t k)
+{
+  return (float)k * ((float)LEDS_TANG/(float)cf->num[x]);
+}
+
+
+/*
+  Slice range [A_BEGIN, A_END) computes the coarse samples whose position
+  lies in it, so each sample is done by exactly one worker.
+*/
 static void
-an_simplex_noise2(frame_t *f, uint32_t c, void *st __attribute__((unused)))
+ut_coarse_sample_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                        struct slice_worker *w)
 {
-  uint32_t x, y, a;
+  struct ut_coarse_field *cf = arg;
+  struct ut_noise_scratch *s = w->scratch;
+  uint32_t x, y, k, k_begin, k_end, n;
 
-  cls(f);
-  for (a = 0; a < LEDS_TANG; a += 1)
+  for (x = 0; x < LEDS_X; ++x)
   {
-    for (x = 0; x < LEDS_X; ++x)
+    uint32_t num = cf->num[x];
+
+    k_begin = (a_begin*num + LEDS_TANG - 1)/LEDS_TANG;
+    k_end = (a_end*num + LEDS_TANG - 1)/LEDS_TANG;
+    n = 0;
+    for (k = k_begin; k < k_end; ++k)
     {
+      struct torus_xz rect_xz = torus_polar2rect((float)x,
+                                                 ut_coarse_angle(cf, x, k));
       for (y = 0; y < LEDS_Y; ++y)
       {
-        float sn;
-        float nx, ny, nz;
-
-        nx = (((float)x+2.58f)*0.06f)*cosf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
-        nz = (((float)x+2.58f)*0.06f)*sinf((float)a * (F_PI*2.0f/(float)LEDS_TANG));
-        ny = (float)y*0.06f;
-        nx = nx + (float)c*0.02f;
-        ny = ny + (float)c*0.007f;
-        nz = nz + (float)c*0.005f;
-        //sn = simplex_noise_3d((float)x*0.2f, (float)y*0.2f, (float)(a+5*c)*0.012f);
-        sn = 0.5f*(1.0f+simplex_noise_3d(nx, ny, nz));
-/*
-        if (sn >= 0.0f && sn <= 1.0f)
-        {
-          struct colour3 col3;
-          col3 = hsv2rgb_f(sn, 1.0f, 1.0f);
-          setpix(f, x, y, a, col3.r, col3.g, col3.b);
-        }
-*/
-        if (sn >= 0.4f)
-        {
-          float fi;
-          uint32_t i;
-          fi = (sn-0.4f)*(256/0.5f);
-          if (fi < 0)
-            i = 0;
-          else if (fi > 255)
-            i = 255;
-          else
-            i = (uint32_t)fi;
-          setpix(f, x, y, a, colour_gradient_blue_green_gold[i][0],
-                 colour_gradient_blue_green_gold[i][1],
-                 colour_gradient_blue_green_gold[i][2]);
-        }
+        s->bx[n] = rect_xz.x;
+        s->by[n] = (float)y;
+        s->bz[n] = rect_xz.z;
+        ++n;
       }
     }
+    if (n == 0)
+      continue;
+    (*cf->fn)(cf->arg, s->bx, s->by, s->bz, s->sum, n, s);
+    memcpy(&cf->samples[x][k_begin*LEDS_Y], s->sum, n*sizeof(float));
   }
 }
 
 
 static void
-an_simplex_noise3(frame_t *f, uint32_t c, void *st __attribute__((unused)))
-{
-  /* If tang_spacing > 1, then a dottet appearance results. */
-  static const uint32_t tang_spacing = 1;
-  /* Frequency of first octave. */
-  static const float base_scale = 0.076f;
-  /* Level below which voxel is invisible (interval [-1..1]). */
-  static const float threshold = -0.2f;
-  /* Factor to overshoot intensity, causing some saturation at either end. */
-  static const float saturation_fact = 0.36f/0.6f;
-  /* Relative frequencies of the different noise octaves. */
-  static const float octaves_freq[] = {1.0f, 2.0f, 4.0f};
-  /* Relative amplitude of the different noise octaves. */
-  static const float octaves_ampl[] = {1.0f, 0.6f, 0.36f};
-  uint32_t x, y, a, i;
-  float px, py, pz;
-  float octave_scaling;
-
-  octave_scaling = 0.0f;
-  for (i = 0; i < sizeof(octaves_ampl)/sizeof(octaves_ampl[0]); ++i)
-    octave_scaling += octaves_ampl[i];
-  octave_scaling = 1.0f/octave_scaling;
-
-  /* Base position moving around in the virtual world of the simplex noise. */
-  // ToDo: incremental movement in varying direction.
-  px =(float)c*0.010f;
-  py =(float)c*0.005f;
-  pz =(float)c*0.004f;
+ut_coarse_sample(struct ut_coarse_field *cf)
+{
+  parallel_for_slices(ut_coarse_sample_slices, cf);
+}
 
-  cls(f);
 
-  for (a = 0; a < LEDS_TANG; a += tang_spacing)
-  {
-    for (x = 0; x < LEDS_X; ++x)
-    {
-      for (y = 0; y < LEDS_Y; ++y)
-      {
-        float sn;
-        float nx, ny, nz;
-        struct torus_xz rect_xz;
-
-        rect_xz = torus_polar2rect((float)x, (float)a);
-        nx = base_scale * rect_xz.x;
-        ny = base_scale * (float)y;
-        nz = base_scale * rect_xz.z;
-        // ToDo: Some gentle rotation, eg A*c around X, B*c around Y or something.
-
-        sn = 0.0f;
-        for (i = 0; i < sizeof(octaves_freq)/sizeof(octaves_freq[0]); ++i)
-        {
-          float freq = octaves_freq[i];
-          float amp = octaves_ampl[i];
-          sn += amp*simplex_noise_3d(freq*nx + px, freq*ny + py, freq*nz + pz);
-        }
-        sn *= octave_scaling;
+static inline float
+ut_catmull_rom(float p0, float p1, float p2, float p3, float w)
+{
+  return p1 + 0.5f*w*((p2 - p0) +
+                      w*((2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3) +
+                         w*(3.0f*(p1 - p2) + p3 - p0)));
+}
 
-        if (sn >= threshold)
-        {
-          float fi;
-          uint32_t i;
-          fi = (sn-threshold)*(256/(saturation_fact*(1.0f-threshold)));
-          if (fi < 0)
-            i = 0;
-          else if (fi > 255)
-            i = 255;
-          else
-            i = (uint32_t)fi;
-          setpix(f, x, y, a, colour_gradient_blue_green_gold[i][0],
-                 colour_gradient_blue_green_gold[i][1],
-                 colour_gradient_blue_green_gold[i][2]);
-        }
-      }
-    }
+
+/* The field at voxel (x, y, a), reconstructed from the coarse samples. */
+static inline float
+ut_coarse_value(const struct ut_coarse_field *cf, uint32_t x, uint32_t y,
+                uint32_t a)
+{
+  const float *s = cf->samples[x];
+  uint32_t num = cf->num[x];
+  uint32_t pos = a*num;
+  uint32_t k = pos / LEDS_TANG;
+  uint32_t k1 = (k + 1 == num ? 0 : k + 1);
+  float w = (float)(pos % LEDS_TANG) * (1.0f/(float)LEDS_TANG);
+
+  if (cf->mode == UT_UPSAMPLE_LINEAR)
+    return s[k*LEDS_Y+y] + w*(s[k1*LEDS_Y+y] - s[k*LEDS_Y+y]);
+  else
+  {
+    uint32_t k0 = (k == 0 ? num - 1 : k - 1);
+    uint32_t k2 = (k1 + 1 == num ? 0 : k1 + 1);
+    return ut_catmull_rom(s[k0*LEDS_Y+y], s[k*LEDS_Y+y], s[k1*LEDS_Y+y],
+                          s[k2*LEDS_Y+y], w);
   }
 }
 
 
-/*******************************************************************************
- *
- * Fireworks animation.
- *
- * (Ported from the corresponding LED-cube animation).
- *
- ******************************************************************************/
-
+/*
+  Draw the coarse field CF in slices 0, STEP, 2*STEP, ... (the others are
+  black): evaluate a slice, then map it through the default palette with M.
+*/
 static void
-ut_fireworks_shiftem(struct st_fireworks *c, uint32_t i)
+ut_coarse_draw(frame_t *f, const struct ut_coarse_field *cf, uint32_t step,
+               const struct palette_map *m)
 {
-  uint32_t j;
+  const struct palette *p = palette_default();
+  float v[LEDS_X*LEDS_Y];
+  uint32_t x, y, a;
 
-  for (j = sizeof(c->p1[0].x)/sizeof(c->p1[0].x[0]) - 1; j > 0; --j)
+  if (step > 1)
+    cls(f);
+  for (a = 0; a < LEDS_TANG; a += step)
   {
-    c->p1[i].x[j] = c->p1[i].x[j-1];
-    c->p1[i].y[j] = c->p1[i].y[j-1];
-    c->p1[i].z[j] = c->p1[i].z[j-1];
+    for (x = 0; x < LEDS_X; ++x)
+      for (y = 0; y < LEDS_Y; ++y)
+        v[y+x*LEDS_Y] = ut_coarse_value(cf, x, y, a);
+    palette_map(p, m, v, &(*f)[a*(LEDS_X*LEDS_Y)], LEDS_X*LEDS_Y);
   }
 }
 
 
+/* The field of simplex_noise1 and simplex_noise2, 0..1; ARG is the frame. */
 static void
-ut_fireworks_setpix(frame_t *f, float xf, float yf, float zf, struct hsv3 col)
+ut_noise12_field(void *arg, const float *px, const float *py, const float *pz,
+                 float *out, uint32_t n, struct ut_noise_scratch *s)
 {
-  int x = roundf(xf);
-  int y = roundf(yf*tang_factor);
-  int z = roundf(zf);
-  if (y < 0)
-    y += LEDS_TANG;
-  else if (y >= LEDS_TANG)
-    y -= LEDS_TANG;
-  if (x >= 0 && x < LEDS_X && y >= 0 && y < LEDS_TANG && z >= 0 && z < LEDS_Y)
+  uint32_t c = *(const uint32_t *)arg;
+  uint32_t j;
+
+  for (j = 0; j < n; ++j)
   {
-    struct colour3 rgb =
-      hsv2rgb_f((float)col.h/255.0f, (float)col.s/255.0f, (float)col.v/255.0f);
-    setpix(f, x, (LEDS_Y-1)-z, y, rgb.r, rgb.g, rgb.b);
+    s->x[j] = px[j]*0.06f + (float)c*0.02f;
+    s->y[j] = py[j]*0.06f + (float)c*0.007f;
+    s->z[j] = pz[j]*0.06f + (float)c*0.005f;
   }
+  simplex_noise_3d_n(s->x, s->y, s->z, out, n);
+  for (j = 0; j < n; ++j)
+    out[j] = 0.5f*(1.0f+out[j]);
 }
 
 
 static uint32_t
-in_fireworks(const struct ledtorus_anim *self __attribute__((unused)),
-             union anim_data *data)
+an_simplex_noise1(frame_t *f, uint32_t c,
+                  union anim_data *data __attribute__((unused)))
 {
-  struct st_fireworks *c = &data->fireworks;
-  c->num_phase1 = 0;
-  c->num_phase2 = 0;
+  static const struct palette_map map = { 0.4f, 0.3f, 0.8f };
+  struct ut_coarse_field cf;
+
+  ut_coarse_init(&cf, ut_noise12_field, &c, 1.0f, UT_UPSAMPLE_CUBIC);
+  ut_coarse_sample(&cf);
+  ut_coarse_draw(f, &cf, 4, &map);
+
   return 0;
 }
 
 
 static uint32_t
-an_fireworks(frame_t *f, uint32_t frame, union anim_data *data)
+an_simplex_noise2(frame_t *f, uint32_t c,
+                  union anim_data *data __attribute__((unused)))
 {
-  uint32_t i, j;
+  static const struct palette_map map = { 0.4f, 0.4f, 0.9f };
+  struct ut_coarse_field cf;
 
-  struct st_fireworks *c= &data->fireworks;
+  ut_coarse_init(&cf, ut_noise12_field, &c, 1.0f, UT_UPSAMPLE_CUBIC);
+  ut_coarse_sample(&cf);
+  ut_coarse_draw(f, &cf, 1, &map);
 
-  static const uint32_t max_phase1 = sizeof(c->p1)/sizeof(c->p1[0]);
-  static const uint32_t max_phase2 = sizeof(c->p2)/sizeof(c->p2[0]);
-  static const float g = 0.045f;
-  static const int new_freq = 25;
-  static const float min_height = 4.0f;
-  static const float max_height = 7.0f;
-  static const uint32_t min_start_delay = 32;
-  static const uint32_t max_start_delay = 67;
-  static const uint32_t min_end_delay = 50;
-  static const uint32_t max_end_delay = 100;
-  const float V = 0.5f;
-  static const float resist = 0.11f;
-  static const float min_fade_factor = 0.22f/15.0f;
-  static const float max_fade_factor = 0.27f/15.0f;
+  return 0;
+}
 
-  /* Start a new one occasionally. */
-  if (c->num_phase1 == 0 || (c->num_phase1 < max_phase1 && irand(new_freq) == 0))
-  {
-    i = c->num_phase1++;
 
-    c->p1[i].x[0] = (float)(LEDS_X-1)/2.0f - 1.2f + drand(2.4f);
-    c->p1[i].y[0] = drand((float)LEDS_TANG/tang_factor);
-    c->p1[i].z[0] = 0.0f;
-    for (j = 0; j < sizeof(c->p1[0].x)/sizeof(c->p1[0].x[0]) - 1; ++j)
-      ut_fireworks_shiftem(c, i);
+/* Parameters of simplex_noise3. */
+/* If tang_spacing > 1, then a dottet appearance results. */
+static const uint32_t noise3_tang_spacing = 1;
+/* Frequency of first octave. */
+static const float noise3_base_scale = 0.076f;
+/* Level below which voxel is invisible (interval [-1..1]). */
+static const float noise3_threshold = -0.2f;
+/* Factor to overshoot intensity, causing some saturation at either end. */
+static const float noise3_saturation_fact = 0.36f/0.6f;
+/* Relative frequencies of the different noise octaves. */
+static const float noise3_octaves_freq[] = {1.0f, 2.0f, 4.0f};
+/* Relative amplitude of the different noise octaves. */
+static const float noise3_octaves_ampl[] = {1.0f, 0.6f, 0.36f};
+#define NOISE3_OCTAVES \
+  (sizeof(noise3_octaves_freq)/sizeof(noise3_octaves_freq[0]))
+/* Tangential sample spacing; the top octave needs more than the others. */
+static const float noise3_spacing = 0.5f;
 
-    c->p1[i].vx = drand(0.35f) - 0.175f;
-    c->p1[i].vy = drand(0.35f/tang_factor) - 0.175f/tang_factor;
-    c->p1[i].s = min_height + drand(max_height - min_height);
-    c->p1[i].vz = sqrtf(2*g*c->p1[i].s);
-    c->p1[i].col = mk_hsv3_f(0.8f, 0.0f, 0.5f);
-    c->p1[i].base_frame = frame;
-    c->p1[i].delay = min_start_delay + irand(max_start_delay - min_start_delay);
-    c->p1[i].gl_base = frame;
-    c->p1[i].gl_period = 0;
-  }
 
-  for (i = 0; i < c->num_phase1; )
-  {
-    uint32_t d = frame - c->p1[i].base_frame;
-    if (d < c->p1[i].delay)
-    {
-      /* Waiting for launch - make fuse glow effect. */
-      uint32_t gl_delta = frame - c->p1[i].gl_base;
-      if (gl_delta >= c->p1[i].gl_period)
-      {
-        c->p1[i].gl_base = frame;
-        c->p1[i].gl_period = 8 + irand(6);
-        c->p1[i].gl_amp = 0.7f + drand(0.3f);
-        gl_delta = 0;
-      }
-      float glow = c->p1[i].gl_amp*sin((float)gl_delta/c->p1[i].gl_period*F_PI);
-      c->p1[i].col = mk_hsv3_f(0.8f, 0.0f, 0.44f + 0.31f*glow);
+static float
+ut_noise3_octave_scaling(void)
+{
+  float octave_scaling = 0.0f;
+  uint32_t i;
+
+  for (i = 0; i < NOISE3_OCTAVES; ++i)
+    octave_scaling += noise3_octaves_ampl[i];
+  return 1.0f/octave_scaling;
+}
+
+
+/*
+  Base position moving around in the virtual world of the simplex noise, at
+  time C (the frame number, but may be fractional or negative).
+*/
+static void
+ut_noise3_offset(float c, float *px, float *py, float *pz)
+{
+  // ToDo: incremental movement in varying direction.
+  *px =c*0.010f;
+  *py =c*0.005f;
+  *pz =c*0.004f;
+}
+
+
+/* The field of simplex_noise3; ARG points to the time as a float. */
+static void
+ut_noise3_field(void *arg, const float *px, const float *py, const float *pz,
+                float *out, uint32_t n, struct ut_noise_scratch *s)
+{
+  float ox, oy, oz;
+  float octave_scaling = ut_noise3_octave_scaling();
+  uint32_t i, j;
+
+  ut_noise3_offset(*(const float *)arg, &ox, &oy, &oz);
+  for (j = 0; j < n; ++j)
+    out[j] = 0.0f;
+  // ToDo: Some gentle rotation, eg A*c around X, B*c around Y or something.
+  for (i = 0; i < NOISE3_OCTAVES; ++i)
+  {
+    float freq = noise3_octaves_freq[i]*noise3_base_scale;
+    float amp = noise3_octaves_ampl[i];
+    for (j = 0; j < n; ++j)
+    {
+      s->x[j] = freq*px[j] + ox;
+      s->y[j] = freq*py[j] + oy;
+      s->z[j] = freq*pz[j] + oz;
+    }
+    simplex_noise_3d_n(s->x, s->y, s->z, s->v, n);
+    for (j = 0; j < n; ++j)
+      out[j] += amp*s->v[j];
+  }
+  for (j = 0; j < n; ++j)
+    out[j] *= octave_scaling;
+}
+
+
+/* The field at one point, for spot checks. */
+static float
+ut_noise3_value(float px, float py, float pz, float c)
+{
+  float ox, oy, oz;
+  float sn = 0.0f;
+  uint32_t i;
+
+  ut_noise3_offset(c, &ox, &oy, &oz);
+  for (i = 0; i < NOISE3_OCTAVES; ++i)
+  {
+    float freq = noise3_octaves_freq[i]*noise3_base_scale;
+    sn += noise3_octaves_ampl[i]*
+      simplex_noise_3d(freq*px + ox, freq*py + oy, freq*pz + oz);
+  }
+  return sn * ut_noise3_octave_scaling();
+}
+
+
+static void
+ut_noise3_draw(frame_t *f, const struct ut_coarse_field *cf)
+{
+  struct palette_map map;
+
+  map.threshold = map.lo = noise3_threshold;
+  map.hi = noise3_threshold + noise3_saturation_fact*(1.0f-noise3_threshold);
+  ut_coarse_draw(f, cf, noise3_tang_spacing, &map);
+}
+
+
+static uint32_t
+an_simplex_noise3(frame_t *f, uint32_t c,
+                  union anim_data *data __attribute__((unused)))
+{
+  struct ut_coarse_field cf;
+  float t = (float)c;
+
+  ut_coarse_init(&cf, ut_noise3_field, &t, noise3_spacing, UT_UPSAMPLE_CUBIC);
+  ut_coarse_sample(&cf);
+  ut_noise3_draw(f, &cf);
+
+  return 0;
+}
+
+
+/*
+  simplex_noise3 with keyframes: the coarse samples of the field are only
+  computed every `interval' frames, and interpolated in time in between.
+  Catmull-Rom interpolation through four keyframes is used; the field has
+  kinks that make linear interpolation about 8 times worse at an interval
+  of 8.
+
+  The noise moves slowly, so this is normally invisible. To make sure,
+  whenever a new keyframe comes into use, the interpolation is checked
+  against the true field half-way to the next one, in a sparse set of probe
+  samples. If the error is above max_error, the interval is halved, down to
+  an interval of 1, which costs the same as computing every frame. If it is
+  well below, the interval is doubled, up to NOISE3_KF_MAX_INTERVAL but not
+  back to an interval that failed before. Changing the interval means
+  computing four new keyframes at once.
+*/
+static uint32_t
+in_simplex_noise3_kf(const struct ledtorus_anim *self __attribute__((unused)),
+                     union anim_data *data)
+{
+  struct st_simplex_noise3_kf *c = &data->simplex_noise3_kf;
+
+  /* About 1.5 steps of the colour gradient. */
+  c->max_error = 0.004f;
+  c->interval = 8;
+  c->failed_interval = NOISE3_KF_MAX_INTERVAL*2;
+  c->have_keys = 0;
+  return 0;
+}
+
+
+/* Keyframe J (0..3 for k0-interval .. k0+2*interval). */
+static inline float *
+ut_noise3_kf_key(struct st_simplex_noise3_kf *c, uint32_t j)
+{
+  return &c->key[(c->first + j) & 3][0][0];
+}
+
+
+static void
+ut_noise3_kf_field(struct ut_coarse_field *cf, float *key, float t)
+{
+  ut_coarse_init(cf, ut_noise3_field, &t, noise3_spacing, UT_UPSAMPLE_CUBIC);
+  ut_coarse_sample(cf);
+  memcpy(key, cf->samples, sizeof(cf->samples));
+}
+
+
+/* Start over with keyframe 1 at FRAME. */
+static void
+ut_noise3_kf_restart(struct st_simplex_noise3_kf *c, struct ut_coarse_field *cf,
+                     uint32_t frame)
+{
+  uint32_t j;
+
+  c->first = 0;
+  c->k0 = frame;
+  for (j = 0; j < 4; ++j)
+    ut_noise3_kf_field(cf, &c->key[j][0][0],
+                       (float)frame + ((float)j - 1.0f)*(float)c->interval);
+  c->have_keys = 1;
+}
+
+
+/* Max. error of the interpolated samples half-way between k0 and k1. */
+static float
+ut_noise3_kf_probe(struct st_simplex_noise3_kf *c,
+                   const struct ut_coarse_field *cf)
+{
+  /* Every 17th sample; prime, so the probes spread over x, y and a. */
+  static const uint32_t probe_step = 17;
+  const float *p0 = ut_noise3_kf_key(c, 0), *p1 = ut_noise3_kf_key(c, 1);
+  const float *p2 = ut_noise3_kf_key(c, 2), *p3 = ut_noise3_kf_key(c, 3);
+  float t = (float)c->k0 + 0.5f*(float)c->interval;
+  uint32_t x, idx;
+  float max_err = 0.0f;
+
+  if (c->interval < 2)
+    return 0.0f;
+  for (x = 0; x < LEDS_X; ++x)
+  {
+    for (idx = x; idx < cf->num[x]*LEDS_Y; idx += probe_step)
+    {
+      uint32_t y = idx % LEDS_Y;
+      uint32_t k = idx / LEDS_Y;
+      uint32_t i = x*(LEDS_TANG*LEDS_Y) + idx;
+      struct torus_xz rect_xz =
+        torus_polar2rect((float)x, ut_coarse_angle(cf, x, k));
+      float err = fabsf(ut_noise3_value(rect_xz.x, (float)y, rect_xz.z, t) -
+                        ut_catmull_rom(p0[i], p1[i], p2[i], p3[i], 0.5f));
+      if (err > max_err)
+        max_err = err;
+    }
+  }
+  return max_err;
+}
+
+
+static void
+ut_noise3_kf_adapt(struct st_simplex_noise3_kf *c, struct ut_coarse_field *cf)
+{
+  for (;;)
+  {
+    float err = ut_noise3_kf_probe(c, cf);
+    if (err > c->max_error && c->interval > 1)
+    {
+      c->failed_interval = c->interval;
+      c->interval /= 2;
+    }
+    else if (err < c->max_error*(1.0f/16.0f) &&
+             2*c->interval < c->failed_interval &&
+             c->interval < NOISE3_KF_MAX_INTERVAL)
+      c->interval *= 2;
+    else
+      break;
+    ut_noise3_kf_restart(c, cf, c->k0);
+  }
+}
+
+
+static uint32_t
+an_simplex_noise3_kf(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  struct st_simplex_noise3_kf *c = &data->simplex_noise3_kf;
+  struct ut_coarse_field cf;
+  const float *p0, *p1, *p2, *p3;
+  float *s;
+  float w, t;
+  uint32_t i;
+
+  if (c->have_keys && frame == c->k0 + c->interval)
+  {
+    /* Move on to the next keyframe; the oldest one is replaced. */
+    ut_noise3_kf_field(&cf, ut_noise3_kf_key(c, 0),
+                       (float)c->k0 + 3.0f*(float)c->interval);
+    c->first = (c->first + 1) & 3;
+    c->k0 += c->interval;
+    ut_noise3_kf_adapt(c, &cf);
+  }
+  else if (!c->have_keys || frame < c->k0 || frame >= c->k0 + c->interval)
+  {
+    ut_noise3_kf_restart(c, &cf, frame);
+    ut_noise3_kf_adapt(c, &cf);
+  }
+
+  /* Interpolate the samples in time, then reconstruct as usual. */
+  t = (float)frame;
+  ut_coarse_init(&cf, ut_noise3_field, &t, noise3_spacing, UT_UPSAMPLE_CUBIC);
+  p0 = ut_noise3_kf_key(c, 0);
+  p1 = ut_noise3_kf_key(c, 1);
+  p2 = ut_noise3_kf_key(c, 2);
+  p3 = ut_noise3_kf_key(c, 3);
+  s = &cf.samples[0][0];
+  w = (float)(frame - c->k0) / (float)c->interval;
+  for (i = 0; i < LEDS_X*LEDS_TANG*LEDS_Y; ++i)
+    s[i] = ut_catmull_rom(p0[i], p1[i], p2[i], p3[i], w);
+  ut_noise3_draw(f, &cf);
+
+  return 0;
+}
+
+
+/*******************************************************************************
+ *
+ * Fireworks animation.
+ *
+ * (Ported from the corresponding LED-cube animation).
+ *
+ ******************************************************************************/
+
+static void
+ut_fireworks_shiftem(struct st_fireworks *c, uint32_t i)
+{
+  uint32_t j;
+
+  for (j = sizeof(c->p1[0].x)/sizeof(c->p1[0].x[0]) - 1; j > 0; --j)
+  {
+    c->p1[i].x[j] = c->p1[i].x[j-1];
+    c->p1[i].y[j] = c->p1[i].y[j-1];
+    c->p1[i].z[j] = c->p1[i].z[j-1];
+  }
+}
+
+
+/* Add a rocket trail point; Y is in units of LEDs (see tang_factor). */
+static void
+ut_fireworks_splat(struct splat_buffer *hdr, float xf, float yf, float zf,
+                   struct hsv3 col)
+{
+  float v = (float)col.v/255.0f;
+  float chroma = v*((float)col.s/255.0f);
+  float h6 = 6.0f*((float)col.h/255.0f);
+
+  splat_point(hdr, xf, (float)(LEDS_Y-1) - zf, yf*tang_factor,
+              splat_hsv_channel(5.0f, h6, v, chroma),
+              splat_hsv_channel(3.0f, h6, v, chroma),
+              splat_hsv_channel(1.0f, h6, v, chroma));
+}
+
+
+static uint32_t
+in_fireworks(const struct ledtorus_anim *self, union anim_data *data)
+{
+  struct st_fireworks *c = &data->fireworks;
+  ut_rng_init(&c->rng, self);
+  c->num_phase1 = 0;
+  particles_init(&c->embers);
+  return 0;
+}
+
+
+static uint32_t
+an_fireworks(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  uint32_t i, j;
+
+  struct st_fireworks *c= &data->fireworks;
+
+  static const uint32_t max_phase1 = sizeof(c->p1)/sizeof(c->p1[0]);
+  static const float g = 0.045f;
+  static const int new_freq = 25;
+  static const float min_height = 4.0f;
+  static const float max_height = 7.0f;
+  static const uint32_t min_start_delay = 32;
+  static const uint32_t max_start_delay = 67;
+  static const uint32_t min_end_delay = 50;
+  static const uint32_t max_end_delay = 100;
+  const float V = 0.5f;
+  static const float resist = 0.11f;
+  static const float min_fade_factor = 0.22f/15.0f;
+  static const float max_fade_factor = 0.27f/15.0f;
+  const struct particle_params ember_params = { g, resist, 0.0f, 0.05f };
+  struct particle_set *e = &c->embers;
+
+  /* Start a new one occasionally. */
+  if (c->num_phase1 == 0 || (c->num_phase1 < max_phase1 && irand(&c->rng, new_freq) == 0))
+  {
+    i = c->num_phase1++;
+
+    c->p1[i].x[0] = (float)(LEDS_X-1)/2.0f - 1.2f + drand(&c->rng, 2.4f);
+    c->p1[i].y[0] = drand(&c->rng, (float)LEDS_TANG/tang_factor);
+    c->p1[i].z[0] = 0.0f;
+    for (j = 0; j < sizeof(c->p1[0].x)/sizeof(c->p1[0].x[0]) - 1; ++j)
+      ut_fireworks_shiftem(c, i);
+
+    c->p1[i].vx = drand(&c->rng, 0.35f) - 0.175f;
+    c->p1[i].vy = drand(&c->rng, 0.35f/tang_factor) - 0.175f/tang_factor;
+    c->p1[i].s = min_height + drand(&c->rng, max_height - min_height);
+    c->p1[i].vz = sqrtf(2*g*c->p1[i].s);
+    c->p1[i].col = mk_hsv3_f(0.8f, 0.0f, 0.5f);
+    c->p1[i].base_frame = frame;
+    c->p1[i].delay = min_start_delay + irand(&c->rng, max_start_delay - min_start_delay);
+    c->p1[i].gl_base = frame;
+    c->p1[i].gl_period = 0;
+  }
+
+  for (i = 0; i < c->num_phase1; )
+  {
+    uint32_t d = frame - c->p1[i].base_frame;
+    if (d < c->p1[i].delay)
+    {
+      /* Waiting for launch - make fuse glow effect. */
+      uint32_t gl_delta = frame - c->p1[i].gl_base;
+      if (gl_delta >= c->p1[i].gl_period)
+      {
+        c->p1[i].gl_base = frame;
+        c->p1[i].gl_period = 8 + irand(&c->rng, 6);
+        c->p1[i].gl_amp = 0.7f + drand(&c->rng, 0.3f);
+        gl_delta = 0;
+      }
+      float glow = c->p1[i].gl_amp*sin((float)gl_delta/c->p1[i].gl_period*F_PI);
+      c->p1[i].col = mk_hsv3_f(0.8f, 0.0f, 0.44f + 0.31f*glow);
       ++i;
     }
     else if (c->p1[i].z[0] > c->p1[i].s)
     {
       /* Kaboom! */
       /* Delete this one, and create a bunch of phase2 ones (if room). */
-      int k = 10 + irand(20);
-      float common_hue = drand(6.5f);
+      int k = 10 + irand(&c->rng, 20);
+      float common_hue = drand(&c->rng, 6.5f);
       while (k-- > 0)
       {
-        if (c->num_phase2 >= max_phase2)
-          break;            /* No more room */
-        j = c->num_phase2++;
+        float vx, vy, vz, fade;
+        int32_t idx = particles_add(e);
 
+        if (idx < 0)
+          break;            /* No more room */
         /* Sample a random direction uniformly. */
-        float vx;
-        float vy;
-        float vz;
-        vrand(V, &vx, &vy, &vz);
-
-        c->p2[j].x = c->p1[i].x[0];
-        c->p2[j].y = c->p1[i].y[0];
-        c->p2[j].z = c->p1[i].z[0];
-        c->p2[j].vx = c->p1[i].vx + vx;
-        c->p2[j].vy = c->p1[i].vy + vy;
-        c->p2[j].vz = c->p1[i].vz + vz;
-        c->p2[j].hue = common_hue < 6.0f? common_hue : drand(6.0f);
-        c->p2[j].col = mk_hsv3_f(c->p2[j].hue, 0.85f, 1.0f);
-        c->p2[j].base_frame = frame;
-        c->p2[j].delay = min_end_delay + irand(max_end_delay - min_end_delay);
-        c->p2[j].fade_factor =
-          min_fade_factor + drand(max_fade_factor - min_fade_factor);
+        vrand(&c->rng, V, &vx, &vy, &vz);
+
+        e->x[idx] = c->p1[i].x[0];
+        e->y[idx] = c->p1[i].y[0]*tang_factor;
+        e->z[idx] = c->p1[i].z[0];
+        e->vx[idx] = c->p1[i].vx + vx;
+        e->vy[idx] = (c->p1[i].vy + vy)*tang_factor;
+        e->vz[idx] = c->p1[i].vz + vz;
+        e->hue[idx] = (common_hue < 6.0f ? common_hue : drand(&c->rng, 6.0f))/6.0f;
+        e->sat[idx] = 0.85f;
+        e->ground_frames[idx] =
+          min_end_delay + irand(&c->rng, max_end_delay - min_end_delay);
+        fade = min_fade_factor + drand(&c->rng, max_fade_factor - min_fade_factor);
+        e->fade[idx] = fade;
+        /* So that it is at full brightness after the update below. */
+        e->val[idx] = 1.0f + fade;
       }
       c->p1[i] = c->p1[--c->num_phase1];
     }
@@ -851,53 +1452,26 @@ an_fireworks(frame_t *f, uint32_t frame, union anim_data *data)
     }
   }
 
-  for (i = 0; i < c->num_phase2;)
-  {
-    c->p2[i].x += c->p2[i].vx;
-    c->p2[i].y += c->p2[i].vy;
-    c->p2[i].z += c->p2[i].vz;
-
-    c->p2[i].vx -= resist*c->p2[i].vx;
-    c->p2[i].vy -= resist*c->p2[i].vy;
-    c->p2[i].vz -= resist*c->p2[i].vz + g;
-
-    float value = 1.0f - c->p2[i].fade_factor*(frame - c->p2[i].base_frame);
-    if (value < 0.0f)
-      value = 0.0f;
-    c->p2[i].col = mk_hsv3_f(c->p2[i].hue, 0.85f, value);
-
-    if (c->p2[i].z <= 0.0f)
-    {
-      c->p2[i].z = 0.0f;
-      if (c->p2[i].delay-- == 0 || value <= 0.05f)
-      {
-        /* Delete it. */
-        c->p2[i] = c->p2[--c->num_phase2];
-      }
-      else
-        ++i;
-    }
-    else
-      ++i;
-  }
+  particles_update(e, &ember_params);
 
-  cls(f);
+  splat_clear(&c->hdr);
   /* Mark out the "ground". */
   for (i = 0; i < LEDS_TANG; ++i)
     for (j = 2; j < LEDS_X-2; ++j)
-      setpix(f, j, LEDS_Y-1, i, 0, 0, 17);
+      splat_point(&c->hdr, j, LEDS_Y-1, i, 0.0f, 0.0f, 17.0f/255.0f);
 
   /*
-    Draw stage2 first, so we don't overwrite a new rocket with an old, dark
-    ember.
+    Everything adds up in the buffer, with a soft shoulder in the tone
+    mapping for where many sparks overlap.
   */
-  for (i = 0; i < c->num_phase2; ++i)
-    ut_fireworks_setpix(f, c->p2[i].x, c->p2[i].y, c->p2[i].z, c->p2[i].col);
+  particles_splat(e, &c->hdr);
   for (i = 0; i < c->num_phase1; ++i)
   {
     for (j = 0; j < sizeof(c->p1[0].x)/sizeof(c->p1[0].x[0]); ++j)
-      ut_fireworks_setpix(f, c->p1[i].x[j], c->p1[i].y[j], c->p1[i].z[j], c->p1[i].col);
+      ut_fireworks_splat(&c->hdr, c->p1[i].x[j], c->p1[i].y[j], c->p1[i].z[j],
+                         c->p1[i].col);
   }
+  splat_tonemap(&c->hdr, f, 0.8f);
 
   return 0;
 }
@@ -978,12 +1552,12 @@ ut_migrating_dots_get_colour(struct st_migrating_dots *c, int idx,
 
 
 static uint32_t
-in_migrating_dots(const struct ledtorus_anim *self __attribute__((unused)),
-                  union anim_data *data)
+in_migrating_dots(const struct ledtorus_anim *self, union anim_data *data)
 {
-  struct st_migrating_dots *c = &data->migrating_dots[0];
+  struct st_migrating_dots *c = &data->migrating_dots.section[0];
   uint32_t i, j;
 
+  ut_rng_init(&data->migrating_dots.rng, self);
   for (j = 0; j < 3; ++j)
   {
     c->end_plane = 1;         /* Top; we will copy this to start_plane below. */
@@ -1017,8 +1591,10 @@ an_migrating_dots(frame_t *f, uint32_t frame, union anim_data *data)
   uint32_t stage_pause;
   uint32_t section = 0;
 
-  struct st_migrating_dots *c = &data->migrating_dots[0];
-  cls(f);
+  struct st_migrating_dots *c = &data->migrating_dots.section[0];
+  struct splat_buffer *hdr = &data->migrating_dots.hdr;
+  struct rng *rng = &data->migrating_dots.rng;
+  splat_clear(hdr);
 
 next_section:
 
@@ -1034,13 +1610,13 @@ next_section:
       c->stage1 = 0;
       for (i = 0; i < MIG_SIDE*MIG_SIDE; ++i)
       {
-        c->dots[i].delay = irand(start_spread);
+        c->dots[i].delay = irand(rng, start_spread);
         if (c->end_plane == 0)
           c->dots[i].v = 0;
         else if (c->end_plane == 1)
-          c->dots[i].v = 1.4f + drand(v_range);
+          c->dots[i].v = 1.4f + drand(rng, v_range);
         else
-          c->dots[i].v = (2*(c->end_plane%2)-1) * (v_min + drand(v_range));
+          c->dots[i].v = (2*(c->end_plane%2)-1) * (v_min + drand(rng, v_range));
         c->dots[i].target = (MIG_SIDE-1)*(c->end_plane%2);
       }
     }
@@ -1056,7 +1632,7 @@ next_section:
         opposite.
       */
       do
-        c->end_plane = irand(6);
+        c->end_plane = irand(rng, 6);
       while ((c->end_plane/2) == (c->start_plane/2));
 
       /* Choose a letter to show, or blank. */
@@ -1088,7 +1664,7 @@ next_section:
         int num_left = MIG_SIDE;
         for (j = 0; j < MIG_SIDE; ++j)
         {
-          int k = irand(num_left);
+          int k = irand(rng, num_left);
           c->dots[idx].target = permute[k];
           permute[k] = permute[--num_left];
           int m = (MIG_SIDE-1)*(c->start_plane%2);
@@ -1134,7 +1710,7 @@ next_section:
             c->dots[idx].y = m;
             break;
           }
-          c->dots[idx].delay = irand(start_spread);
+          c->dots[idx].delay = irand(rng, start_spread);
           c->dots[idx].hue = c->dots[idx].new_hue;
           c->dots[idx].sat = c->dots[idx].new_sat;
           c->dots[idx].val = c->dots[idx].new_val;
@@ -1153,10 +1729,10 @@ next_section:
           if (c->start_plane == 1)
             c->dots[idx].v = 0;
           else if (c->start_plane == 0)
-            c->dots[idx].v = 1.4f + drand(v_range);
+            c->dots[idx].v = 1.4f + drand(rng, v_range);
           else
             c->dots[idx].v =
-              (1.0f-(float)(2*(c->start_plane%2))) * (v_min + drand(v_range));
+              (1.0f-(float)(2*(c->start_plane%2))) * (v_min + drand(rng, v_range));
           ++idx;
         }
       }
@@ -1211,8 +1787,7 @@ next_section:
     float x = c->dots[i].x;
     float y = c->dots[i].y*tang_factor;
     float z = c->dots[i].z;
-    int ix, iy, iz;
-    float hue, sat, val;
+    float hue, sat, val, h6, chroma;
     if (c->stage1)
     {
       hue = c->dots[i].hue;
@@ -1255,43 +1830,17 @@ next_section:
         z = (float)(LEDS_Y-2);
     }
 
-    float x1, x2, y1, y2, z1, z2, in1, in2;
-    switch (plane/2)
-    {
-    case 0:
-      x1 = x2 = roundf(x);
-      y1 = y2 = roundf(y);
-      z1 = floorf(z);
-      z2 = ceilf(z);
-      in1 = z2 - z;
-      break;
-    case 1:
-      x1 = floorf(x);
-      x2 = ceilf(x);
-      y1 = y2 = roundf(y);
-      z1 = z2 = roundf(z);
-      in1 = x2 - x;
-      break;
-    default:  /* case 2 */
-      x1 = x2 = roundf(x);
-      y1 = floorf(y);
-      y2 = ceilf(y);
-      z1 = z2 = roundf(z);
-      in1 = y2 - y;
-      break;
-    }
-    in2 = 1.0f - in1;
-
-    struct colour3 rgb = hsv2rgb_f(hue, sat, in1*val);
-    ix = x1; iy = y1 + y_shift; iz = (LEDS_Y-1) - z1;
-    if (ix >= 0 && ix < LEDS_X && iz >= 0 && iz < LEDS_Y &&
-        iy >= 0 && iy < LEDS_TANG)
-      setpix(f, ix, iz, iy, rgb.r, rgb.g, rgb.b);
-    rgb = hsv2rgb_f(hue, sat, in2*val);
-    ix = x2; iy = y2 + y_shift; iz = (LEDS_Y-1) - z2;
-    if (ix >= 0 && ix < LEDS_X && iz >= 0 && iz < LEDS_Y &&
-        iy >= 0 && iy < LEDS_TANG)
-      setpix(f, ix, iz, iy, rgb.r, rgb.g, rgb.b);
+    /*
+      Spread trilinearly over the 8 voxels around the point (wrapping
+      around the torus) in the HDR buffer, which is tone-mapped once all
+      dots are in.
+    */
+    h6 = 6.0f*hue;
+    chroma = val*sat;
+    splat_point(hdr, x, (float)(LEDS_Y-1) - z, y + (float)y_shift,
+                splat_hsv_channel(5.0f, h6, val, chroma),
+                splat_hsv_channel(3.0f, h6, val, chroma),
+                splat_hsv_channel(1.0f, h6, val, chroma));
   }
 
   ++c;
@@ -1299,55 +1848,11 @@ next_section:
   if (section < 3)
     goto next_section;
 
+  splat_tonemap(hdr, f, 1.0f);
   return 0;
 }
 
 
-static void
-ut_sphere(frame_t *f, float x, float y, float a, float r, struct colour3 col)
-{
-  float x0 = floorf(x - r);
-  float x1 = ceilf(x + r);
-  float y0 = floorf(y - r);
-  float y1 = ceilf(y + r);
-  float a0 = floorf(a - r*tang_factor);
-  float a1 = ceilf(a + r*tang_factor);
-  float xi0, xi, xi1, yi0, yi, yi1, ai0, ai, ai1;
-  float r0_2 = (r-0.5f)*(r-0.5f);
-  float r1_2 = (r+0.5f)*(r+0.5f);
-  float r1 = sqrtf(r1_2);
-
-  xi0 =  x0 < 0.0f ? 0.0f : x0;
-  xi1 = x1 > (float)(LEDS_X-1) ? (float)(LEDS_X-1) : x1;
-  yi0 = y0 < 0.0f ? 0.0f : y0;
-  yi1 = y1 > (float)(LEDS_Y-1) ? (float)(LEDS_Y-1) : y1;
-  ai0 = a0;// < 0.0f ? a0 + (float)LEDS_TANG : a0;
-  ai1 = a1;// > (float)(LEDS_TANG-1) ? a1 - (float)LEDS_TANG : a1;
-
-  for (xi = xi0; xi <= xi1; ++xi)
-  {
-    for (yi = yi0; yi <= yi1; ++yi)
-    {
-      for (ai = ai0; ai <= ai1; ai+=4)
-      {
-        float a_adj = ai < 0.0f ? ai+LEDS_TANG : (ai > LEDS_TANG-1 ? ai - LEDS_TANG : ai);
-        float dx = x - xi;
-        float dy = y - yi;
-        float da = (a - a_adj)/tang_factor;
-        float d2 = dx*dx + dy*dy + da*da;
-        if (d2 < r0_2)
-          setpix(f, xi, yi, a_adj, col.r, col.g, col.b);
-        else if (d2 < r1_2)
-        {
-          float diff = r1 - sqrtf(d2);
-          setpix(f, xi, yi, a_adj, col.r*diff, col.g*diff, col.b*diff);
-        }
-      }
-    }
-  }
-}
-
-
 static uint32_t
 in_spheretest(const struct ledtorus_anim *self __attribute__((unused)),
               union anim_data *data)
@@ -1360,74 +1865,41 @@ static uint32_t
 an_spheretest(frame_t *f, uint32_t frame,
               union anim_data *data __attribute__((unused)))
 {
+  struct sdf_scene scene;
+  struct torus_xz pos;
+  struct colour3 col;
   float r, y, a;
 
   cls(f);
   r = 0.8f + fabsf((float)(frame % 256) - 127.5f)*(1.85f/127.5f);
   a = (3*frame) % LEDS_TANG;
   y = (float)LEDS_Y/2.0f + 2.7f*sinf((float)(frame %165)*(2.0f*F_PI/165.0f));
-  ut_sphere(f, 3, y, a, r, hsv2rgb_f(0.33f, 1.0f, 1.0f));
+  pos = torus_polar2rect(3, a);
+  col = hsv2rgb_f(0.33f, 1.0f, 1.0f);
+  sdf_scene_init(&scene);
+  sdf_add_object(&scene, sdf_sphere(&scene, pos.x, y, pos.z, r),
+                 col.r, col.g, col.b, 0.0f, 1.0f);
+  sdf_render(&scene, f);
   return 0;
 }
 
 
-/*
-  Distance from point (x,y,z) to plane with normal (nx,ny,nz) and passing
-  through the point (x0,y0,z0). The normal should be of unit length.
-
-  Returns the signed distance, which is positive if the point is on the side
-  of the plane pointed to by the normal.
-*/
-static float
-dist_point_plane(float x, float y, float z,
-                 float nx, float ny, float nz,
-                 float x0, float y0, float z0)
-{
-  float dx = x - x0;
-  float dy = y - y0;
-  float dz = z - z0;
-  return nx*dx + ny*dy + nz*dz;
-}
-
-
 static uint32_t
 an_planetest(frame_t *f, uint32_t frame,
              union anim_data *data __attribute__((unused)))
 {
   static const float thick = 0.23f;
-  uint32_t i, j, k;
-  float x, y, z;
-  float dist;
-  float nx = 3, ny = 8, nz = 1;
-  float norm = sqrtf(nx*nx + ny*ny + nz*nz);
-
-  nx /= norm; ny /= norm; nz /= norm;
+  struct sdf_scene scene;
 
   cls(f);
-  for (k = 0; k < LEDS_TANG; ++k)
-  {
-    for (i = 0; i < LEDS_X; ++i)
-    {
-      struct torus_xz rect_xz;
-
-      rect_xz = torus_polar2rect((float)i, (float)k);
-      x = rect_xz.x;
-      z = rect_xz.z;
-      for (j = 0; j < LEDS_Y; ++j)
-      {
-        y = j;
-
-        dist = dist_point_plane(x, y, z,
-                                nx, ny, nz,
-                                0, 3, 0);
-        if (fabsf(dist) > -thick && fabsf(dist) < thick)
-        {
-          struct colour3 col = hsv2rgb_f(0.0f, 0.0f, 1.0f-(1.0f/thick)*fabs(dist));
-          setpix(f, i, j, k, col.r, col.g, col.b);
-        }
-      }
-    }
-  }
+  sdf_scene_init(&scene);
+  /*
+    A shell of half-thickness thick/2 with an antialiasing ramp of width
+    thick fades linearly from 1 on the plane to 0 at distance thick.
+  */
+  sdf_add_object(&scene, sdf_plane(&scene, 3, 8, 1, 0, 3, 0),
+                 255, 255, 255, 0.5f*thick, thick);
+  sdf_render(&scene, f);
 
   return 0;
 }
@@ -1437,30 +1909,26 @@ static uint32_t
 an_testimg1(frame_t *f, uint32_t frame,
             union anim_data *data __attribute__((unused)))
 {
-  uint32_t i, j, k;
-  struct colour3 col;
-
-  cls(f);
+  struct planar_frame p;
+  float dummy;
+  float hue, sat;
+  uint32_t k;
+
+  /* The colour only depends on the slice, so each is one fill. */
+  hue = modff((float)frame/(25.0f*13.0f), &dummy);
+  sat = 1 - powf(modff((float)frame/(25.0f*29.0f), &dummy), 2.3f);
+  sat = 0.5f + fabsf(sat-0.5f);
   for (k = 0; k < LEDS_TANG; ++k)
   {
-    for (i = 0; i < LEDS_X; ++i)
-    {
-      for (j = 0; j < LEDS_Y; ++j)
-      {
-        float dummy;
-        float hue, sat, val;
-
-        hue = modff((float)frame/(25.0f*13.0f), &dummy);
-        sat = 1 - powf(modff((float)frame/(25.0f*29.0f), &dummy), 2.3f);
-        sat = 0.5f + fabsf(sat-0.5f);
-        val = (float)k/((float)LEDS_TANG/1.08f);
-        if (val > 1.0f)
-          val = 0.0f;
-        col = hsv2rgb_f(hue, sat, val);
-        setpix(f, i, j, k, col.r, col.g, col.b);
-      }
-    }
+    float val = (float)k/((float)LEDS_TANG/1.08f);
+    struct colour3 col;
+
+    if (val > 1.0f)
+      val = 0.0f;
+    col = hsv2rgb_f(hue, sat, val);
+    planar_fill_slices(&p, k, k+1, col.r, col.g, col.b);
   }
+  planar_interleave(f, &p);
 
   return 0;
 }
@@ -1483,86 +1951,1329 @@ an_rubberduck(frame_t *f, uint32_t frame, union anim_data *data)
 }
 
 
-int
-main(int argc, char *argv[])
+/*
+  Particles advected by curl noise. The velocity is the curl of a vector
+  potential made of three simplex noise fields, which makes the flow
+  divergence-free: particles swirl around without bunching up or thinning
+  out. With the analytic gradients, this costs three noise evaluations per
+  particle instead of the 18 of finite differences.
+*/
+static void
+ut_curl_noise_spawn(struct st_curl_noise *c, uint32_t i)
 {
-  uint32_t n;
-  frame_t frame;
-  static union anim_data private_data;
+  float r = 2.58f + drand(&c->rng, (float)(LEDS_X-1));
+  float angle = drand(&c->rng, 2.0f*F_PI);
+  c->x[i] = r*cosf(angle);
+  c->z[i] = r*sinf(angle);
+  c->y[i] = drand(&c->rng, (float)(LEDS_Y-1));
+  c->hue[i] = 0.45f + drand(&c->rng, 0.3f);
+  c->age[i] = 0;
+  c->lifetime[i] = 50 + irand(&c->rng, 200);
+}
+
 
-  for (n = 0; n < 5000; ++n)
+static uint32_t
+in_curl_noise(const struct ledtorus_anim *self, union anim_data *data)
+{
+  struct st_curl_noise *c = &data->curl_noise;
+  uint32_t i;
+
+  ut_rng_init(&c->rng, self);
+  for (i = 0; i < CURL_PARTICLES; ++i)
   {
-    uint8_t buf[512];
-    uint16_t len = sizeof(frame_t);
+    ut_curl_noise_spawn(c, i);
+    /* Spread out the ages, so they do not all die at once. */
+    c->age[i] = irand(&c->rng, c->lifetime[i]);
+  }
+  return 0;
+}
+
 
-    switch (argc > 1 ? atoi(argv[1]) : 0)
+/* Saturating add of a colour to a pixel. */
+static inline void
+ut_addpix(frame_t *f, uint32_t x, uint32_t y, uint32_t a, struct colour3 col)
+{
+  uint8_t *p = (*f)[y+x*LEDS_Y+a*(LEDS_Y*LEDS_X)];
+  uint32_t r = p[0] + col.r, g = p[1] + col.g, b = p[2] + col.b;
+  p[0] = (r > 255 ? 255 : r);
+  p[1] = (g > 255 ? 255 : g);
+  p[2] = (b > 255 ? 255 : b);
+}
+
+
+static uint32_t
+an_curl_noise(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  /* Spatial frequency of the noise. */
+  static const float scale = 0.11f;
+  /* Speed of the particles, LED spacings per frame. */
+  static const float speed = 0.09f;
+  /* Offsets decorrelating the three components of the potential. */
+  static const float off1 = 31.416f, off2 = -47.853f;
+  struct st_curl_noise *c = &data->curl_noise;
+  float t = (float)frame*0.004f;
+  uint32_t i;
+
+  cls(f);
+  for (i = 0; i < CURL_PARTICLES; ++i)
+  {
+    float nx = c->x[i]*scale, ny = c->y[i]*scale, nz = c->z[i]*scale + t;
+    float g1[3], g2[3], g3[3];
+    float vx, vy, vz, r, angle, fade;
+    int32_t ix, iy, ia;
+    struct colour3 col;
+
+    simplex_noise_3d_grad(nx, ny, nz, g1);
+    simplex_noise_3d_grad(nx + off1, ny, nz, g2);
+    simplex_noise_3d_grad(nx + off2, ny, nz, g3);
+    /* curl psi, with g1, g2, g3 the gradients of psi_x, psi_y, psi_z. */
+    vx = g3[1] - g2[2];
+    vy = g1[2] - g3[0];
+    vz = g2[0] - g1[1];
+    c->x[i] += speed*vx;
+    c->y[i] += speed*vy;
+    c->z[i] += speed*vz;
+
+    r = sqrtf(c->x[i]*c->x[i] + c->z[i]*c->z[i]) - 2.58f;
+    if (++c->age[i] >= c->lifetime[i] ||
+        r < -0.5f || r > (float)LEDS_X - 0.5f ||
+        c->y[i] < -0.5f || c->y[i] > (float)LEDS_Y - 0.5f)
     {
-    case 0:
-      an_ghost(&frame, n, NULL);
-      break;
-    case 1:
-      an_test(&frame, n, NULL);
-      break;
-    case 2:
-      an_supply_voltage(&frame, n, NULL);
-      break;
-    case 3:
-      an_simplex_noise1(&frame, n, NULL);
-      break;
-    case 4:
-      an_simplex_noise2(&frame, n, NULL);
-      break;
-    case 5:
-      an_simplex_noise3(&frame, n, NULL);
-      break;
-    case 7:
+      ut_curl_noise_spawn(c, i);
+      continue;
+    }
+
+    angle = atan2f(c->z[i], c->x[i]);
+    ia = (int32_t)(angle*((float)LEDS_TANG/(2.0f*F_PI)) + 0.5f);
+    if (ia < 0)
+      ia += LEDS_TANG;
+    if (ia >= LEDS_TANG)
+      ia -= LEDS_TANG;
+    ix = (int32_t)(r + 0.5f);
+    iy = (int32_t)(c->y[i] + 0.5f);
+    /* Fade in at birth and out before death. */
+    fade = 1.0f;
+    if (c->age[i] < 10)
+      fade = (float)c->age[i]*0.1f;
+    else if (c->lifetime[i] - c->age[i] < 20)
+      fade = (float)(c->lifetime[i] - c->age[i])*0.05f;
+    col = hsv2rgb_f(c->hue[i], 0.85f, 0.5f*fade);
+    ut_addpix(f, ix, iy, ia, col);
+  }
+
+  return 0;
+}
+
+
+static uint32_t
+in_shader(const struct ledtorus_anim *self __attribute__((unused)),
+          union anim_data *data)
+{
+  if (vm_shader_file)
+    return vm_compile_file(&data->shader, vm_shader_file);
+  return vm_compile(&data->shader, vm_default_shader, "(default shader)");
+}
+
+
+struct ut_shader_job {
+  frame_t *f;
+  const struct vm_program *prog;
+  uint32_t frame;
+};
+
+static void
+ut_shader_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                 struct slice_worker *w)
+{
+  const struct ut_shader_job *job = arg;
+
+  vm_render_slices(job->prog, job->f, job->frame, a_begin, a_end, w->scratch);
+}
+
+
+static uint32_t
+an_shader(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  struct ut_shader_job job = { f, &data->shader, frame };
+
+  parallel_for_slices(ut_shader_slices, &job);
+  return 0;
+}
+
+
+static uint32_t
+in_heat(const struct ledtorus_anim *self __attribute__((unused)),
+        union anim_data *data)
+{
+  /* Black through red and yellow to white. */
+  static const struct palette_stop stops[] = {
+    { 0.0f, 0, 0, 0 }, { 1.0f/3.0f, 255, 0, 0 }, { 2.0f/3.0f, 255, 255, 0 },
+    { 1.0f, 255, 255, 255 }
+  };
+
+  grid_init(&data->heat.g, 1, GRID_EDGE_CLAMP);
+  palette_from_stops(&data->heat.pal, stops, sizeof(stops)/sizeof(stops[0]));
+  return 0;
+}
+
+
+/*
+  Heat diffusion: three sources wander around the torus, each heating the
+  voxel it is at, and the heat spreads out from them and slowly cools.
+*/
+static uint32_t
+an_heat(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  static const struct grid_params params = {
+    GRID_HEAT, { 0.15f, 0.0f }, 0.003f, 0.0f, 0.0f, 0, 0
+  };
+  static const struct palette_map map = { 0.0f, 0.0f, 1.0f };
+  /* Steps of the simulation per frame. */
+  static const uint32_t substeps = 8;
+  struct grid *g = &data->heat.g;
+  float *u, v[LEDS_X*LEDS_Y];
+  uint32_t i, x, y, a;
+
+  u = grid_field(g, 0);
+  for (i = 0; i < 3; ++i)
+  {
+    float t = (float)frame*(0.011f + 0.004f*(float)i) + 2.1f*(float)i;
+    float pos = fmodf(t*(float)LEDS_TANG*(i == 1 ? -0.25f : 0.3f),
+                      (float)LEDS_TANG);
+    x = (uint32_t)(3.0f + 2.9f*sinf(1.7f*t + (float)i));
+    y = (uint32_t)(3.5f + 3.4f*sinf(2.3f*t + 1.3f*(float)i));
+    /* Wrapped first: a negative float to unsigned is undefined. */
+    if (pos < 0.0f)
+      pos += (float)LEDS_TANG;
+    a = (uint32_t)pos % LEDS_TANG;
+    u[GRID_IDX(x, y, a)] = 8.0f;
+  }
+  grid_step(g, &params, substeps, GRID_PARALLEL);
+
+  for (a = 0; a < LEDS_TANG; ++a)
+  {
+    grid_get_slice(g, 0, a, v);
+    palette_map(&data->heat.pal, &map, v, &(*f)[a*(LEDS_X*LEDS_Y)],
+                LEDS_X*LEDS_Y);
+  }
+
+  return 0;
+}
+
+
+/* Start a blob of v in the Gray-Scott grid at a random place. */
+static void
+ut_gray_scott_seed(struct st_gray_scott *c)
+{
+  float *u = grid_field(&c->g, 0), *v = grid_field(&c->g, 1);
+  uint32_t x = irand(&c->rng, LEDS_X - 2), y = irand(&c->rng, LEDS_Y - 2);
+  uint32_t a = irand(&c->rng, LEDS_TANG);
+  uint32_t dx, dy, da;
+
+  for (da = 0; da < 4; ++da)
+    for (dx = 0; dx < 3; ++dx)
+      for (dy = 0; dy < 3; ++dy)
+      {
+        uint32_t i = GRID_IDX(x + dx, y + dy, (a + da) % LEDS_TANG);
+        u[i] = 0.5f;
+        v[i] = 0.25f + drand(&c->rng, 0.1f);
+      }
+}
+
+
+static uint32_t
+in_gray_scott(const struct ledtorus_anim *self, union anim_data *data)
+{
+  struct st_gray_scott *c = &data->gray_scott;
+  float *u;
+  uint32_t i, x, y, a;
+
+  c->pal = *palette_default();
+  for (i = 1; i <= PALETTE_SIZE; ++i)
+  {
+    uint32_t col = c->pal.lut[i], r = col & 0xff, g = (col >> 8) & 0xff;
+    uint32_t b = col >> 16;
+    c->pal.lut[i] = (r*i >> PALETTE_BITS) | (g*i >> PALETTE_BITS) << 8 |
+      (b*i >> PALETTE_BITS) << 16;
+  }
+  ut_rng_init(&c->rng, self);
+  grid_init(&c->g, 2, GRID_EDGE_CLAMP);
+  u = grid_field(&c->g, 0);
+  for (a = 0; a < LEDS_TANG; ++a)
+    for (x = 0; x < LEDS_X; ++x)
+      for (y = 0; y < LEDS_Y; ++y)
+        u[GRID_IDX(x, y, a)] = 1.0f;
+  for (i = 0; i < 12; ++i)
+    ut_gray_scott_seed(c);
+  return 0;
+}
+
+
+/*
+  Gray-Scott reaction-diffusion: spots of v grow, split and wander around
+  the torus.
+*/
+static uint32_t
+an_gray_scott(frame_t *f, uint32_t frame __attribute__((unused)),
+              union anim_data *data)
+{
+  /*
+    Diffusion near the limit of the 6-neighbour stencil, and feed/kill for
+    spots that keep moving and splitting rather than settling.
+  */
+  static const struct grid_params params = {
+    GRID_GRAY_SCOTT, { 0.16f, 0.08f }, 0.0f, 0.025f, 0.06f, 0, 0
+  };
+  static const struct palette_map map = { 0.0f, 0.0f, 0.4f };
+  static const uint32_t substeps = 24;
+  struct st_gray_scott *c = &data->gray_scott;
+  float v[LEDS_X*LEDS_Y], total = 0.0f;
+  uint32_t i, a;
+
+  grid_step(&c->g, &params, substeps, GRID_PARALLEL);
+
+  for (a = 0; a < LEDS_TANG; ++a)
+  {
+    grid_get_slice(&c->g, 1, a, v);
+    for (i = 0; i < LEDS_X*LEDS_Y; ++i)
+      total += v[i];
+    palette_map(&c->pal, &map, v, &(*f)[a*(LEDS_X*LEDS_Y)], LEDS_X*LEDS_Y);
+  }
+  /* Keep it going should it die out. */
+  if (total < 20.0f)
+    ut_gray_scott_seed(c);
+
+  return 0;
+}
+
+
+/* Fill slices A0 <= a < A0+N (wrapping) of the Life grid with random cells. */
+static void
+ut_life3d_seed(struct st_life3d *c, uint32_t a0, uint32_t n)
+{
+  float *u = grid_field(&c->g, 0);
+  uint32_t x, y, a;
+
+  for (a = a0; a < a0 + n; ++a)
+    for (x = 0; x < LEDS_X; ++x)
+      for (y = 0; y < LEDS_Y; ++y)
+        if (irand(&c->rng, 100) < 20)
+          u[GRID_IDX(x, y, a % LEDS_TANG)] = 1.0f;
+  c->stale = 0;
+}
+
+
+static uint32_t
+in_life3d(const struct ledtorus_anim *self, union anim_data *data)
+{
+  struct st_life3d *c = &data->life3d;
+
+  ut_rng_init(&c->rng, self);
+  grid_init(&c->g, 1, GRID_EDGE_ZERO);
+  ut_life3d_seed(c, 0, LEDS_TANG);
+  return 0;
+}
+
+
+/*
+  3D Game of Life, Bays' rule 4555 (born with 5 neighbours, survives with 4
+  or 5). Dead cells fade out. When it is nearly dead or has settled, a
+  random stretch of the torus is reseeded.
+*/
+static uint32_t
+an_life3d(frame_t *f, uint32_t frame, union anim_data *data)
+{
+  static const struct grid_params params = {
+    GRID_LIFE, { 0.0f, 0.0f }, 0.0f, 0.0f, 0.0f, 1u << 5, (1u << 4) | (1u << 5)
+  };
+  /* Frames per generation. */
+  static const uint32_t period = 3;
+  struct st_life3d *c = &data->life3d;
+  const float *u;
+  uint32_t x, y, a, population = 0;
+
+  if (frame % period == 0)
+  {
+    grid_step(&c->g, &params, 1, GRID_PARALLEL);
+    u = grid_field(&c->g, 0);
+    for (a = 0; a < LEDS_TANG; ++a)
+      for (x = 0; x < LEDS_X; ++x)
+        for (y = 0; y < LEDS_Y; ++y)
+          population += u[GRID_IDX(x, y, a)] > 0.5f;
+    c->stale = population == c->population[0] ||
+      population == c->population[1] ? c->stale + 1 : 0;
+    c->population[1] = c->population[0];
+    c->population[0] = population;
+    if (population < LEDS_TANG*LEDS_X*LEDS_Y/50 || c->stale > 20)
+      ut_life3d_seed(c, irand(&c->rng, LEDS_TANG), 40);
+  }
+
+  u = grid_field(&c->g, 0);
+  for (a = 0; a < LEDS_TANG; ++a)
+    for (x = 0; x < LEDS_X; ++x)
+      for (y = 0; y < LEDS_Y; ++y)
+      {
+        float *glow = &c->glow[a][x][y];
+        struct colour3 col;
+
+        *glow = u[GRID_IDX(x, y, a)] > 0.5f ? 1.0f : *glow*0.8f;
+        col = hsv2rgb_f(fmodf((float)a*(1.0f/(float)LEDS_TANG) +
+                              (float)frame*0.001f, 1.0f),
+                        0.9f - 0.5f*(*glow)*(*glow), 0.6f*(*glow));
+        setpix(f, x, y, a, col.r, col.g, col.b);
+      }
+
+  return 0;
+}
+
+
+/* Size of the state used by one member of union anim_data. */
+#define ANIM_STATE(member) sizeof(((union anim_data *)0)->member)
+
+/*
+  The table of all animations. The position in the table is the number used
+  to select an animation on the command line, so only add at the end.
+*/
+const struct ledtorus_anim anim_table[] = {
+  { "ghost", NULL, an_ghost, 0, ANIM_STATELESS },
+  { "test", NULL, an_test, 0, ANIM_STATELESS },
+  { "supply_voltage", NULL, an_supply_voltage, 0, 0 },
+  { "simplex_noise1", NULL, an_simplex_noise1, 0, ANIM_STATELESS },
+  { "simplex_noise2", NULL, an_simplex_noise2, 0, ANIM_STATELESS },
+  { "simplex_noise3", NULL, an_simplex_noise3, 0, ANIM_STATELESS },
+  { "test2", NULL, an_test2, 0, ANIM_STATELESS },
+  { "fireworks", in_fireworks, an_fireworks, ANIM_STATE(fireworks), 0 },
+  { "migrating_dots", in_migrating_dots, an_migrating_dots,
+    ANIM_STATE(migrating_dots), 0 },
+  { "spheretest", in_spheretest, an_spheretest, 0, ANIM_STATELESS },
+  { "planetest", NULL, an_planetest, 0, ANIM_STATELESS },
+  { "testimg1", NULL, an_testimg1, 0, ANIM_STATELESS },
+  { "rubberduck", in_rubberduck, an_rubberduck, ANIM_STATE(rubberduck),
+    ANIM_SEEKABLE },
+  { "curl_noise", in_curl_noise, an_curl_noise, ANIM_STATE(curl_noise), 0 },
+  { "simplex_noise3_kf", in_simplex_noise3_kf, an_simplex_noise3_kf,
+    ANIM_STATE(simplex_noise3_kf), 0 },
+  { "shader", in_shader, an_shader, ANIM_STATE(shader), ANIM_STATELESS },
+  { "heat", in_heat, an_heat, ANIM_STATE(heat), 0 },
+  { "gray_scott", in_gray_scott, an_gray_scott, ANIM_STATE(gray_scott), 0 },
+  { "life3d", in_life3d, an_life3d, ANIM_STATE(life3d), 0 },
+};
+const uint32_t anim_table_size = sizeof(anim_table)/sizeof(anim_table[0]);
+
+
+/* Draw a few numbers from slice_rng() for each slice, into ARG. */
+static void
+ut_selftest_rng_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                       struct slice_worker *w)
+{
+  uint32_t (*out)[4] = arg;
+  uint32_t a, i;
+
+  for (a = a_begin; a < a_end; ++a)
+    for (i = 0; i < 4; ++i)
+      out[a][i] = rng_u32(slice_rng(w));
+}
+
+
+/*
+  Check each SIMD implementation of simplex_noise_3d_n() supported by this
+  CPU against the scalar simplex_noise_3d(), and time them, and check that
+  the random numbers of the slice pool do not depend on -j. Returns
+  non-zero on mismatch.
+*/
+static int
+ut_selftest(uint32_t threads)
+{
+  /* The variants must give exactly the same results as the scalar code. */
+  static const float tolerance = 0.0f;
+  static const uint32_t num_points = 1<<20;
+  float *xs, *ys, *zs, *ref, *out;
+  const struct simplex_noise_impl *impl;
+  struct rng rng;
+  uint64_t t0, t1;
+  uint32_t i;
+  int failed = 0;
+
+  xs = malloc(5*num_points*sizeof(float));
+  ys = xs + num_points;
+  zs = ys + num_points;
+  ref = zs + num_points;
+  out = ref + num_points;
+  rng_seed(&rng, 42);
+  for (i = 0; i < num_points; ++i)
+  {
+    /* Some lattice points and some near zero, the rest spread out. */
+    if (i < 4096)
     {
-      if (n == 0)
-        in_fireworks(NULL, &private_data);
-      an_fireworks(&frame, n, &private_data);
-      break;
+      xs[i] = (float)((int)(i % 16) - 8);
+      ys[i] = (float)((int)(i/16 % 16) - 8);
+      zs[i] = (float)((int)(i/256) - 8) + ((i & 1) ? 1e-7f : 0.0f);
     }
-    case 8:
+    else
     {
-      if (n == 0)
-        in_migrating_dots(NULL, &private_data);
-      an_migrating_dots(&frame, n, &private_data);
-      break;
+      float range = (i < num_points/2 ? 4.0f : 2000.0f);
+      xs[i] = range*(drand(&rng, 2.0f) - 1.0f);
+      ys[i] = range*(drand(&rng, 2.0f) - 1.0f);
+      zs[i] = range*(drand(&rng, 2.0f) - 1.0f);
     }
-    case 9:
+  }
+
+  t0 = trace_now();
+  for (i = 0; i < num_points; ++i)
+    ref[i] = simplex_noise_3d(xs[i], ys[i], zs[i]);
+  t1 = trace_now();
+  printf("%-8s %7.2f ns/point\n", "scalar", (double)(t1-t0)/num_points);
+
+  for (impl = simplex_noise_impls; impl->name; ++impl)
+  {
+    float max_err = 0.0f;
+
+    if (!impl->supported())
     {
-      if (n == 0)
-        in_spheretest(NULL, &private_data);
-      an_spheretest(&frame, n, &private_data);
-      break;
+      printf("%-8s not supported by this CPU\n", impl->name);
+      continue;
     }
-    case 10:
+    t0 = trace_now();
+    impl->fn(xs, ys, zs, out, num_points);
+    t1 = trace_now();
+    for (i = 0; i < num_points; ++i)
     {
-      an_planetest(&frame, n, &private_data);
-      break;
+      float err = fabsf(out[i] - ref[i]);
+      if (!(err <= max_err))
+        max_err = err;
     }
-    case 11:
+    printf("%-8s %7.2f ns/point  max error %g%s%s\n", impl->name,
+           (double)(t1-t0)/num_points, max_err,
+           impl == simplex_noise_best_impl() ? "  (used)" : "",
+           max_err <= tolerance ? "" : "  FAILED");
+    if (!(max_err <= tolerance))
+      failed = 1;
+  }
+
+  /*
+    The analytic gradient, against central differences. The noise has small
+    jumps where the 0.6 kernel radius reaches past the neighbouring simplex
+    cells, so a few differences straddling one are way off; allow 1%.
+  */
+  {
+    static const float h = 1e-3f;
+    static const uint32_t num_grad = 1<<16;
+    uint32_t outliers = 0;
+    double sum_err = 0.0;
+    float grad[3];
+
+    for (i = 0; i < num_grad; ++i)
     {
-      an_testimg1(&frame, n, &private_data);
-      break;
+      float x = xs[i+4096], y = ys[i+4096], z = zs[i+4096];
+      float v = simplex_noise_3d_grad(x, y, z, grad);
+      float dx = (simplex_noise_3d(x+h, y, z) - simplex_noise_3d(x-h, y, z))/(2*h);
+      float dy = (simplex_noise_3d(x, y+h, z) - simplex_noise_3d(x, y-h, z))/(2*h);
+      float dz = (simplex_noise_3d(x, y, z+h) - simplex_noise_3d(x, y, z-h))/(2*h);
+      float err = fabsf(grad[0] - dx);
+      err = fmaxf(err, fabsf(grad[1] - dy));
+      err = fmaxf(err, fabsf(grad[2] - dz));
+      if (v != simplex_noise_3d(x, y, z))
+        err = INFINITY;
+      sum_err += err;
+      if (!(err <= 0.05f))
+        ++outliers;
     }
-    case 12:
+    t0 = trace_now();
+    for (i = 0; i < num_points; ++i)
+      ref[i] = simplex_noise_3d_grad(xs[i], ys[i], zs[i], grad) + grad[0];
+    t1 = trace_now();
+    printf("%-8s %7.2f ns/point  mean error %g, %u of %u off%s\n", "gradient",
+           (double)(t1-t0)/num_points, sum_err/num_grad, outliers, num_grad,
+           outliers <= num_grad/100 ? "" : "  FAILED");
+    if (outliers > num_grad/100)
+      failed = 1;
+  }
+
+  /* Random numbers, one at a time and in bulk, against libc rand(). */
+  {
+    float sum = 0.0f;
+
+    t0 = trace_now();
+    for (i = 0; i < num_points; ++i)
+      sum += (float)rand();
+    t1 = trace_now();
+    printf("%-8s %7.2f ns/number\n", "rand()", (double)(t1-t0)/num_points);
+    t0 = trace_now();
+    for (i = 0; i < num_points; ++i)
+      sum += rng_float(&rng);
+    t1 = trace_now();
+    printf("%-8s %7.2f ns/number\n", "rng", (double)(t1-t0)/num_points);
+    t0 = trace_now();
+    rng_floats(&rng, out, num_points);
+    t1 = trace_now();
+    printf("%-8s %7.2f ns/number\n", "rng bulk", (double)(t1-t0)/num_points);
+    /* Keep the loops from being optimised away. */
+    if (sum < 0.0f)
+      failed = 1;
+  }
+
+  /*
+    Particle throughput, for a full set; to keep 25 fps, update and drawing
+    must stay well below 40 ms per frame.
+  */
+  {
+    static const uint32_t num_frames = 25;
+    static const struct particle_params params = { 0.002f, 0.01f, 0.0f, 0.0f };
+    struct particle_set *ps = calloc(1, sizeof(*ps));
+    frame_t *pf = malloc(sizeof(frame_t));
+    struct splat_buffer *hdr = malloc(sizeof(*hdr));
+
+    particles_init(ps);
+    for (i = 0; i < PARTICLES_MAX; ++i)
     {
-      if (n == 0)
-        in_rubberduck(NULL, &private_data);
-      an_rubberduck(&frame, n, &private_data);
-      break;
+      int32_t idx = particles_add(ps);
+      ps->x[idx] = drand(&rng, (float)(LEDS_X-1));
+      ps->y[idx] = drand(&rng, (float)LEDS_TANG);
+      ps->z[idx] = drand(&rng, (float)(LEDS_Y-1));
+      ps->vx[idx] = drand(&rng, 0.1f) - 0.05f;
+      ps->vy[idx] = drand(&rng, 0.5f) - 0.25f;
+      ps->vz[idx] = drand(&rng, 0.1f);
+      ps->hue[idx] = drand(&rng, 1.0f);
+      ps->sat[idx] = 1.0f;
+      ps->val[idx] = 1.0f;
+      ps->fade[idx] = 0.5f/(float)num_frames;
+      ps->ground_frames[idx] = irand(&rng, num_frames);
     }
-    default:
-      an_test2(&frame, n, NULL);
-      break;
+    t0 = trace_now();
+    for (i = 0; i < num_frames; ++i)
+    {
+      particles_update(ps, &params);
+      cls(pf);
+      particles_render(ps, pf);
+    }
+    t1 = trace_now();
+    printf("%-8s %7.2f ms/frame for %u particles\n", "particles",
+           (double)(t1-t0)/num_frames*1e-6, PARTICLES_MAX);
+    /* Antialiased, as drawn by fireworks; the set has thinned out by now. */
+    ps->count = PARTICLES_MAX;
+    t0 = trace_now();
+    for (i = 0; i < num_frames; ++i)
+    {
+      splat_clear(hdr);
+      particles_splat(ps, hdr);
+      splat_tonemap(hdr, pf, 0.8f);
+    }
+    t1 = trace_now();
+    printf("%-8s %7.2f ms/frame for %u particles\n", "splat",
+           (double)(t1-t0)/num_frames*1e-6, PARTICLES_MAX);
+    free(hdr);
+    free(pf);
+    free(ps);
+  }
+
+  {
+    static uint32_t pooled[LEDS_TANG][4], serial[LEDS_TANG][4];
+    int same;
+
+    parallel_for_slices_seeded(ut_selftest_rng_slices, pooled, 12345);
+    for_slices_serial(ut_selftest_rng_slices, serial, 12345);
+    same = 0 == memcmp(pooled, serial, sizeof(pooled));
+    printf("%-8s %s with -j %u as with -j 1%s\n", "slicerng",
+           same ? "same" : "different", threads, same ? "" : "  FAILED");
+    if (!same)
+      failed = 1;
+  }
+
+  free(xs);
+  return failed;
+}
+
+
+/*
+  Render frames 0..N-1 of ANIM from a fresh state. Returns non-zero if init()
+  fails, else the time spent in nextframe() in *NS. The animations seed
+  their random numbers from anim_seed in init(), so they take the same
+  course in every run.
+*/
+static int
+ut_render_run(const struct ledtorus_anim *anim, frame_t *frames, uint32_t n,
+              uint64_t *ns)
+{
+  union anim_data *data;
+  uint64_t t0;
+  uint32_t i;
+
+  data = calloc(1, anim->state_size ? anim->state_size : 1);
+  if (anim->init && anim->init(anim, data))
+  {
+    free(data);
+    return 1;
+  }
+  memset(frames, 0, n*sizeof(frame_t));
+  t0 = trace_now();
+  for (i = 0; i < n; ++i)
+    anim->nextframe(&frames[i], i, data);
+  *ns = trace_now() - t0;
+  free(data);
+  return 0;
+}
+
+
+#ifndef LEDTORUS_FIXED_POINT
+/*
+  Render the first N frames of each animation with float and with fixed
+  point, and report the timings and the PSNR of the fixed-point frames
+  against the float ones.
+*/
+static int
+ut_compare(const struct playlist_entry *entries, uint32_t num_entries,
+           uint32_t n)
+{
+  frame_t *float_frames, *fix_frames;
+  uint32_t e, i;
+
+  float_frames = malloc(n*sizeof(frame_t));
+  fix_frames = malloc(n*sizeof(frame_t));
+  printf("%-16s %10s %10s %8s\n", "animation", "float ms", "fixed ms",
+         "PSNR dB");
+  for (e = 0; e < num_entries; ++e)
+  {
+    const struct ledtorus_anim *anim = entries[e].anim;
+    uint64_t float_ns, fix_ns;
+    double sq_err, psnr;
+    const uint8_t *p, *q;
+
+    fixed_point_enabled = 0;
+    if (ut_render_run(anim, float_frames, n, &float_ns))
+    {
+      printf("%-16s init failed\n", anim->name);
+      continue;
     }
-    write(1, frame, len);
-    if (len % 512)
+    fixed_point_enabled = 1;
+    ut_render_run(anim, fix_frames, n, &fix_ns);
+    fixed_point_enabled = 0;
+
+    p = (const uint8_t *)float_frames;
+    q = (const uint8_t *)fix_frames;
+    sq_err = 0.0;
+    for (i = 0; i < n*sizeof(frame_t); ++i)
     {
-      memset(buf, 0, 512 - (len % 512));
-      write(1, buf, 512 - (len % 512));
+      double d = (double)p[i] - (double)q[i];
+      sq_err += d*d;
     }
+    if (sq_err > 0.0)
+      psnr = 10.0*log10(255.0*255.0/(sq_err/(double)(n*sizeof(frame_t))));
+    else
+      psnr = INFINITY;
+    printf("%-16s %10.3f %10.3f %8.2f\n", anim->name,
+           (double)float_ns/1e6/n, (double)fix_ns/1e6/n, psnr);
   }
+  free(float_frames);
+  free(fix_frames);
   return 0;
 }
+#endif
+
+
+#define BENCH_BUDGET_MS 40.0
+
+
+static int
+ut_cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+
+/* Nearest-rank percentile P (0..1) of the N sorted values V, in ms. */
+static double
+ut_percentile_ms(const uint64_t *v, uint32_t n, double p)
+{
+  uint32_t k = (uint32_t)ceil(p*n);
+  return (double)v[k > 0 ? k - 1 : 0]/1e6;
+}
+
+
+/*
+  Render the first N frames of each animation from a fresh state, throwing
+  them away, and print the per-frame render times as JSON on stdout, with
+  whether the 99th percentile fits the frame budget at 25 fps.
+*/
+static int
+ut_bench(const struct playlist_entry *entries, uint32_t num_entries,
+         uint32_t n, uint32_t threads)
+{
+  uint64_t *times = malloc(n*sizeof(*times));
+  frame_t *frame = malloc(sizeof(frame_t));
+  uint32_t e, i;
+  int failed = 0;
+
+  if (!times || !frame)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  printf("{\n  \"frames\": %u,\n  \"threads\": %u,\n  \"seed\": %llu,\n"
+         "  \"fixed_point\": %s,\n  \"budget_ms\": %.1f,\n"
+         "  \"animations\": [",
+         n, threads, (unsigned long long)anim_seed,
+         USE_FIXED_POINT ? "true" : "false", BENCH_BUDGET_MS);
+  for (e = 0; e < num_entries; ++e)
+  {
+    const struct ledtorus_anim *anim = entries[e].anim;
+    union anim_data *data;
+    uint64_t t0, t1, total = 0;
+    double mean_ms, p99_ms;
+
+    printf("%s\n    { \"name\": \"%s\", ", e ? "," : "", anim->name);
+    data = calloc(1, anim->state_size ? anim->state_size : 1);
+    t0 = trace_now();
+    if (!data || (anim->init && anim->init(anim, data)))
+    {
+      printf("\"error\": \"init failed\" }");
+      free(data);
+      failed = 1;
+      continue;
+    }
+    t1 = trace_now();
+    printf("\"init_ms\": %.3f, ", (double)(t1 - t0)/1e6);
+    for (i = 0; i < n; ++i)
+    {
+      t0 = trace_now();
+      anim->nextframe(frame, i, data);
+      times[i] = trace_now() - t0;
+      total += times[i];
+    }
+    free(data);
+
+    qsort(times, n, sizeof(*times), ut_cmp_u64);
+    mean_ms = (double)total/1e6/n;
+    p99_ms = ut_percentile_ms(times, n, 0.99);
+    printf("\"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+           "\"max_ms\": %.3f, \"fps\": %.1f, \"within_budget\": %s }",
+           mean_ms, ut_percentile_ms(times, n, 0.5), p99_ms,
+           (double)times[n - 1]/1e6, total ? 1e9*n/(double)total : 0.0,
+           p99_ms <= BENCH_BUDGET_MS ? "true" : "false");
+    fflush(stdout);
+  }
+  printf("\n  ]\n}\n");
+  free(frame);
+  free(times);
+  return failed;
+}
+
+
+
+/*
+  Golden-frame regression check.
+
+  The golden file holds a 64-bit FNV-1a hash of each of the first frames of
+  each animation, rendered from a fresh state with a fixed seed:
+
+    # comment
+    frames N seed S fixed F
+    <name> <hash of frame 0> <hash of frame 1> ...
+
+  Changes that are meant to keep the output identical must match it
+  exactly. For changes that are expected to alter the output slightly (eg.
+  another SIMD variant or a lookup table), the frames themselves can be kept
+  in a directory with --golden-frames when writing; checking against it
+  with a tolerance then reports the largest per-channel difference and the
+  PSNR of the frames that differ, and passes if the PSNR is high enough.
+*/
+
+#define GOLDEN_FRAMES 50
+
+
+static uint64_t
+ut_frame_hash(const frame_t *f)
+{
+  const uint8_t *p = (const uint8_t *)f;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+
+  for (i = 0; i < sizeof(frame_t); ++i)
+    h = (h ^ p[i])*0x100000001b3ULL;
+  return h;
+}
+
+
+static int
+ut_golden_frames_path(char *buf, size_t size, const char *dir,
+                      const struct ledtorus_anim *anim)
+{
+  return (size_t)snprintf(buf, size, "%s/%s.frames", dir, anim->name) >= size;
+}
+
+
+static int
+ut_golden_write(const char *filename, const char *frames_dir,
+                const struct playlist_entry *entries, uint32_t num_entries)
+{
+  frame_t *frames = malloc(GOLDEN_FRAMES*sizeof(frame_t));
+  FILE *fp;
+  uint32_t e, i;
+  int err = 0;
+
+  if (!frames)
+    return 1;
+  if (!(fp = fopen(filename, "w")))
+  {
+    fprintf(stderr, "Error: cannot write '%s'\n", filename);
+    free(frames);
+    return 1;
+  }
+  if (frames_dir)
+    mkdir(frames_dir, 0777);
+  fprintf(fp, "# ledtorus_anim golden frame hashes, see --golden-check\n");
+  fprintf(fp, "frames %u seed %llu fixed %d\n", GOLDEN_FRAMES,
+          (unsigned long long)anim_seed, USE_FIXED_POINT ? 1 : 0);
+  for (e = 0; e < num_entries; ++e)
+  {
+    const struct ledtorus_anim *anim = entries[e].anim;
+    uint64_t ns;
+
+    if (ut_render_run(anim, frames, GOLDEN_FRAMES, &ns))
+    {
+      fprintf(stderr, "%-18s init failed\n", anim->name);
+      err = 1;
+      continue;
+    }
+    fprintf(fp, "%s", anim->name);
+    for (i = 0; i < GOLDEN_FRAMES; ++i)
+      fprintf(fp, " %016llx", (unsigned long long)ut_frame_hash(&frames[i]));
+    fprintf(fp, "\n");
+
+    if (frames_dir)
+    {
+      char path[4096];
+      FILE *ff;
+
+      if (ut_golden_frames_path(path, sizeof(path), frames_dir, anim) ||
+          !(ff = fopen(path, "wb")))
+      {
+        fprintf(stderr, "Error: cannot write frames of '%s'\n", anim->name);
+        err = 1;
+        continue;
+      }
+      if (fwrite(frames, sizeof(frame_t), GOLDEN_FRAMES, ff) != GOLDEN_FRAMES)
+        err = 1;
+      err |= fclose(ff) != 0;
+    }
+  }
+  err |= fclose(fp) != 0;
+  free(frames);
+  return err;
+}
+
+
+/*
+  Compare the N FRAMES against the reference frames of ANIM in FRAMES_DIR,
+  reporting the largest difference and the PSNR. Returns the PSNR, or -1 if
+  the reference frames cannot be read.
+*/
+static double
+ut_golden_psnr(const char *frames_dir, const struct ledtorus_anim *anim,
+               const frame_t *frames, uint32_t n)
+{
+  frame_t *ref = malloc(n*sizeof(frame_t));
+  const uint8_t *p = (const uint8_t *)frames, *q = (const uint8_t *)ref;
+  char path[4096];
+  double sq_err = 0.0, psnr;
+  uint32_t max_delta = 0;
+  FILE *fp = NULL;
+  size_t i;
+
+  if (!ref || ut_golden_frames_path(path, sizeof(path), frames_dir, anim) ||
+      !(fp = fopen(path, "rb")) || fread(ref, sizeof(frame_t), n, fp) != n)
+  {
+    printf(", no reference frames");
+    if (fp)
+      fclose(fp);
+    free(ref);
+    return -1.0;
+  }
+  fclose(fp);
+  for (i = 0; i < n*sizeof(frame_t); ++i)
+  {
+    int d = (int)p[i] - (int)q[i];
+    uint32_t a = d < 0 ? -d : d;
+    if (a > max_delta)
+      max_delta = a;
+    sq_err += (double)(d*d);
+  }
+  free(ref);
+  psnr = sq_err > 0.0 ?
+    10.0*log10(255.0*255.0/(sq_err/(double)(n*sizeof(frame_t)))) : INFINITY;
+  printf(", max delta %u, PSNR %.2f dB", max_delta, psnr);
+  return psnr;
+}
+
+
+/*
+  Render each animation in the golden file (or only the ones given) and
+  compare against its hashes; an animation given but missing from the file
+  fails. With TOLERANCE > 0, an animation whose frames differ still passes
+  if their PSNR against the frames in FRAMES_DIR is at least TOLERANCE dB.
+  Those frames are written locally before a change (they are not kept in
+  the tree), so make check only ever compares hashes. Returns non-zero if
+  any animation fails.
+*/
+static int
+ut_golden_check(const char *filename, const char *frames_dir, double tolerance,
+                const struct playlist_entry *entries, uint32_t num_entries)
+{
+  char *line = NULL;
+  size_t line_size = 0;
+  unsigned long long seed;
+  uint32_t n, fixed, e, checked = 0, failures = 0;
+  frame_t *frames = NULL;
+  uint8_t *seen;
+  FILE *fp;
+
+  if (!(fp = fopen(filename, "r")))
+  {
+    fprintf(stderr, "Error: cannot read '%s'\n", filename);
+    return 1;
+  }
+  do
+  {
+    if (getline(&line, &line_size, fp) < 0)
+    {
+      fprintf(stderr, "Error: '%s' is not a golden file\n", filename);
+      fclose(fp);
+      free(line);
+      return 1;
+    }
+  } while (line[0] == '#');
+  if (sscanf(line, "frames %u seed %llu fixed %u", &n, &seed, &fixed) != 3 ||
+      n == 0)
+  {
+    fprintf(stderr, "Error: '%s' is not a golden file\n", filename);
+    fclose(fp);
+    free(line);
+    return 1;
+  }
+  if (fixed != (USE_FIXED_POINT ? 1u : 0u))
+  {
+    fprintf(stderr, "Error: '%s' is for %s arithmetic\n", filename,
+            fixed ? "fixed-point" : "float");
+    fclose(fp);
+    free(line);
+    return 1;
+  }
+  anim_seed = seed;
+  frames = malloc(n*sizeof(frame_t));
+  seen = calloc(num_entries, 1);
+
+  while (frames && seen && getline(&line, &line_size, fp) >= 0)
+  {
+    const struct ledtorus_anim *anim;
+    char *name;
+    uint32_t i, found = 0, diffs = 0, first_diff = 0;
+    uint64_t ns;
+
+    if (line[0] == '#' || !(name = strtok(line, " \n")))
+      continue;
+    if (!(anim = anim_lookup(name)))
+    {
+      printf("%-18s not an animation\n", name);
+      ++failures;
+      continue;
+    }
+    for (e = 0; e < num_entries; ++e)
+      if (entries[e].anim == anim)
+        seen[e] = found = 1;
+    if (!found)
+      continue;
+    ++checked;
+    if (ut_render_run(anim, frames, n, &ns))
+    {
+      printf("%-18s init failed\n", anim->name);
+      ++failures;
+      continue;
+    }
+    for (i = 0; i < n; ++i)
+    {
+      char *hash = strtok(NULL, " \n");
+
+      if (!hash || strtoull(hash, NULL, 16) != ut_frame_hash(&frames[i]))
+      {
+        if (diffs++ == 0)
+          first_diff = i;
+      }
+    }
+    if (diffs == 0)
+    {
+      printf("%-18s ok\n", anim->name);
+      continue;
+    }
+    printf("%-18s %u/%u frames differ, first at %u", anim->name, diffs, n,
+           first_diff);
+    if (frames_dir && tolerance > 0.0 &&
+        ut_golden_psnr(frames_dir, anim, frames, n) >= tolerance)
+      printf(", within tolerance\n");
+    else
+    {
+      printf(", FAILED\n");
+      ++failures;
+    }
+  }
+  fclose(fp);
+  free(line);
+  /* An animation without hashes is a failure, not a silent pass. */
+  for (e = 0; frames && seen && e < num_entries; ++e)
+  {
+    if (seen[e])
+      continue;
+    printf("%-18s not in '%s', FAILED\n", entries[e].anim->name, filename);
+    ++failures;
+  }
+  if (!frames || !seen)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    ++failures;
+  }
+  free(frames);
+  free(seen);
+  printf("%u animation(s) checked, %u failed\n", checked, failures);
+  return failures != 0;
+}
+
+static void
+usage(const char *argv0)
+{
+  uint32_t i;
+
+  fprintf(stderr,
+          "Usage: %s [options] [anim[:frames][@start] ...]\n"
+          "Plays the animations one after the other. An animation\n"
+          "is given by name or number; the default is 0. @start starts it\n"
+          "at that frame number.\n"
+          "  -d, --duration N   frames per animation without :frames (%u)\n"
+          "  -x, --crossfade N  frames of crossfade between animations (%u)\n"
+          "  -l, --loop         repeat the playlist forever\n"
+          "  -j, --threads N    threads rendering frames of stateless\n"
+          "                     animations in parallel (number of CPUs)\n"
+          "  -F, --fixed-point  use the fixed-point noise, colour and polar\n"
+          "                     code of the firmware\n"
+          "  -s, --seed N       seed for the random animations (1)\n"
+          "  -o, --output SINK[,POLICY]\n"
+          "                     send the frames to SINK: - for stdout (the\n"
+          "                     default), unix:PATH, tcp:HOST:PORT, or a file\n"
+          "                     or FIFO; may be given several times. POLICY\n"
+          "                     for when the sink falls behind: block (wait\n"
+          "                     for it), drop-oldest or skip\n"
+          "      --checkpoint-dir DIR\n"
+          "                     read checkpoints of the simulated animations\n"
+          "                     from DIR, to start at a later frame quickly\n"
+          "      --checkpoint-every N\n"
+          "                     write a checkpoint to DIR every N frames\n"
+          "      --compare[=N]  render N frames (100) of each animation (or the\n"
+          "                     given ones) in float and in fixed point, and\n"
+          "                     report timing and PSNR\n"
+          "      --bench[=N]    render N frames (500) of each animation (or the\n"
+          "                     given ones) without output, and print the\n"
+          "                     frame times as JSON\n"
+          "      --golden-write FILE\n"
+          "                     write hashes of the first frames of each\n"
+          "                     animation (or the given ones) to FILE\n"
+          "      --golden-check FILE\n"
+          "                     check the animations against the hashes in FILE\n"
+          "      --golden-frames DIR\n"
+          "                     also write the frames to DIR, or with\n"
+          "                     --tolerance, compare differing frames to them\n"
+          "      --tolerance DB pass differing animations with at least this\n"
+          "                     PSNR against the frames in --golden-frames\n"
+          "      --shader FILE  run the voxel shader in FILE as the \"shader\"\n"
+          "                     animation (see vm.h)\n"
+          "      --palette FILE use the palette in FILE (see palette.h) instead\n"
+          "                     of blue-green-gold\n"
+          "      --selftest     check the SIMD noise code against the scalar,\n"
+          "                     and the slice pool against -j 1\n"
+          "Animations:\n",
+          argv0, PLAYER_DEFAULT_DURATION, PLAYER_DEFAULT_CROSSFADE);
+  for (i = 0; i < anim_table_size; ++i)
+    fprintf(stderr, "  %2u %s\n", i, anim_table[i].name);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  static const struct option long_options[] = {
+    { "duration", required_argument, NULL, 'd' },
+    { "crossfade", required_argument, NULL, 'x' },
+    { "loop", no_argument, NULL, 'l' },
+    { "threads", required_argument, NULL, 'j' },
+    { "fixed-point", no_argument, NULL, 'F' },
+    { "seed", required_argument, NULL, 's' },
+    { "output", required_argument, NULL, 'o' },
+    { "checkpoint-dir", required_argument, NULL, 'D' },
+    { "checkpoint-every", required_argument, NULL, 'E' },
+    { "compare", optional_argument, NULL, 'C' },
+    { "bench", optional_argument, NULL, 'B' },
+    { "golden-write", required_argument, NULL, 'W' },
+    { "golden-check", required_argument, NULL, 'K' },
+    { "golden-frames", required_argument, NULL, 'G' },
+    { "tolerance", required_argument, NULL, 'P' },
+    { "shader", required_argument, NULL, 'S' },
+    { "palette", required_argument, NULL, 'L' },
+    { "selftest", no_argument, NULL, 'T' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+  uint32_t n;
+  struct player player;
+  struct output *output;
+  struct playlist_entry *entries;
+  uint32_t num_entries;
+  uint32_t duration = PLAYER_DEFAULT_DURATION;
+  uint32_t crossfade = PLAYER_DEFAULT_CROSSFADE;
+  uint32_t loop = 0;
+  uint32_t threads = frame_pool_default_threads();
+  uint32_t compare_frames = 0;
+  uint32_t bench_frames = 0;
+  const char *golden_write = NULL, *golden_check = NULL, *golden_frames = NULL;
+  const char **sink_specs;
+  uint32_t num_sinks = 0;
+  double tolerance = 0.0;
+  int selftest = 0;
+  int opt, i;
+
+  /* The sinks are opened (and files truncated) only when playing. */
+  sink_specs = calloc(argc, sizeof(*sink_specs));
+  while ((opt = getopt_long(argc, argv, "d:x:lj:Fs:o:h", long_options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+    case 'd':
+      duration = strtoul(optarg, NULL, 0);
+      break;
+    case 'x':
+      crossfade = strtoul(optarg, NULL, 0);
+      break;
+    case 'l':
+      loop = 1;
+      break;
+    case 'j':
+      threads = strtoul(optarg, NULL, 0);
+      break;
+    case 's':
+      anim_seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'o':
+      sink_specs[num_sinks++] = optarg;
+      break;
+    case 'D':
+      checkpoint_dir = optarg;
+      break;
+    case 'E':
+      checkpoint_interval = strtoul(optarg, NULL, 0);
+      break;
+#ifndef LEDTORUS_FIXED_POINT
+    case 'F':
+      fixed_point_enabled = 1;
+      break;
+    case 'C':
+      compare_frames = optarg ? strtoul(optarg, NULL, 0) : 100;
+      if (compare_frames == 0)
+        compare_frames = 1;
+      break;
+#endif
+    case 'B':
+      bench_frames = optarg ? strtoul(optarg, NULL, 0) : 500;
+      if (bench_frames == 0)
+        bench_frames = 1;
+      break;
+    case 'W':
+      golden_write = optarg;
+      break;
+    case 'K':
+      golden_check = optarg;
+      break;
+    case 'G':
+      golden_frames = optarg;
+      break;
+    case 'P':
+      tolerance = strtod(optarg, NULL);
+      break;
+    case 'S':
+      vm_shader_file = optarg;
+      break;
+    case 'L':
+      if (palette_set_default(optarg))
+        exit(1);
+      break;
+    case 'T':
+      selftest = 1;
+      break;
+    default:
+      usage(argv[0]);
+      exit(opt == 'h' ? 0 : 1);
+    }
+  }
+
+  num_entries = optind < argc ? argc - optind : 1;
+  if ((compare_frames || bench_frames || golden_write || golden_check) &&
+      optind >= argc)
+    num_entries = anim_table_size;
+  entries = calloc(num_entries, sizeof(*entries));
+  if (optind >= argc)
+  {
+    for (n = 0; n < num_entries; ++n)
+    {
+      entries[n].anim = &anim_table[n];
+      entries[n].duration = duration;
+    }
+  }
+  for (i = optind; i < argc; ++i)
+  {
+    if (playlist_parse_entry(&entries[i - optind], argv[i], duration))
+    {
+      fprintf(stderr, "Unknown animation or bad frame count in '%s'\n",
+              argv[i]);
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  trace_init("ledtorus_anim");
+  slice_pool_init(threads);
+  if (selftest)
+    exit(ut_selftest(threads));
+#ifndef LEDTORUS_FIXED_POINT
+  if (compare_frames)
+    exit(ut_compare(entries, num_entries, compare_frames));
+#endif
+  if (bench_frames)
+    exit(ut_bench(entries, num_entries, bench_frames, threads));
+  if (golden_write)
+    exit(ut_golden_write(golden_write, golden_frames, entries, num_entries));
+  if (golden_check)
+    exit(ut_golden_check(golden_check, golden_frames, tolerance, entries,
+                         num_entries));
+
+  output = output_new();
+  for (n = 0; n < num_sinks; ++n)
+    if (output_add_sink(output, sink_specs[n]))
+      exit(1);
+  player_init(&player, entries, num_entries, crossfade, loop, threads);
+
+  output_start(output);
+
+  for (n = 0; ; ++n)
+  {
+    frame_t *frame;
+    uint64_t t_start, t_done;
+
+    if (!(frame = output_frame(output)))
+      break;
+    t_start = trace_now();
+    if (!player_next_frame(&player, frame))
+      break;
+    t_done = trace_now();
+    trace_span("render", t_start, t_done, n);
+    trace_flow(0, t_done, n);
+
+    if (output_commit(output, n, t_done))
+      break;
+  }
+  return output_finish(output) ? 1 : 0;
+}
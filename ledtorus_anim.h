@@ -2,6 +2,10 @@
 #define LEDTORUS_ANIM_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "fixpoint.h"
 
 #define LEDS_X 7
 #define LEDS_Y 8
@@ -11,6 +15,7 @@ typedef uint8_t frame_t[LEDS_Y*LEDS_X*LEDS_TANG][3];
 #define F_PI 3.141592654f
 
 struct torus_xz { float x, z; };
+struct torus_xz_fix { fix16_t x, z; };
 
 
 static inline void
@@ -24,8 +29,106 @@ setpix(frame_t *f, uint32_t x, uint32_t y, uint32_t a,
 }
 
 
+union anim_data;
+
+/*
+  Entry in the table of animations.
+
+  init() (may be NULL) sets up a freshly zeroed state of state_size bytes,
+  and returns non-zero on failure. nextframe() renders frame number FRAME,
+  counting from 0, and returns non-zero when the animation wants to end.
+*/
+struct ledtorus_anim {
+  const char *name;
+  uint32_t (*init)(const struct ledtorus_anim *self, union anim_data *data);
+  uint32_t (*nextframe)(frame_t *f, uint32_t frame, union anim_data *data);
+  size_t state_size;
+  uint32_t flags;
+};
+
+/*
+  Each frame is a pure function of the frame number; the state (if any) is
+  not modified after init(). Such frames can be rendered out of order and
+  concurrently.
+*/
+#define ANIM_STATELESS 1
+/*
+  The state is modified by nextframe(), but only as scratch space (and may
+  hold pointers set up by init()); any frame can be rendered right after
+  init(). Such animations are started at a later frame without replaying or
+  checkpointing anything.
+*/
+#define ANIM_SEEKABLE 2
+
+extern const struct ledtorus_anim anim_table[];
+extern const uint32_t anim_table_size;
+/* Seed of the random numbers of the animations (ledtorus_anim -s). */
+extern uint64_t anim_seed;
+
+
 extern struct torus_xz torus_polar2rect(float x, float a);
+extern struct torus_xz_fix torus_polar2rect_fix(fix16_t x, fix16_t a);
+
+
+/*
+  Precomputed geometry of the LED positions: rect[a][x] is
+  torus_polar2rect(x, a), and cos_a[a]/sin_a[a] the cosine/sine of the angle
+  of slice a. Get it with torus_tables(), which builds it on first use; the
+  pointer stays valid, so fetch it once per frame, not per voxel. There is
+  one set of tables per USE_FIXED_POINT mode, as torus_polar2rect() differs.
+*/
+struct torus_tables {
+  float cos_a[LEDS_TANG] __attribute__((aligned(64)));
+  float sin_a[LEDS_TANG] __attribute__((aligned(64)));
+  struct torus_xz rect[LEDS_TANG][LEDS_X] __attribute__((aligned(64)));
+};
+
+extern struct torus_tables torus_tab[2];
+extern int torus_tab_ready[2];
+extern void torus_tables_build(int fixed);
+
+static inline const struct torus_tables *
+torus_tables(void)
+{
+  int fixed = USE_FIXED_POINT ? 1 : 0;
+
+  if (!__atomic_load_n(&torus_tab_ready[fixed], __ATOMIC_ACQUIRE))
+    torus_tables_build(fixed);
+  return &torus_tab[fixed];
+}
+
+
+/*
+  For positions rotated by a fractional number of slices DA, compute
+  R = torus_rotation(DA) once, then torus_rect_rotated(t, x, a, R) gives
+  torus_polar2rect(x, a + DA) without any trigonometry.
+*/
+struct torus_rot { float c, s; };
+
+static inline struct torus_rot
+torus_rotation(float da)
+{
+  struct torus_rot r;
+  float angle = da * (F_PI*2.0f/(float)LEDS_TANG);
+  r.c = cosf(angle);
+  r.s = sinf(angle);
+  return r;
+}
+
+static inline struct torus_xz
+torus_rect_rotated(const struct torus_tables *t, uint32_t x, uint32_t a,
+                   struct torus_rot r)
+{
+  struct torus_xz p = t->rect[a][x];
+  struct torus_xz res;
+  res.x = p.x*r.c - p.z*r.s;
+  res.z = p.x*r.s + p.z*r.c;
+  return res;
+}
+
+struct layer;
+
 extern void cls(frame_t *f);
-extern void envelope(frame_t *f, uint32_t c);
+extern void envelope(struct layer *l, uint32_t c);
 
 #endif  /* LEDTORUS_ANIM_H */
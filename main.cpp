@@ -46,8 +46,10 @@
 #include "window.h"
 #include "io.h"
 #include "ledtorus.h"
+#include "trace.h"
 int main(int argc, char *argv[])
 {
+    trace_init("ledtorus-viewer");
     QApplication app(argc, argv);
     Window window;
     window.resize(window.sizeHint());
@@ -0,0 +1,580 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "output.h"
+#include "trace.h"
+
+
+/*
+  Pipelined output with fan-out.
+
+  The main thread asks for a free buffer, renders the next frame into it and
+  commits it; the padding after the frame is stamped at that point, and the
+  buffer is appended to the queue of each sink, which takes a reference on
+  it. The writer thread of a sink takes everything in its queue at once and
+  writes it with one writev(), dropping each reference as soon as the bytes
+  of that frame are out, also in the middle of a short write. The sinks
+  hold at most OUTPUT_QUEUE queued plus OUTPUT_BATCH frames being written
+  each, so with enough buffers for that there is always a free one, and the
+  only place rendering waits is the policy check in output_commit().
+
+  A sink that fails (eg. the reader of a pipe went away) is dropped; if it
+  was a blocking one, or the last one, the output as a whole fails.
+*/
+
+
+static const char *const output_policy_names[] = {
+  "block", "drop-oldest", "skip"
+};
+
+
+static uint8_t *
+output_buf(const struct output *o, uint32_t buf)
+{
+  return o->bufs + (size_t)buf*o->frame_bytes;
+}
+
+
+struct output *
+output_new(void)
+{
+  struct output *o = calloc(1, sizeof(*o));
+
+  if (!o)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  o->frame_bytes = (sizeof(frame_t) + OUTPUT_ALIGN - 1)/OUTPUT_ALIGN*OUTPUT_ALIGN;
+  pthread_mutex_init(&o->mutex, NULL);
+  pthread_cond_init(&o->space_cond, NULL);
+  return o;
+}
+
+
+static int
+output_connect_unix(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+/* Connect to "HOST:PORT". */
+static int
+output_connect_tcp(const char *hostport)
+{
+  struct addrinfo hints, *res, *ai;
+  char host[256];
+  const char *colon = strrchr(hostport, ':');
+  int fd = -1, err;
+
+  if (!colon || (size_t)(colon - hostport) >= sizeof(host))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  memcpy(host, hostport, colon - hostport);
+  host[colon - hostport] = '\0';
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if ((err = getaddrinfo(host, colon + 1, &hints, &res)))
+  {
+    fprintf(stderr, "Error: %s: %s\n", hostport, gai_strerror(err));
+    errno = EHOSTUNREACH;
+    return -1;
+  }
+  for (ai = res; ai; ai = ai->ai_next)
+  {
+    if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+
+/*
+  Add a sink given as TARGET[,POLICY]. TARGET is "-" for stdout,
+  "unix:PATH" or "tcp:HOST:PORT" for a socket to connect to, or else a file
+  or FIFO to open for writing (which for a FIFO waits for a reader). The
+  part after the last comma is only taken as the policy if it is one, so
+  TARGET may contain commas. Returns non-zero on error.
+*/
+int
+output_add_sink(struct output *o, const char *spec)
+{
+  struct output_sink *s, *sinks;
+  enum output_policy policy = OUTPUT_POLICY_BLOCK;
+  const char *comma = strrchr(spec, ',');
+  char *name;
+  uint32_t i;
+  int fd;
+
+  name = strdup(spec);
+  if (comma)
+  {
+    for (i = 0; i < sizeof(output_policy_names)/sizeof(output_policy_names[0]);
+         ++i)
+      if (0 == strcmp(comma + 1, output_policy_names[i]))
+      {
+        policy = (enum output_policy)i;
+        free(name);
+        name = strndup(spec, comma - spec);
+        break;
+      }
+  }
+  if (!name)
+    return 1;
+
+  /* Two writers on one target would interleave their frames. */
+  for (i = 0; i < o->num_sinks; ++i)
+    if (0 == strcmp(name, o->sinks[i].name))
+    {
+      fprintf(stderr, "Error: output '%s' given twice\n", name);
+      free(name);
+      return 1;
+    }
+
+  if (0 == strcmp(name, "-"))
+    fd = 1;
+  else if (0 == strncmp(name, "unix:", 5))
+    fd = output_connect_unix(name + 5);
+  else if (0 == strncmp(name, "tcp:", 4))
+    fd = output_connect_tcp(name + 4);
+  else
+    fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error: cannot open output '%s': %s\n", name,
+            strerror(errno));
+    free(name);
+    return 1;
+  }
+
+  sinks = realloc(o->sinks, (o->num_sinks + 1)*sizeof(*sinks));
+  if (!sinks)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  o->sinks = sinks;
+  s = &o->sinks[o->num_sinks];
+  memset(s, 0, sizeof(*s));
+  s->out = o;
+  s->name = name;
+  s->index = o->num_sinks++;
+  s->fd = fd;
+  s->policy = policy;
+  return 0;
+}
+
+
+/* Drop the references of the sinks on buffers. Called with the lock held. */
+static void
+output_release(struct output *o, const uint32_t *bufs, uint32_t count)
+{
+  uint32_t i;
+
+  for (i = 0; i < count; ++i)
+    --o->refs[bufs[i]];
+  pthread_cond_broadcast(&o->space_cond);
+}
+
+
+/* Wait until FD can take more data, when it is non-blocking. */
+static int
+output_wait_writable(int fd)
+{
+  struct pollfd pfd;
+
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  while (poll(&pfd, 1, -1) < 0)
+    if (errno != EINTR)
+      return -1;
+  return 0;
+}
+
+
+/*
+  Write the COUNT buffers BUFS to sink S, all of them, releasing each one
+  as soon as it is out (or, on error, all of the rest). Returns non-zero on
+  a write error.
+*/
+static int
+output_write_bufs(struct output_sink *s, const uint32_t *bufs, uint32_t count)
+{
+  struct output *o = s->out;
+  struct iovec iov[OUTPUT_BATCH];
+  uint32_t done = 0, i;
+  size_t offset = 0;
+
+  while (done < count)
+  {
+    uint32_t first = done;
+    ssize_t res;
+
+    for (i = done; i < count; ++i)
+    {
+      iov[i - done].iov_base = output_buf(o, bufs[i]);
+      iov[i - done].iov_len = o->frame_bytes;
+    }
+    iov[0].iov_base = (uint8_t *)iov[0].iov_base + offset;
+    iov[0].iov_len -= offset;
+    res = writev(s->fd, iov, count - done);
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+          output_wait_writable(s->fd) == 0)
+        continue;
+      fprintf(stderr, "Error: writing to '%s': %s\n", s->name, strerror(errno));
+      pthread_mutex_lock(&o->mutex);
+      output_release(o, bufs + done, count - done);
+      pthread_mutex_unlock(&o->mutex);
+      return 1;
+    }
+    offset += (size_t)res;
+    while (done < count && offset >= o->frame_bytes)
+    {
+      offset -= o->frame_bytes;
+      ++done;
+    }
+
+    if (done > first)
+    {
+      pthread_mutex_lock(&o->mutex);
+      output_release(o, bufs + first, done - first);
+      s->written += done - first;
+      pthread_mutex_unlock(&o->mutex);
+    }
+  }
+  return 0;
+}
+
+
+static void *
+output_thread(void *arg)
+{
+  struct output_sink *s = arg;
+  struct output *o = s->out;
+
+  trace_thread_name("output");
+  pthread_mutex_lock(&o->mutex);
+  for (;;)
+  {
+    uint32_t bufs[OUTPUT_BATCH];
+    uint32_t count, i;
+    uint64_t t_start;
+    int err;
+
+    while (!o->stop && s->queue_count == 0)
+    {
+      s->writer_idle = 1;
+      pthread_cond_wait(&s->data_cond, &o->mutex);
+      s->writer_idle = 0;
+    }
+    if (s->queue_count == 0)
+      break;
+    count = s->queue_count < OUTPUT_BATCH ? s->queue_count : OUTPUT_BATCH;
+    for (i = 0; i < count; ++i)
+      bufs[i] = s->queue[(s->queue_first + i) % OUTPUT_QUEUE];
+    s->queue_first = (s->queue_first + count) % OUTPUT_QUEUE;
+    s->queue_count -= count;
+    pthread_cond_broadcast(&o->space_cond);
+    pthread_mutex_unlock(&o->mutex);
+
+    t_start = trace_now();
+    err = output_write_bufs(s, bufs, count);
+    trace_span("write", t_start, trace_now(), s->written);
+
+    pthread_mutex_lock(&o->mutex);
+    if (err)
+    {
+      /* Give up on this sink, and whatever it still has queued. */
+      s->error = 1;
+      for (i = 0; i < s->queue_count; ++i)
+        --o->refs[s->queue[(s->queue_first + i) % OUTPUT_QUEUE]];
+      s->queue_count = 0;
+      pthread_cond_broadcast(&o->space_cond);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&o->mutex);
+  return NULL;
+}
+
+
+/*
+  Allocate the buffers and start the writers. Without any sink added, the
+  output goes to stdout.
+*/
+void
+output_start(struct output *o)
+{
+  void *bufs = NULL;
+  uint32_t i;
+
+  if (o->num_sinks == 0 && output_add_sink(o, "-"))
+    exit(1);
+  /* A reader going away is an error on that sink, not the end of us. */
+  signal(SIGPIPE, SIG_IGN);
+
+  o->num_bufs = o->num_sinks*(OUTPUT_QUEUE + OUTPUT_BATCH) + 1;
+  if (posix_memalign(&bufs, 4096, (size_t)o->num_bufs*o->frame_bytes))
+    bufs = NULL;
+  o->refs = calloc(o->num_bufs, sizeof(*o->refs));
+  if (!bufs || !o->refs)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  /* The padding is zero apart from the stamp. */
+  memset(bufs, 0, (size_t)o->num_bufs*o->frame_bytes);
+  o->bufs = bufs;
+
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    struct output_sink *s = &o->sinks[i];
+
+    pthread_cond_init(&s->data_cond, NULL);
+    if (pthread_create(&s->thread, NULL, output_thread, s))
+    {
+      fprintf(stderr, "Error: cannot start output thread\n");
+      exit(1);
+    }
+    s->thread_running = 1;
+  }
+}
+
+
+/*
+  The output has failed when a blocking sink has, or all of them have.
+  Called with the lock held.
+*/
+static int
+output_failed(const struct output *o)
+{
+  uint32_t i, alive = 0;
+
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    if (!o->sinks[i].error)
+      ++alive;
+    else if (o->sinks[i].policy == OUTPUT_POLICY_BLOCK)
+      return 1;
+  }
+  return alive == 0;
+}
+
+
+/*
+  Whether a new frame can be queued: all blocking sinks have room for it,
+  or, without blocking sinks, at least one sink has. Called with the lock
+  held.
+*/
+static int
+output_ready(const struct output *o)
+{
+  uint32_t i;
+  int blocking = 0, room = 0;
+
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    const struct output_sink *s = &o->sinks[i];
+
+    if (s->error)
+      continue;
+    if (s->policy == OUTPUT_POLICY_BLOCK)
+    {
+      if (s->queue_count >= OUTPUT_QUEUE)
+        return 0;
+      blocking = 1;
+    }
+    else if (s->queue_count < OUTPUT_QUEUE)
+      room = 1;
+  }
+  return blocking || room;
+}
+
+
+/* Get the buffer to render the next frame into. NULL if the output failed. */
+frame_t *
+output_frame(struct output *o)
+{
+  uint32_t i;
+  frame_t *f = NULL;
+
+  pthread_mutex_lock(&o->mutex);
+  while (!output_failed(o))
+  {
+    for (i = 1; i <= o->num_bufs; ++i)
+      if (o->refs[(o->cur + i) % o->num_bufs] == 0)
+        break;
+    if (i <= o->num_bufs)
+    {
+      o->cur = (o->cur + i) % o->num_bufs;
+      f = (frame_t *)output_buf(o, o->cur);
+      break;
+    }
+    /* Not reached with the buffers sized for the worst case. */
+    pthread_cond_wait(&o->space_cond, &o->mutex);
+  }
+  pthread_mutex_unlock(&o->mutex);
+  return f;
+}
+
+
+/*
+  Queue the frame rendered into the buffer from output_frame() on each sink,
+  stamping it with FRAME_ID and DONE_NS. Waits for blocking sinks with a
+  full queue, and drops frames on the others. Returns non-zero if the output
+  has failed.
+*/
+int
+output_commit(struct output *o, uint64_t frame_id, uint64_t done_ns)
+{
+  uint8_t *pad = output_buf(o, o->cur) + sizeof(frame_t);
+  uint64_t t_start = trace_now();
+  uint32_t i;
+  int waited = 0;
+
+  /* Stamp the frame, for latency measurements in the viewer. */
+  if (o->frame_bytes - sizeof(frame_t) >= sizeof(struct frame_stamp))
+  {
+    struct frame_stamp stamp;
+
+    stamp.magic = FRAME_STAMP_MAGIC;
+    stamp.reserved = 0;
+    stamp.frame_id = frame_id;
+    stamp.done_ns = done_ns;
+    memcpy(pad, &stamp, sizeof(stamp));
+  }
+
+  pthread_mutex_lock(&o->mutex);
+  while (!output_failed(o) && !output_ready(o))
+  {
+    pthread_cond_wait(&o->space_cond, &o->mutex);
+    waited = 1;
+  }
+  if (output_failed(o))
+  {
+    pthread_mutex_unlock(&o->mutex);
+    return 1;
+  }
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    struct output_sink *s = &o->sinks[i];
+
+    if (s->error)
+      continue;
+    if (s->queue_count >= OUTPUT_QUEUE)
+    {
+      ++s->dropped;
+      if (trace_enabled)
+      {
+        char name[32];
+
+        snprintf(name, sizeof(name), "dropped %u", s->index);
+        trace_counter(name, t_start, (double)s->dropped);
+      }
+      if (s->policy != OUTPUT_POLICY_DROP_OLDEST)
+        continue;
+      --o->refs[s->queue[s->queue_first]];
+      s->queue_first = (s->queue_first + 1) % OUTPUT_QUEUE;
+      --s->queue_count;
+    }
+    s->queue[(s->queue_first + s->queue_count++) % OUTPUT_QUEUE] = o->cur;
+    ++o->refs[o->cur];
+    if (s->writer_idle)
+      pthread_cond_signal(&s->data_cond);
+  }
+  pthread_mutex_unlock(&o->mutex);
+  if (waited)
+    trace_span("output wait", t_start, trace_now(), frame_id);
+  return 0;
+}
+
+
+/*
+  Write out everything queued, stop the writers and free O. Reports the
+  frames dropped per sink. Returns non-zero if the output failed.
+*/
+int
+output_finish(struct output *o)
+{
+  uint32_t i;
+  int err;
+
+  pthread_mutex_lock(&o->mutex);
+  o->stop = 1;
+  for (i = 0; i < o->num_sinks; ++i)
+    if (o->sinks[i].thread_running)
+      pthread_cond_signal(&o->sinks[i].data_cond);
+  pthread_mutex_unlock(&o->mutex);
+
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    struct output_sink *s = &o->sinks[i];
+
+    if (s->thread_running)
+    {
+      pthread_join(s->thread, NULL);
+      pthread_cond_destroy(&s->data_cond);
+    }
+    if (s->dropped)
+      fprintf(stderr, "Output '%s' (%s): %llu frames written, %llu dropped\n",
+              s->name, output_policy_names[s->policy],
+              (unsigned long long)s->written, (unsigned long long)s->dropped);
+  }
+  err = output_failed(o);
+
+  for (i = 0; i < o->num_sinks; ++i)
+  {
+    if (o->sinks[i].fd != 1)
+      close(o->sinks[i].fd);
+    free((char *)o->sinks[i].name);
+  }
+  pthread_mutex_destroy(&o->mutex);
+  pthread_cond_destroy(&o->space_cond);
+  free(o->sinks);
+  free(o->refs);
+  free(o->bufs);
+  free(o);
+  return err;
+}
@@ -0,0 +1,80 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <pthread.h>
+
+#include "ledtorus_anim.h"
+
+/*
+  Output stage: frames are rendered straight into a pool of padded output
+  buffers and sent to one or more sinks (stdout, files, FIFOs, sockets).
+  Each sink has its own queue and writer thread, which writes as many
+  queued frames as there are in one writev().
+
+  What happens when a sink's queue is full depends on its policy:
+    block        rendering waits for the sink (the default)
+    drop-oldest  the oldest queued frame is dropped for the new one
+    skip         the new frame is dropped
+  Rendering waits for all blocking sinks, or if there are none, until at
+  least one sink can take the frame.
+*/
+
+/* Frames are padded to a multiple of this on the wire. */
+#define OUTPUT_ALIGN 512
+/* Frames queued per sink, and frames written per writev() at most. */
+#define OUTPUT_QUEUE 16
+#define OUTPUT_BATCH 16
+
+enum output_policy {
+  OUTPUT_POLICY_BLOCK,
+  OUTPUT_POLICY_DROP_OLDEST,
+  OUTPUT_POLICY_SKIP
+};
+
+struct output;
+
+struct output_sink {
+  struct output *out;
+  const char *name;
+  uint32_t index;
+  int fd;
+  enum output_policy policy;
+  /* Ring of queued buffer numbers. */
+  uint32_t queue[OUTPUT_QUEUE];
+  uint32_t queue_first;
+  uint32_t queue_count;
+  uint64_t written;
+  uint64_t dropped;
+  int error;
+  /* The writer is waiting for frames (and needs a signal). */
+  int writer_idle;
+  pthread_t thread;
+  int thread_running;
+  pthread_cond_t data_cond;
+};
+
+struct output {
+  struct output_sink *sinks;
+  uint32_t num_sinks;
+  /* Pool of padded frame buffers, each referenced by the sinks that have it
+     queued or are writing it. */
+  uint32_t frame_bytes;
+  uint32_t num_bufs;
+  uint8_t *bufs;
+  uint32_t *refs;
+  /* Buffer handed out by output_frame(). */
+  uint32_t cur;
+  int stop;
+  pthread_mutex_t mutex;
+  pthread_cond_t space_cond;
+};
+
+extern struct output *output_new(void);
+extern int output_add_sink(struct output *o, const char *spec);
+extern void output_start(struct output *o);
+extern frame_t *output_frame(struct output *o);
+extern int output_commit(struct output *o, uint64_t frame_id,
+                         uint64_t done_ns);
+extern int output_finish(struct output *o);
+
+#endif  /* OUTPUT_H */
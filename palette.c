@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "palette.h"
+#include "colours.h"
+
+
+/*
+  Build P from NUM_STOPS (at least 1) control points, sorted by position.
+*/
+void
+palette_from_stops(struct palette *p, const struct palette_stop *stops,
+                   uint32_t num_stops)
+{
+  uint32_t i, k = 0;
+
+  p->lut[0] = 0;
+  for (i = 0; i < PALETTE_SIZE; ++i)
+  {
+    float pos = ((float)i + 0.5f)*(1.0f/(float)PALETTE_SIZE);
+    const struct palette_stop *s0, *s1;
+    float w;
+
+    while (k + 1 < num_stops && stops[k+1].pos <= pos)
+      ++k;
+    s0 = &stops[k];
+    s1 = k + 1 < num_stops ? &stops[k+1] : s0;
+    if (pos <= s0->pos || s1 == s0)
+      w = 0.0f;
+    else
+      w = (pos - s0->pos)/(s1->pos - s0->pos);
+    p->lut[1+i] =
+      (uint32_t)((float)s0->r + ((float)s1->r - (float)s0->r)*w + 0.5f) |
+      (uint32_t)((float)s0->g + ((float)s1->g - (float)s0->g)*w + 0.5f) << 8 |
+      (uint32_t)((float)s0->b + ((float)s1->b - (float)s0->b)*w + 0.5f) << 16;
+  }
+}
+
+
+/*
+  Load P from the control points in FILENAME (see palette.h). Errors go to
+  stderr; returns non-zero on error, leaving P unchanged.
+*/
+int
+palette_load(struct palette *p, const char *filename)
+{
+  struct palette_stop stops[PALETTE_MAX_STOPS];
+  FILE *fp;
+  char line[256];
+  uint32_t num_stops = 0, lineno = 0;
+  int err = 0;
+
+  if (!(fp = fopen(filename, "r")))
+  {
+    fprintf(stderr, "Error: cannot read palette '%s'\n", filename);
+    return 1;
+  }
+  while (!err && fgets(line, sizeof(line), fp))
+  {
+    unsigned r, g, b;
+    float pos;
+    int len = 0;
+
+    ++lineno;
+    line[strcspn(line, "\r\n")] = '\0';
+    sscanf(line, " %n", &len);
+    if (line[len] == '\0' || line[len] == '#')
+      continue;
+    if (sscanf(line, "%f%n", &pos, &len) != 1 ||
+        (sscanf(line + len, " #%2x%2x%2x", &r, &g, &b) != 3 &&
+         sscanf(line + len, "%u %u %u", &r, &g, &b) != 3))
+    {
+      fprintf(stderr, "%s:%u: expected a position and a colour\n", filename,
+              lineno);
+      err = 1;
+    }
+    else if (!isfinite(pos) || pos < 0.0f || pos > 1.0f ||
+             r > 255 || g > 255 || b > 255 ||
+             (num_stops > 0 && pos < stops[num_stops-1].pos))
+    {
+      fprintf(stderr, "%s:%u: position or colour out of range\n", filename,
+              lineno);
+      err = 1;
+    }
+    else if (num_stops >= PALETTE_MAX_STOPS)
+    {
+      fprintf(stderr, "%s:%u: too many control points\n", filename, lineno);
+      err = 1;
+    }
+    else
+    {
+      stops[num_stops].pos = pos;
+      stops[num_stops].r = r;
+      stops[num_stops].g = g;
+      stops[num_stops].b = b;
+      ++num_stops;
+    }
+  }
+  fclose(fp);
+  if (!err && num_stops == 0)
+  {
+    fprintf(stderr, "%s: no control points\n", filename);
+    err = 1;
+  }
+  if (!err)
+    palette_from_stops(p, stops, num_stops);
+  return err;
+}
+
+
+static struct palette default_palette;
+static int default_palette_ready;
+
+
+static void
+palette_build_default(void)
+{
+  struct palette_stop stops[256];
+  uint32_t i;
+
+  /* Each entry of the gradient is the colour at the middle of its step. */
+  for (i = 0; i < 256; ++i)
+  {
+    stops[i].pos = ((float)i + 0.5f)*(1.0f/256.0f);
+    stops[i].r = colour_gradient_blue_green_gold[i][0];
+    stops[i].g = colour_gradient_blue_green_gold[i][1];
+    stops[i].b = colour_gradient_blue_green_gold[i][2];
+  }
+  palette_from_stops(&default_palette, stops, 256);
+  __atomic_store_n(&default_palette_ready, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+  The palette of the animations that do not have their own: the one given
+  to palette_set_default(), or colour_gradient_blue_green_gold. Safe to
+  call from several threads at once.
+*/
+const struct palette *
+palette_default(void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  if (!__atomic_load_n(&default_palette_ready, __ATOMIC_ACQUIRE))
+    pthread_once(&once, palette_build_default);
+  return &default_palette;
+}
+
+
+/*
+  Use the palette in FILENAME as the default (ledtorus_anim --palette),
+  before any animation starts. Returns non-zero on error.
+*/
+int
+palette_set_default(const char *filename)
+{
+  if (palette_load(&default_palette, filename))
+    return 1;
+  __atomic_store_n(&default_palette_ready, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+/*
+  The mapping runs in chunks of this many values, in three loops that each
+  vectorise: positions to table indices, the lookup (a gather with AVX2;
+  GCC only vectorises it as a loop of its own), and the split into bytes.
+  The chunks stay in L1, so this is still a single pass over the values.
+*/
+#define PALETTE_CHUNK 64
+
+/*
+  As in particles.c, the selects need GCC to know that nothing traps in
+  order to vectorise.
+*/
+#pragma GCC push_options
+#pragma GCC optimize ("no-trapping-math")
+
+static inline __attribute__((always_inline)) void
+palette_map_kernel(const uint32_t *lut, float threshold, float lo,
+                   float scale, const float *v, uint8_t (*out)[3], size_t n)
+{
+  int32_t idx[PALETTE_CHUNK];
+  uint32_t c[PALETTE_CHUNK];
+  size_t base, i;
+
+  for (base = 0; base < n; base += PALETTE_CHUNK)
+  {
+    size_t m = n - base < PALETTE_CHUNK ? n - base : PALETTE_CHUNK;
+    const float *vb = v + base;
+    uint8_t (*ob)[3] = out + base;
+
+    for (i = 0; i < m; ++i)
+    {
+      float fi = (vb[i] - lo)*scale;
+      fi = fi < 0.0f ? 0.0f : fi;
+      fi = fi > (float)(PALETTE_SIZE-1) ? (float)(PALETTE_SIZE-1) : fi;
+      idx[i] = vb[i] >= threshold ? (int32_t)fi + 1 : 0;
+    }
+    for (i = 0; i < m; ++i)
+      c[i] = lut[idx[i]];
+    for (i = 0; i < m; ++i)
+    {
+      ob[i][0] = (uint8_t)c[i];
+      ob[i][1] = (uint8_t)(c[i] >> 8);
+      ob[i][2] = (uint8_t)(c[i] >> 16);
+    }
+  }
+}
+
+
+static void
+palette_map_generic(const uint32_t *lut, float threshold, float lo,
+                    float scale, const float *v, uint8_t (*out)[3], size_t n)
+{
+  palette_map_kernel(lut, threshold, lo, scale, v, out, n);
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+static __attribute__((target("avx2"))) void
+palette_map_avx2(const uint32_t *lut, float threshold, float lo, float scale,
+                 const float *v, uint8_t (*out)[3], size_t n)
+{
+  palette_map_kernel(lut, threshold, lo, scale, v, out, n);
+}
+
+#endif
+
+#pragma GCC pop_options
+
+
+static void palette_map_select(const uint32_t *lut, float threshold,
+                               float lo, float scale, const float *v,
+                               uint8_t (*out)[3], size_t n);
+
+static void (*palette_map_fn)(const uint32_t *, float, float, float,
+                              const float *, uint8_t (*)[3], size_t) =
+  palette_map_select;
+
+
+static void
+palette_map_select(const uint32_t *lut, float threshold, float lo,
+                   float scale, const float *v, uint8_t (*out)[3], size_t n)
+{
+  void (*fn)(const uint32_t *, float, float, float, const float *,
+             uint8_t (*)[3], size_t) = palette_map_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    fn = palette_map_avx2;
+#endif
+  palette_map_fn = fn;
+  fn(lut, threshold, lo, scale, v, out, n);
+}
+
+
+/*
+  Colour N voxels OUT from the values V: black below M->threshold, else the
+  colour of P at (v - M->lo)/(M->hi - M->lo), clamped to 0..1.
+*/
+void
+palette_map(const struct palette *p, const struct palette_map *m,
+            const float *v, uint8_t (*out)[3], size_t n)
+{
+  palette_map_fn(p->lut, m->threshold, m->lo,
+                 (float)PALETTE_SIZE/(m->hi - m->lo), v, out, n);
+}
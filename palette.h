@@ -0,0 +1,64 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Colour palettes.
+
+  A palette is a lookup table of PALETTE_SIZE colours along 0..1, fine
+  enough that its steps do not show even in slow gradients. It is built by
+  linear interpolation between control points, which come from code or
+  from a file (palette_load()) with one point per line:
+
+    # position  colour (0..255 each, or #rrggbb)
+    0.0   0 0 0
+    0.4   #1d38be
+    1.0   255 230 140
+
+  Positions are 0..1 and increasing; before the first point and after the
+  last, the palette has their colour.
+
+  palette_map() turns an array of values into colours in one pass: the
+  values are scaled to positions in the palette, clamped (so that values
+  past the ends saturate at the end colours), and looked up, with values
+  below a threshold left black. The lookup is a gather, so it vectorises.
+*/
+
+#define PALETTE_BITS 12
+#define PALETTE_SIZE (1 << PALETTE_BITS)
+#define PALETTE_MAX_STOPS 256
+
+struct palette {
+  /*
+    lut[1+i] is the colour at position (i + 0.5)/PALETTE_SIZE, packed as
+    r | g<<8 | b<<16;
+    lut[0] is black, for the values below the threshold of palette_map().
+  */
+  uint32_t lut[PALETTE_SIZE + 1];
+};
+
+struct palette_stop {
+  float pos;
+  uint8_t r, g, b;
+};
+
+struct palette_map {
+  /* Values below this are black. */
+  float threshold;
+  /* Values mapped to the start and the end of the palette. */
+  float lo, hi;
+};
+
+
+extern void palette_from_stops(struct palette *p,
+                               const struct palette_stop *stops,
+                               uint32_t num_stops);
+extern int palette_load(struct palette *p, const char *filename);
+extern const struct palette *palette_default(void);
+extern int palette_set_default(const char *filename);
+extern void palette_map(const struct palette *p, const struct palette_map *m,
+                        const float *v, uint8_t (*out)[3], size_t n);
+
+#endif  /* PALETTE_H */
@@ -0,0 +1,202 @@
+#include "particles.h"
+
+
+/* Particles are drawn in batches of this many. */
+#define PARTICLES_CHUNK 256
+
+
+/*
+  The loops below select with ?: rather than branch. None of it raises
+  floating-point exceptions, and GCC needs to be told so to if-convert them
+  (same as the batch noise in simplex_noise.c).
+*/
+#pragma GCC push_options
+#pragma GCC optimize ("no-trapping-math")
+
+
+void
+particles_init(struct particle_set *ps)
+{
+  ps->count = 0;
+}
+
+
+/*
+  Allocate a new particle, returning its index, or -1 if the set is full. The
+  caller must fill in all of its fields.
+*/
+int32_t
+particles_add(struct particle_set *ps)
+{
+  if (ps->count >= PARTICLES_MAX)
+    return -1;
+  return (int32_t)ps->count++;
+}
+
+
+static inline int
+particles_alive(const struct particle_set *ps, uint32_t i, float min_val)
+{
+  return ps->val[i] > min_val && ps->ground_frames[i] >= 0;
+}
+
+
+/*
+  Advance all particles by one frame, and remove the dead ones.
+
+  The integration loop is branch-free, so it vectorises. Dead particles are
+  removed afterwards by sliding the live ones down, which keeps them in the
+  order they were added (the draw order), unlike swapping in the last one.
+*/
+void
+particles_update(struct particle_set *ps, const struct particle_params *p)
+{
+  const uint32_t n = ps->count;
+  const float keep = 1.0f - p->drag;
+  const float gravity = p->gravity;
+  const float ground = p->ground;
+  const float min_val = p->min_val;
+  uint32_t i, j, dead;
+
+  dead = 0;
+  for (i = 0; i < n; ++i)
+  {
+    float y = ps->y[i] + ps->vy[i];
+    float z = ps->z[i] + ps->vz[i];
+    int32_t landed = (z <= ground);
+
+    y += (y < 0.0f ? (float)LEDS_TANG : 0.0f);
+    y -= (y >= (float)LEDS_TANG ? (float)LEDS_TANG : 0.0f);
+    ps->x[i] += ps->vx[i];
+    ps->y[i] = y;
+    ps->z[i] = (landed ? ground : z);
+    ps->vx[i] *= keep;
+    ps->vy[i] *= keep;
+    ps->vz[i] = ps->vz[i]*keep - gravity;
+    ps->val[i] -= ps->fade[i];
+    ps->ground_frames[i] -= landed;
+    dead += (ps->val[i] <= min_val) | (ps->ground_frames[i] < 0);
+  }
+  if (!dead)
+    return;
+
+  for (i = 0; i < n && particles_alive(ps, i, min_val); ++i)
+    ;
+  for (j = i; i < n; ++i)
+  {
+    if (!particles_alive(ps, i, min_val))
+      continue;
+    ps->x[j] = ps->x[i];
+    ps->y[j] = ps->y[i];
+    ps->z[j] = ps->z[i];
+    ps->vx[j] = ps->vx[i];
+    ps->vy[j] = ps->vy[i];
+    ps->vz[j] = ps->vz[i];
+    ps->hue[j] = ps->hue[i];
+    ps->sat[j] = ps->sat[i];
+    ps->val[j] = ps->val[i];
+    ps->fade[j] = ps->fade[i];
+    ps->ground_frames[j] = ps->ground_frames[i];
+    ++j;
+  }
+  ps->count = j;
+}
+
+
+/*
+  Draw each particle into its nearest voxel, later particles on top. The
+  voxel index and colour of a chunk of particles are computed in one
+  vectorised loop, then written out with a plain scatter.
+*/
+void
+particles_render(const struct particle_set *ps, frame_t *f)
+{
+  int32_t idx[PARTICLES_CHUNK];
+  uint8_t r[PARTICLES_CHUNK], g[PARTICLES_CHUNK], b[PARTICLES_CHUNK];
+  uint32_t base, i;
+
+  for (base = 0; base < ps->count; base += PARTICLES_CHUNK)
+  {
+    uint32_t n = ps->count - base;
+    const float *px = ps->x + base, *py = ps->y + base, *pz = ps->z + base;
+    const float *ph = ps->hue + base, *psat = ps->sat + base;
+    const float *pv = ps->val + base;
+
+    if (n > PARTICLES_CHUNK)
+      n = PARTICLES_CHUNK;
+    for (i = 0; i < n; ++i)
+    {
+      float x = px[i], y = py[i], z = pz[i];
+      float v = pv[i];
+      float h6, c;
+      int32_t ix, ia, iz;
+      int valid;
+
+      /* Rounding by truncation, as the coordinates are checked > -0.5. */
+      ix = (int32_t)(x + 0.5f);
+      ia = (int32_t)(y + 0.5f);
+      iz = (int32_t)(z + 0.5f);
+      ia -= (ia >= LEDS_TANG ? LEDS_TANG : 0);
+      valid = (x > -0.5f) & (x < (float)LEDS_X - 0.5f) &
+        (z > -0.5f) & (z < (float)LEDS_Y - 0.5f);
+      idx[i] = (valid ? (LEDS_Y-1-iz) + ix*LEDS_Y + ia*(LEDS_Y*LEDS_X) : -1);
+
+      v = (v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v));
+      c = v*psat[i];
+      h6 = 6.0f*ph[i];
+      r[i] = (uint8_t)(0.1f + 255.8f*splat_hsv_channel(5.0f, h6, v, c));
+      g[i] = (uint8_t)(0.1f + 255.8f*splat_hsv_channel(3.0f, h6, v, c));
+      b[i] = (uint8_t)(0.1f + 255.8f*splat_hsv_channel(1.0f, h6, v, c));
+    }
+    for (i = 0; i < n; ++i)
+    {
+      uint8_t *p;
+
+      if (idx[i] < 0)
+        continue;
+      p = (*f)[idx[i]];
+      p[0] = r[i];
+      p[1] = g[i];
+      p[2] = b[i];
+    }
+  }
+}
+
+
+/*
+  Splat the particles, antialiased, into an accumulation buffer; see
+  splat.h. The colours of a chunk are converted in one vectorised loop.
+*/
+void
+particles_splat(const struct particle_set *ps, struct splat_buffer *b)
+{
+  float row[PARTICLES_CHUNK];
+  float r[PARTICLES_CHUNK], g[PARTICLES_CHUNK], bl[PARTICLES_CHUNK];
+  uint32_t base, i;
+
+  for (base = 0; base < ps->count; base += PARTICLES_CHUNK)
+  {
+    uint32_t n = ps->count - base;
+    const float *pz = ps->z + base;
+    const float *ph = ps->hue + base, *psat = ps->sat + base;
+    const float *pv = ps->val + base;
+
+    if (n > PARTICLES_CHUNK)
+      n = PARTICLES_CHUNK;
+    for (i = 0; i < n; ++i)
+    {
+      float v = (pv[i] < 0.0f ? 0.0f : pv[i]);
+      float c = v*psat[i];
+      float h6 = 6.0f*ph[i];
+
+      row[i] = (float)(LEDS_Y-1) - pz[i];
+      r[i] = splat_hsv_channel(5.0f, h6, v, c);
+      g[i] = splat_hsv_channel(3.0f, h6, v, c);
+      bl[i] = splat_hsv_channel(1.0f, h6, v, c);
+    }
+    splat_points(b, ps->x + base, row, ps->y + base, r, g, bl, n);
+  }
+}
+
+
+#pragma GCC pop_options
@@ -0,0 +1,50 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include "ledtorus_anim.h"
+#include "splat.h"
+
+/*
+  Particle system, stored as structure-of-arrays so that the per-frame update
+  is a handful of straight loops that the compiler vectorises.
+
+  Positions are in LED units: x radial (0..LEDS_X-1), y tangential in slices
+  (wrapping around at LEDS_TANG), z height above the bottom LED row. The set
+  lives inside the animation state (union anim_data), so it has a fixed
+  capacity and no pointers.
+*/
+
+#define PARTICLES_MAX 131072
+
+struct particle_params {
+  /* Subtracted from vz every frame. */
+  float gravity;
+  /* Fraction of the velocity lost every frame. */
+  float drag;
+  /* Particles are stopped from falling below this height. */
+  float ground;
+  /* Particles die when faded to this value or below. */
+  float min_val;
+};
+
+struct particle_set {
+  uint32_t count;
+  float x[PARTICLES_MAX], y[PARTICLES_MAX], z[PARTICLES_MAX];
+  float vx[PARTICLES_MAX], vy[PARTICLES_MAX], vz[PARTICLES_MAX];
+  /* Colour, in HSV with all of h, s, v in 0..1. */
+  float hue[PARTICLES_MAX], sat[PARTICLES_MAX], val[PARTICLES_MAX];
+  /* Subtracted from val every frame. */
+  float fade[PARTICLES_MAX];
+  /* Frames to live after reaching the ground; they die when it goes < 0. */
+  int32_t ground_frames[PARTICLES_MAX];
+};
+
+extern void particles_init(struct particle_set *ps);
+extern int32_t particles_add(struct particle_set *ps);
+extern void particles_update(struct particle_set *ps,
+                             const struct particle_params *p);
+extern void particles_render(const struct particle_set *ps, frame_t *f);
+extern void particles_splat(const struct particle_set *ps,
+                            struct splat_buffer *b);
+
+#endif  /* PARTICLES_H */
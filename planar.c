@@ -0,0 +1,94 @@
+#include "planar.h"
+
+
+/*
+  Interleaving 3 channels takes byte shuffles that SSE2 does not have, so
+  the kernel is also built for SSSE3 and AVX2 and the best one the CPU
+  supports is picked on the first call, as for the simplex noise.
+*/
+static inline void
+planar_interleave_kernel(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                         const uint8_t *b, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; ++i)
+  {
+    d[3*i] = r[i];
+    d[3*i+1] = g[i];
+    d[3*i+2] = b[i];
+  }
+}
+
+
+static void
+planar_interleave_generic(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                          const uint8_t *b, size_t n)
+{
+  planar_interleave_kernel(d, r, g, b, n);
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+static __attribute__((target("ssse3"))) void
+planar_interleave_ssse3(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                        const uint8_t *b, size_t n)
+{
+  planar_interleave_kernel(d, r, g, b, n);
+}
+
+
+static __attribute__((target("avx2"))) void
+planar_interleave_avx2(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                       const uint8_t *b, size_t n)
+{
+  planar_interleave_kernel(d, r, g, b, n);
+}
+
+#endif
+
+
+static void planar_interleave_select(uint8_t *d, const uint8_t *r,
+                                     const uint8_t *g, const uint8_t *b,
+                                     size_t n);
+
+static void (*planar_interleave_fn)(uint8_t *, const uint8_t *,
+                                    const uint8_t *, const uint8_t *,
+                                    size_t) = planar_interleave_select;
+
+
+static void
+planar_interleave_select(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                         const uint8_t *b, size_t n)
+{
+  void (*fn)(uint8_t *, const uint8_t *, const uint8_t *, const uint8_t *,
+             size_t) = planar_interleave_generic;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    fn = planar_interleave_avx2;
+  else if (__builtin_cpu_supports("ssse3"))
+    fn = planar_interleave_ssse3;
+#endif
+  planar_interleave_fn = fn;
+  fn(d, r, g, b, n);
+}
+
+
+/* Interleave N voxels from the planes R, G and B into D. */
+void
+planar_interleave_n(uint8_t *d, const uint8_t *r, const uint8_t *g,
+                    const uint8_t *b, size_t n)
+{
+  planar_interleave_fn(d, r, g, b, n);
+}
+
+
+/* Interleave the planes into the wire format. */
+void
+planar_interleave(frame_t *f, const struct planar_frame *p)
+{
+  planar_interleave_fn((uint8_t *)f, p->r, p->g, p->b, PLANAR_VOXELS);
+}
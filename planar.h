@@ -0,0 +1,56 @@
+#ifndef PLANAR_H
+#define PLANAR_H
+
+#include <string.h>
+
+#include "ledtorus_anim.h"
+
+/*
+  Planar render target.
+
+  frame_t interleaves R, G and B per voxel, which is what goes on the wire
+  but makes every whole-frame operation a strided one. A planar_frame keeps
+  each channel in a plane of its own, in the same voxel order as frame_t
+  (so tangential slice A is the LEDS_Y*LEDS_X entries from
+  A*PLANAR_SLICE), and is interleaved into a frame_t in one pass at the
+  end. Clearing, filling, fading and blending a planar_frame are plain
+  loops over bytes that the compiler vectorises.
+*/
+
+#define PLANAR_SLICE (LEDS_Y*LEDS_X)
+#define PLANAR_VOXELS (LEDS_Y*LEDS_X*LEDS_TANG)
+
+struct planar_frame {
+  uint8_t r[PLANAR_VOXELS];
+  uint8_t g[PLANAR_VOXELS];
+  uint8_t b[PLANAR_VOXELS];
+};
+
+
+static inline void
+planar_setpix(struct planar_frame *p, uint32_t x, uint32_t y, uint32_t a,
+              uint8_t r, uint8_t g, uint8_t b)
+{
+  uint32_t i = y+x*LEDS_Y+a*PLANAR_SLICE;
+  p->r[i] = r;
+  p->g[i] = g;
+  p->b[i] = b;
+}
+
+
+/* Fill tangential slices A0 .. A1-1 with one colour. */
+static inline void
+planar_fill_slices(struct planar_frame *p, uint32_t a0, uint32_t a1,
+                   uint8_t r, uint8_t g, uint8_t b)
+{
+  size_t start = (size_t)a0*PLANAR_SLICE, len = (size_t)(a1 - a0)*PLANAR_SLICE;
+  memset(p->r + start, r, len);
+  memset(p->g + start, g, len);
+  memset(p->b + start, b, len);
+}
+
+extern void planar_interleave_n(uint8_t *d, const uint8_t *r,
+                                const uint8_t *g, const uint8_t *b, size_t n);
+extern void planar_interleave(frame_t *f, const struct planar_frame *p);
+
+#endif  /* PLANAR_H */
@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "player.h"
+#include "snapshot.h"
+#include "trace.h"
+
+
+/*
+  Playlist scheduler.
+
+  Animations in the playlist are played back to back, with a crossfade over
+  the last frames of one and the first frames of the next. To avoid a visible
+  stall at the switch (init can be expensive, eg. rubberduck parses a large
+  point cloud), the next animation is started on a background thread as soon
+  as the current one begins: it runs init() and pre-renders the frames needed
+  for the crossfade, while the main thread keeps rendering the current one.
+
+  An animation can start at a later frame than 0. Unless it is stateless or
+  seekable, that means simulating the frames before it, from the latest
+  checkpoint (snapshot.h) if there is one.
+*/
+
+
+const struct ledtorus_anim *
+anim_lookup(const char *name)
+{
+  char *end;
+  unsigned long idx;
+  uint32_t i;
+
+  idx = strtoul(name, &end, 10);
+  if (end != name && *end == '\0')
+    return idx < anim_table_size ? &anim_table[idx] : NULL;
+  for (i = 0; i < anim_table_size; ++i)
+    if (0 == strcmp(name, anim_table[i].name))
+      return &anim_table[i];
+  return NULL;
+}
+
+
+/*
+  Parse "name[:frames][@start]" into a playlist entry. Returns non-zero on
+  error.
+*/
+int
+playlist_parse_entry(struct playlist_entry *e, const char *arg,
+                     uint32_t default_duration)
+{
+  char buf[100];
+  char *colon, *at, *end;
+
+  if (strlen(arg) >= sizeof(buf))
+    return 1;
+  strcpy(buf, arg);
+  e->duration = default_duration;
+  e->start = 0;
+  if ((at = strchr(buf, '@')))
+  {
+    *at = '\0';
+    e->start = strtoul(at+1, &end, 0);
+    if (end == at+1 || *end != '\0')
+      return 1;
+  }
+  if ((colon = strchr(buf, ':')))
+  {
+    *colon = '\0';
+    e->duration = strtoul(colon+1, &end, 0);
+    if (end == colon+1 || *end != '\0')
+      return 1;
+  }
+  e->anim = anim_lookup(buf);
+  return e->anim == NULL;
+}
+
+
+/* Render frame N, checkpointing the state before it when due. */
+static uint32_t
+instance_nextframe(struct anim_instance *inst, frame_t *f, uint32_t n)
+{
+  checkpoint_maybe_save(inst->anim, inst->data, n);
+  return inst->anim->nextframe(f, n, inst->data);
+}
+
+
+/*
+  Bring the freshly initialised state up to just before frame inst->first,
+  from the latest checkpoint (if any), rendering the frames in between into
+  SCRATCH.
+*/
+static void
+instance_seek(struct anim_instance *inst, frame_t *scratch)
+{
+  uint64_t t_start = trace_now();
+  uint32_t n;
+
+  if (inst->first == 0 ||
+      (inst->anim->flags & (ANIM_STATELESS|ANIM_SEEKABLE)))
+    return;
+  for (n = checkpoint_restore(inst->anim, inst->data, inst->first);
+       n < inst->first; ++n)
+    instance_nextframe(inst, scratch, n);
+  trace_span("seek", t_start, trace_now(), inst->first);
+}
+
+
+static void *
+preroll_thread(void *arg)
+{
+  struct anim_instance *inst = arg;
+  uint64_t t_start = trace_now();
+  uint32_t i;
+
+  trace_thread_name("preroll");
+  if (inst->anim->init && inst->anim->init(inst->anim, inst->data))
+  {
+    inst->init_failed = 1;
+    return NULL;
+  }
+  trace_span(inst->anim->name, t_start, trace_now(), 0);
+  instance_seek(inst, &inst->preroll[0]);
+  /* The end signal is not tracked this early; the player fades out. */
+  for (i = 0, inst->frame = inst->first; i < inst->num_preroll;
+       ++i, ++inst->frame)
+    instance_nextframe(inst, &inst->preroll[i], inst->frame);
+  return NULL;
+}
+
+
+static struct anim_instance *
+instance_start(const struct playlist_entry *e, uint32_t num_preroll)
+{
+  struct anim_instance *inst = calloc(1, sizeof(*inst));
+  size_t state_size = e->anim->state_size ? e->anim->state_size : 1;
+
+  if (num_preroll < 1)
+    num_preroll = 1;
+  inst->anim = e->anim;
+  inst->duration = e->duration;
+  inst->first = e->start;
+  inst->data = calloc(1, state_size);
+  inst->preroll = malloc(num_preroll*sizeof(frame_t));
+  inst->num_preroll = num_preroll;
+  if (!inst->data || !inst->preroll)
+  {
+    fprintf(stderr, "Error: out of memory\n");
+    exit(1);
+  }
+  if (pthread_create(&inst->thread, NULL, preroll_thread, inst) == 0)
+    inst->thread_running = 1;
+  else
+    preroll_thread(inst);
+  return inst;
+}
+
+
+static void
+instance_wait(struct anim_instance *inst)
+{
+  if (inst->thread_running)
+  {
+    pthread_join(inst->thread, NULL);
+    inst->thread_running = 0;
+  }
+}
+
+
+/*
+  Called when the instance becomes the current one. Stateless animations then
+  continue rendering with a pool of threads from after the pre-rolled frames.
+*/
+static void
+instance_make_current(struct anim_instance *inst, uint32_t threads)
+{
+  if (threads > 1 && (inst->anim->flags & ANIM_STATELESS))
+    inst->pool = frame_pool_start(inst->anim, inst->data, threads, inst->frame,
+                                  inst->duration ? inst->first + inst->duration
+                                  : UINT32_MAX);
+}
+
+
+static void
+instance_free(struct anim_instance *inst)
+{
+  instance_wait(inst);
+  if (inst->pool)
+    frame_pool_stop(inst->pool);
+  free(inst->preroll);
+  free(inst->data);
+  free(inst);
+}
+
+
+/* Render the next frame; returns non-zero if the animation wants to end. */
+static uint32_t
+instance_render(struct anim_instance *inst, frame_t *f)
+{
+  uint32_t res = 0;
+
+  if (inst->preroll_used < inst->num_preroll)
+    memcpy(f, &inst->preroll[inst->preroll_used++], sizeof(frame_t));
+  else if (inst->pool)
+  {
+    res = frame_pool_get(inst->pool, f);
+    ++inst->frame;
+  }
+  else
+    res = instance_nextframe(inst, f, inst->frame++);
+  return res;
+}
+
+
+/* Frames left to render after the one just rendered. */
+static uint32_t
+instance_left(const struct anim_instance *inst)
+{
+  uint32_t done = inst->preroll_used < inst->num_preroll ?
+    inst->preroll_used : inst->frame - inst->first;
+
+  if (!inst->duration)
+    return UINT32_MAX;
+  return done >= inst->duration ? 0 : inst->duration - done;
+}
+
+
+/* Start pre-rolling the next animation in the playlist, if any. */
+static void
+player_start_next(struct player *p)
+{
+  p->next = NULL;
+  if (p->next_entry >= p->num_entries)
+  {
+    if (!p->loop)
+      return;
+    p->next_entry = 0;
+  }
+  p->next = instance_start(&p->entries[p->next_entry++], p->crossfade);
+}
+
+
+/*
+  Wait for the pre-roll of the next animation. Animations that fail to
+  initialise are skipped. Returns non-zero if there is a next animation.
+*/
+static int
+player_ready_next(struct player *p)
+{
+  uint32_t failures = 0;
+
+  while (p->next)
+  {
+    instance_wait(p->next);
+    if (!p->next->init_failed)
+      return 1;
+    fprintf(stderr, "Warning: animation '%s' failed to initialise, skipped\n",
+            p->next->anim->name);
+    instance_free(p->next);
+    if (++failures >= p->num_entries)
+    {
+      p->next = NULL;
+      break;
+    }
+    player_start_next(p);
+  }
+  return 0;
+}
+
+
+static void
+blend_frames(frame_t *dst, const frame_t *src, uint32_t w)
+{
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(frame_t); ++i)
+    d[i] = (d[i]*(256 - w) + s[i]*w) >> 8;
+}
+
+
+void
+player_init(struct player *p, const struct playlist_entry *entries,
+            uint32_t num_entries, uint32_t crossfade, uint32_t loop,
+            uint32_t threads)
+{
+  p->entries = entries;
+  p->num_entries = num_entries;
+  p->crossfade = crossfade;
+  p->loop = loop;
+  p->threads = threads;
+  p->next_entry = 0;
+  player_start_next(p);
+  p->cur = player_ready_next(p) ? p->next : NULL;
+  if (p->cur)
+  {
+    instance_make_current(p->cur, p->threads);
+    player_start_next(p);
+  }
+}
+
+
+/* Render the next output frame. Returns 0 when the playlist is finished. */
+int
+player_next_frame(struct player *p, frame_t *f)
+{
+  struct anim_instance *cur = p->cur;
+  uint32_t left;
+
+  if (!cur)
+    return 0;
+  if (instance_render(cur, f))
+  {
+    /* The animation wants to end; fade out from here. */
+    uint32_t end = cur->frame - cur->first + p->crossfade;
+    if (!cur->duration || cur->duration > end)
+      cur->duration = end;
+  }
+
+  left = instance_left(cur);
+  if (left < p->crossfade && player_ready_next(p))
+  {
+    uint32_t k = p->crossfade - left;
+    instance_render(p->next, &p->blend_buf);
+    blend_frames(f, &p->blend_buf, k*256/(p->crossfade + 1));
+  }
+
+  if (left == 0)
+  {
+    instance_free(cur);
+    p->cur = player_ready_next(p) ? p->next : NULL;
+    if (p->cur)
+    {
+      instance_make_current(p->cur, p->threads);
+      player_start_next(p);
+    }
+  }
+  return 1;
+}
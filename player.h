@@ -0,0 +1,59 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <pthread.h>
+
+#include "ledtorus_anim.h"
+#include "framepool.h"
+
+#define PLAYER_DEFAULT_DURATION 5000
+#define PLAYER_DEFAULT_CROSSFADE 25
+
+struct playlist_entry {
+  const struct ledtorus_anim *anim;
+  /* Number of frames to play, 0 to play until the animation ends. */
+  uint32_t duration;
+  /* Frame number to start at. */
+  uint32_t start;
+};
+
+/* One running animation, with its own state. */
+struct anim_instance {
+  const struct ledtorus_anim *anim;
+  union anim_data *data;
+  uint32_t duration;
+  /* Frame number of the first frame, and of the next one to render. */
+  uint32_t first;
+  uint32_t frame;
+  uint32_t init_failed;
+  /* Frames rendered ahead by the pre-roll thread. */
+  frame_t *preroll;
+  uint32_t num_preroll;
+  uint32_t preroll_used;
+  pthread_t thread;
+  int thread_running;
+  /* Frame-parallel rendering, once current (stateless animations only). */
+  struct frame_pool *pool;
+};
+
+struct player {
+  const struct playlist_entry *entries;
+  uint32_t num_entries;
+  uint32_t crossfade;
+  uint32_t loop;
+  uint32_t threads;
+  /* Index in entries of the next animation to start pre-rolling. */
+  uint32_t next_entry;
+  struct anim_instance *cur, *next;
+  frame_t blend_buf;
+};
+
+extern const struct ledtorus_anim *anim_lookup(const char *name);
+extern int playlist_parse_entry(struct playlist_entry *e, const char *arg,
+                                uint32_t default_duration);
+extern void player_init(struct player *p, const struct playlist_entry *entries,
+                        uint32_t num_entries, uint32_t crossfade,
+                        uint32_t loop, uint32_t threads);
+extern int player_next_frame(struct player *p, frame_t *f);
+
+#endif  /* PLAYER_H */
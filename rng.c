@@ -0,0 +1,119 @@
+#include "rng.h"
+
+
+/* SplitMix64, to spread one seed over all of the state. */
+static uint64_t
+rng_splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+
+void
+rng_seed(struct rng *r, uint64_t seed)
+{
+  uint32_t i, j;
+
+  for (j = 0; j < RNG_LANES; ++j)
+  {
+    for (i = 0; i < 4; i += 2)
+    {
+      uint64_t v = rng_splitmix64(&seed);
+      r->s[i][j] = (uint32_t)v;
+      r->s[i+1][j] = (uint32_t)(v >> 32);
+    }
+    /* The all-zero state is a fixed point. */
+    if (!(r->s[0][j] | r->s[1][j] | r->s[2][j] | r->s[3][j]))
+      r->s[0][j] = 1;
+  }
+  r->pos = RNG_LANES;
+}
+
+
+/* One step of all lanes, storing the outputs in OUT. */
+static inline void
+rng_step(struct rng *r, uint32_t *out)
+{
+  uint32_t j;
+
+  for (j = 0; j < RNG_LANES; ++j)
+  {
+    uint32_t s0 = r->s[0][j], s1 = r->s[1][j];
+    uint32_t s2 = r->s[2][j], s3 = r->s[3][j];
+    uint32_t t = s1 << 9;
+
+    out[j] = s0 + s3;
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= t;
+    s3 = (s3 << 11) | (s3 >> 21);
+    r->s[0][j] = s0;
+    r->s[1][j] = s1;
+    r->s[2][j] = s2;
+    r->s[3][j] = s3;
+  }
+}
+
+
+void
+rng_refill(struct rng *r)
+{
+  rng_step(r, r->buf);
+  r->pos = 0;
+}
+
+
+/*
+  N random floats 0 <= x < 1. Takes whatever is left in the buffer first, so
+  the numbers are the same as from N calls of rng_float(). The lanes are
+  stepped in local copies, which GCC keeps in vector registers.
+*/
+void
+rng_floats(struct rng *r, float *out, size_t n)
+{
+  uint32_t s0[RNG_LANES], s1[RNG_LANES], s2[RNG_LANES], s3[RNG_LANES];
+  size_t i = 0;
+  uint32_t j;
+
+  while (i < n && r->pos < RNG_LANES)
+    out[i++] = rng_float(r);
+  if (i + RNG_LANES <= n)
+  {
+    for (j = 0; j < RNG_LANES; ++j)
+    {
+      s0[j] = r->s[0][j];
+      s1[j] = r->s[1][j];
+      s2[j] = r->s[2][j];
+      s3[j] = r->s[3][j];
+    }
+    for (; i + RNG_LANES <= n; i += RNG_LANES)
+    {
+      for (j = 0; j < RNG_LANES; ++j)
+      {
+        uint32_t t = s1[j] << 9;
+
+        out[i+j] = (float)(int32_t)((s0[j] + s3[j]) >> 8) * (1.0f/16777216.0f);
+        s2[j] ^= s0[j];
+        s3[j] ^= s1[j];
+        s1[j] ^= s2[j];
+        s0[j] ^= s3[j];
+        s2[j] ^= t;
+        s3[j] = (s3[j] << 11) | (s3[j] >> 21);
+      }
+    }
+    for (j = 0; j < RNG_LANES; ++j)
+    {
+      r->s[0][j] = s0[j];
+      r->s[1][j] = s1[j];
+      r->s[2][j] = s2[j];
+      r->s[3][j] = s3[j];
+    }
+  }
+  while (i < n)
+    out[i++] = rng_float(r);
+}
@@ -0,0 +1,57 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+  Small, fast pseudo-random number generator, kept in the state of whoever
+  uses it, so that animations are reproducible from their seed no matter
+  which thread renders them, and do not contend on the lock in rand().
+
+  It is xoshiro128+ run as RNG_LANES independent streams side by side, so
+  that stepping all of them is one vectorised loop (16 lanes are enough
+  independent work to hide the latency of a step). Single numbers are
+  handed out from a buffer of the last step; rng_floats() fills an array
+  directly. The low bits of xoshiro128+ are weak, so everything here uses
+  the high bits.
+*/
+
+#define RNG_LANES 16
+
+struct rng {
+  uint32_t s[4][RNG_LANES];
+  uint32_t buf[RNG_LANES];
+  uint32_t pos;
+};
+
+extern void rng_seed(struct rng *r, uint64_t seed);
+extern void rng_refill(struct rng *r);
+extern void rng_floats(struct rng *r, float *out, size_t n);
+
+
+static inline uint32_t
+rng_u32(struct rng *r)
+{
+  if (r->pos >= RNG_LANES)
+    rng_refill(r);
+  return r->buf[r->pos++];
+}
+
+
+/* Random integer 0 <= x < N. */
+static inline uint32_t
+rng_below(struct rng *r, uint32_t n)
+{
+  return (uint32_t)(((uint64_t)rng_u32(r) * n) >> 32);
+}
+
+
+/* Random float 0 <= x < 1. */
+static inline float
+rng_float(struct rng *r)
+{
+  return (float)(rng_u32(r) >> 8) * (1.0f/16777216.0f);
+}
+
+#endif  /* RNG_H */
@@ -4,6 +4,8 @@
 #include <stdio.h>
 
 #include "rubberduck.h"
+#include "slicepool.h"
+#include "composite.h"
 
 
 static int
@@ -111,6 +113,12 @@ uint32_t
 rubberduck_init(struct st_rubberduck *c)
 {
   const char *filename = "rubber-duck-10_samp.pcd";
+  /*
+    The points are only read after loading, so parse the file once and share
+    the result between all instances of the animation.
+  */
+  static float *loaded_points = NULL;
+  static int loaded_num_points = 0;
   FILE *fp;
   char buf[1024];
   int in_header;
@@ -118,6 +126,11 @@ rubberduck_init(struct st_rubberduck *c)
   float cx, cy, cz;
   float size;
 
+  if (loaded_points) {
+    c->points = loaded_points;
+    c->num_points = loaded_num_points;
+    return 0;
+  }
   c->points = NULL;
 
   if (!(fp = fopen(filename, "r")))
@@ -190,24 +203,36 @@ rubberduck_init(struct st_rubberduck *c)
   /* Sort the points by x,y,z. */
   qsort(c->points, c->num_points, 3*sizeof(float), cmp_3float);
 
+  loaded_points = c->points;
+  loaded_num_points = c->num_points;
   return 0;
 }
 
 
-uint32_t
-rubberduck_anim_frame(frame_t *f, uint32_t frame, struct st_rubberduck *c)
+struct rubberduck_job {
+  struct layer *duck;
+  uint32_t frame;
+  struct st_rubberduck *c;
+  /* Per-worker maximum density. */
+  float max_density[SLICE_POOL_MAX];
+  float norm;
+};
+
+
+static void
+rubberduck_density_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                          struct slice_worker *w)
 {
+  struct rubberduck_job *job = arg;
+  struct st_rubberduck *c = job->c;
+  const struct torus_tables *t = torus_tables();
+  struct torus_rot rot = torus_rotation(0.3f*(float)job->frame);
   int ix, iy, ia;
-  float max_density;
-
-  cls(f);
-  envelope(f, frame);
+  float max_density = job->max_density[w->id];
 
-  max_density = 0.0f;
   for (ix = 0; ix < LEDS_X; ++ix) {
-    for (ia = 0; ia < LEDS_TANG; ++ia) {
-      struct torus_xz pos2 = torus_polar2rect((float)ix,
-                                              (float)ia+0.3*(float)frame);
+    for (ia = a_begin; ia < (int)a_end; ++ia) {
+      struct torus_xz pos2 = torus_rect_rotated(t, ix, ia, rot);
       float x = pos2.x;
       float z = pos2.z;
       for (iy = 0; iy < LEDS_Y; ++iy) {
@@ -222,29 +247,72 @@ rubberduck_anim_frame(frame_t *f, uint32_t frame, struct st_rubberduck *c)
       }
     }
   }
+  job->max_density[w->id] = max_density;
+}
+
+
+static void
+rubberduck_draw_slices(void *arg, uint32_t a_begin, uint32_t a_end,
+                       struct slice_worker *w __attribute__((unused)))
+{
+  struct rubberduck_job *job = arg;
+  struct st_rubberduck *c = job->c;
+  struct layer *duck = job->duck;
+  int ix, iy, ia;
 
-  if (max_density > 0.0f)
-    max_density = 1.0f/max_density;
   for (ix = 0; ix < LEDS_X; ++ix) {
-    for (ia = 0; ia < LEDS_TANG; ++ia) {
+    for (ia = a_begin; ia < (int)a_end; ++ia) {
       for (iy = 0; iy < LEDS_Y; ++iy) {
-        float density = c->density[ix][iy][ia] * max_density;
+        float density = c->density[ix][iy][ia] * job->norm;
         if (density > 0.01) {
           float cr = 1.0f*density;
           float cg = 1.0f*density;
           float cb = 0.0f*density;
-          setpix(f, ix, iy, ia, (uint8_t)255.0*cr, (uint8_t)255.0*cg, (uint8_t)255.0*cb);
+          layer_setpix(duck, ix, iy, ia, (uint8_t)255.0*cr, (uint8_t)255.0*cg, (uint8_t)255.0*cb);
         }
 #if 0
         // Some kind of axis...
         if (iy == LEDS_Y/2 && (ia == 0 || ia == LEDS_TANG/2))
-          setpix(f, ix, iy, ia, 255, 0, 0);
+          layer_setpix(duck, ix, iy, ia, 255, 0, 0);
         else if (iy == LEDS_Y/2 && (ia == LEDS_TANG/4 || ia == 3*LEDS_TANG/4))
-          setpix(f, ix, iy, ia, 0, 255, 0);
+          layer_setpix(duck, ix, iy, ia, 0, 255, 0);
 #endif
       }
     }
   }
+}
+
+
+uint32_t
+rubberduck_anim_frame(frame_t *f, uint32_t frame, struct st_rubberduck *c)
+{
+  struct rubberduck_job job;
+  struct layer env, duck;
+  const struct layer *layers[2] = { &env, &duck };
+  float max_density;
+  int i;
+
+  /* The duck is drawn over the envelope. */
+  layer_init(&env, LAYER_ALPHA, 255);
+  layer_init(&duck, LAYER_ALPHA, 255);
+  envelope(&env, frame);
+
+  job.duck = &duck;
+  job.frame = frame;
+  job.c = c;
+  for (i = 0; i < SLICE_POOL_MAX; ++i)
+    job.max_density[i] = 0.0f;
+  parallel_for_slices(rubberduck_density_slices, &job);
+
+  max_density = 0.0f;
+  for (i = 0; i < SLICE_POOL_MAX; ++i)
+    if (job.max_density[i] > max_density)
+      max_density = job.max_density[i];
+  if (max_density > 0.0f)
+    max_density = 1.0f/max_density;
+  job.norm = max_density;
+  parallel_for_slices(rubberduck_draw_slices, &job);
+  composite(f, layers, 2);
 
   return (frame > 2*60*25);
 }
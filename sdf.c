@@ -0,0 +1,470 @@
+#include <math.h>
+#include <string.h>
+
+#include "sdf.h"
+
+
+void
+sdf_scene_init(struct sdf_scene *s)
+{
+  s->num_nodes = 0;
+  s->num_objects = 0;
+}
+
+
+static struct sdf_node *
+sdf_new_node(struct sdf_scene *s, enum sdf_op op)
+{
+  struct sdf_node *n;
+
+  if (s->num_nodes >= SDF_MAX_NODES)
+    return NULL;
+  n = &s->nodes[s->num_nodes++];
+  n->op = op;
+  return n;
+}
+
+
+static void
+sdf_set_bound(struct sdf_node *n, float x, float y, float z, float r)
+{
+  n->bound_c[0] = x;
+  n->bound_c[1] = y;
+  n->bound_c[2] = z;
+  n->bound_r = r;
+}
+
+
+const struct sdf_node *
+sdf_sphere(struct sdf_scene *s, float x, float y, float z, float r)
+{
+  struct sdf_node *n = sdf_new_node(s, SDF_SPHERE);
+  if (!n)
+    return NULL;
+  n->u.sphere.c[0] = x;
+  n->u.sphere.c[1] = y;
+  n->u.sphere.c[2] = z;
+  n->u.sphere.r = r;
+  sdf_set_bound(n, x, y, z, r);
+  return n;
+}
+
+
+/* Plane with normal (NX,NY,NZ) through (X0,Y0,Z0); positive on the normal side. */
+const struct sdf_node *
+sdf_plane(struct sdf_scene *s, float nx, float ny, float nz,
+          float x0, float y0, float z0)
+{
+  struct sdf_node *n = sdf_new_node(s, SDF_PLANE);
+  float norm = sqrtf(nx*nx + ny*ny + nz*nz);
+  if (!n)
+    return NULL;
+  n->u.plane.n[0] = nx/norm;
+  n->u.plane.n[1] = ny/norm;
+  n->u.plane.n[2] = nz/norm;
+  n->u.plane.d = (nx*x0 + ny*y0 + nz*z0)/norm;
+  sdf_set_bound(n, 0.0f, 0.0f, 0.0f, INFINITY);
+  return n;
+}
+
+
+const struct sdf_node *
+sdf_box(struct sdf_scene *s, float x, float y, float z,
+        float hx, float hy, float hz)
+{
+  struct sdf_node *n = sdf_new_node(s, SDF_BOX);
+  if (!n)
+    return NULL;
+  n->u.box.c[0] = x;
+  n->u.box.c[1] = y;
+  n->u.box.c[2] = z;
+  n->u.box.h[0] = hx;
+  n->u.box.h[1] = hy;
+  n->u.box.h[2] = hz;
+  sdf_set_bound(n, x, y, z, sqrtf(hx*hx + hy*hy + hz*hz));
+  return n;
+}
+
+
+/* The points within R of the segment from A to B. */
+const struct sdf_node *
+sdf_capsule(struct sdf_scene *s, float ax, float ay, float az,
+            float bx, float by, float bz, float r)
+{
+  struct sdf_node *n = sdf_new_node(s, SDF_CAPSULE);
+  float dx = bx - ax, dy = by - ay, dz = bz - az;
+  if (!n)
+    return NULL;
+  n->u.capsule.a[0] = ax;
+  n->u.capsule.a[1] = ay;
+  n->u.capsule.a[2] = az;
+  n->u.capsule.b[0] = bx;
+  n->u.capsule.b[1] = by;
+  n->u.capsule.b[2] = bz;
+  n->u.capsule.r = r;
+  sdf_set_bound(n, 0.5f*(ax + bx), 0.5f*(ay + by), 0.5f*(az + bz),
+                0.5f*sqrtf(dx*dx + dy*dy + dz*dz) + r);
+  return n;
+}
+
+
+/* Torus with major radius R and minor radius r, around a vertical axis. */
+const struct sdf_node *
+sdf_torus(struct sdf_scene *s, float x, float y, float z, float R, float r)
+{
+  struct sdf_node *n = sdf_new_node(s, SDF_TORUS);
+  if (!n)
+    return NULL;
+  n->u.torus.c[0] = x;
+  n->u.torus.c[1] = y;
+  n->u.torus.c[2] = z;
+  n->u.torus.R = R;
+  n->u.torus.r = r;
+  sdf_set_bound(n, x, y, z, R + r);
+  return n;
+}
+
+
+static struct sdf_node *
+sdf_csg(struct sdf_scene *s, enum sdf_op op, const struct sdf_node *a,
+        const struct sdf_node *b)
+{
+  struct sdf_node *n;
+
+  if (!a || !b || !(n = sdf_new_node(s, op)))
+    return NULL;
+  n->u.csg.a = a;
+  n->u.csg.b = b;
+  return n;
+}
+
+
+const struct sdf_node *
+sdf_union(struct sdf_scene *s, const struct sdf_node *a,
+          const struct sdf_node *b)
+{
+  struct sdf_node *n = sdf_csg(s, SDF_UNION, a, b);
+  float dx, dy, dz, dist, r;
+
+  if (!n)
+    return NULL;
+  /* Smallest sphere enclosing both bounding spheres. */
+  dx = b->bound_c[0] - a->bound_c[0];
+  dy = b->bound_c[1] - a->bound_c[1];
+  dz = b->bound_c[2] - a->bound_c[2];
+  dist = sqrtf(dx*dx + dy*dy + dz*dz);
+  if (isinf(a->bound_r) || isinf(b->bound_r))
+    sdf_set_bound(n, 0.0f, 0.0f, 0.0f, INFINITY);
+  else if (dist + b->bound_r <= a->bound_r)
+    sdf_set_bound(n, a->bound_c[0], a->bound_c[1], a->bound_c[2], a->bound_r);
+  else if (dist + a->bound_r <= b->bound_r)
+    sdf_set_bound(n, b->bound_c[0], b->bound_c[1], b->bound_c[2], b->bound_r);
+  else
+  {
+    float t;
+    r = 0.5f*(dist + a->bound_r + b->bound_r);
+    t = (r - a->bound_r)/dist;
+    sdf_set_bound(n, a->bound_c[0] + t*dx, a->bound_c[1] + t*dy,
+                  a->bound_c[2] + t*dz, r);
+  }
+  return n;
+}
+
+
+const struct sdf_node *
+sdf_intersect(struct sdf_scene *s, const struct sdf_node *a,
+              const struct sdf_node *b)
+{
+  struct sdf_node *n = sdf_csg(s, SDF_INTERSECT, a, b);
+  const struct sdf_node *smaller;
+
+  if (!n)
+    return NULL;
+  /* Either bound will do; take the tighter one. */
+  smaller = (b->bound_r < a->bound_r ? b : a);
+  sdf_set_bound(n, smaller->bound_c[0], smaller->bound_c[1],
+                smaller->bound_c[2], smaller->bound_r);
+  return n;
+}
+
+
+/* A minus B. */
+const struct sdf_node *
+sdf_subtract(struct sdf_scene *s, const struct sdf_node *a,
+             const struct sdf_node *b)
+{
+  struct sdf_node *n = sdf_csg(s, SDF_SUBTRACT, a, b);
+
+  if (!n)
+    return NULL;
+  sdf_set_bound(n, a->bound_c[0], a->bound_c[1], a->bound_c[2], a->bound_r);
+  return n;
+}
+
+
+void
+sdf_add_object(struct sdf_scene *s, const struct sdf_node *shape,
+               uint8_t r, uint8_t g, uint8_t b, float thickness, float aa)
+{
+  struct sdf_object *o;
+
+  if (!shape || s->num_objects >= SDF_MAX_OBJECTS)
+    return;
+  o = &s->objects[s->num_objects++];
+  o->shape = shape;
+  o->r = r;
+  o->g = g;
+  o->b = b;
+  o->thickness = thickness;
+  o->aa = (aa > 0.0f ? aa : 1.0f);
+}
+
+
+/*
+  Signed distance from (X,Y,Z) to the shape. Exact for the primitives; for
+  CSG combinations a lower bound outside, as usual, which is all that the
+  bounds culling relies on.
+*/
+float
+sdf_eval(const struct sdf_node *n, float x, float y, float z)
+{
+  switch (n->op)
+  {
+  case SDF_SPHERE:
+  {
+    float dx = x - n->u.sphere.c[0];
+    float dy = y - n->u.sphere.c[1];
+    float dz = z - n->u.sphere.c[2];
+    return sqrtf(dx*dx + dy*dy + dz*dz) - n->u.sphere.r;
+  }
+  case SDF_PLANE:
+    return n->u.plane.n[0]*x + n->u.plane.n[1]*y + n->u.plane.n[2]*z -
+      n->u.plane.d;
+  case SDF_BOX:
+  {
+    float qx = fabsf(x - n->u.box.c[0]) - n->u.box.h[0];
+    float qy = fabsf(y - n->u.box.c[1]) - n->u.box.h[1];
+    float qz = fabsf(z - n->u.box.c[2]) - n->u.box.h[2];
+    float ox = fmaxf(qx, 0.0f), oy = fmaxf(qy, 0.0f), oz = fmaxf(qz, 0.0f);
+    return sqrtf(ox*ox + oy*oy + oz*oz) +
+      fminf(fmaxf(qx, fmaxf(qy, qz)), 0.0f);
+  }
+  case SDF_CAPSULE:
+  {
+    const float *a = n->u.capsule.a, *b = n->u.capsule.b;
+    float pax = x - a[0], pay = y - a[1], paz = z - a[2];
+    float bax = b[0] - a[0], bay = b[1] - a[1], baz = b[2] - a[2];
+    float bb = bax*bax + bay*bay + baz*baz;
+    float h = (bb > 0.0f ? (pax*bax + pay*bay + paz*baz)/bb : 0.0f);
+    float dx, dy, dz;
+    h = fminf(fmaxf(h, 0.0f), 1.0f);
+    dx = pax - h*bax;
+    dy = pay - h*bay;
+    dz = paz - h*baz;
+    return sqrtf(dx*dx + dy*dy + dz*dz) - n->u.capsule.r;
+  }
+  case SDF_TORUS:
+  {
+    float dx = x - n->u.torus.c[0];
+    float dy = y - n->u.torus.c[1];
+    float dz = z - n->u.torus.c[2];
+    float q = sqrtf(dx*dx + dz*dz) - n->u.torus.R;
+    return sqrtf(q*q + dy*dy) - n->u.torus.r;
+  }
+  case SDF_UNION:
+    return fminf(sdf_eval(n->u.csg.a, x, y, z), sdf_eval(n->u.csg.b, x, y, z));
+  case SDF_INTERSECT:
+    return fmaxf(sdf_eval(n->u.csg.a, x, y, z), sdf_eval(n->u.csg.b, x, y, z));
+  case SDF_SUBTRACT:
+    return fmaxf(sdf_eval(n->u.csg.a, x, y, z),
+                 -sdf_eval(n->u.csg.b, x, y, z));
+  }
+  return INFINITY;
+}
+
+
+/*
+  Range of voxels that can touch the (margin-enlarged) bounding sphere
+  (C, R). The slices run from a_first for a_count slices, wrapping
+  around at LEDS_TANG.
+*/
+struct sdf_bounds {
+  uint32_t x0, x1;
+  uint32_t a_first, a_count;
+};
+
+
+static int
+sdf_bounds(const float c[3], float r, struct sdf_bounds *b)
+{
+  float rho, rho_min, rho_max;
+
+  b->x0 = 0;
+  b->x1 = LEDS_X-1;
+  b->a_first = 0;
+  b->a_count = LEDS_TANG;
+  if (isinf(r))
+    return 1;
+  if (c[1] + r < 0.0f || c[1] - r > (float)(LEDS_Y-1))
+    return 0;
+
+  rho = sqrtf(c[0]*c[0] + c[2]*c[2]);
+  rho_min = rho - r - 2.58f;
+  rho_max = rho + r - 2.58f;
+  if (rho_max < 0.0f || rho_min > (float)(LEDS_X-1))
+    return 0;
+  if (rho_min > 0.0f)
+    b->x0 = (uint32_t)ceilf(rho_min);
+  if (rho_max < (float)(LEDS_X-1))
+    b->x1 = (uint32_t)floorf(rho_max);
+  if (b->x0 > b->x1)
+    return 0;
+
+  /* Angular extent, unless the sphere contains the axis. */
+  if (rho > r)
+  {
+    float a_c = atan2f(c[2], c[0]) * ((float)LEDS_TANG/(2.0f*F_PI));
+    float half = asinf(r/rho) * ((float)LEDS_TANG/(2.0f*F_PI));
+    int32_t a0 = (int32_t)floorf(a_c - half);
+    int32_t a1 = (int32_t)ceilf(a_c + half);
+    if (a1 - a0 + 1 < LEDS_TANG)
+    {
+      b->a_count = (uint32_t)(a1 - a0 + 1);
+      a0 %= LEDS_TANG;
+      if (a0 < 0)
+        a0 += LEDS_TANG;
+      b->a_first = (uint32_t)a0;
+    }
+  }
+  return 1;
+}
+
+
+/*
+  Range of y in the column at (PX, PZ) that can be within MARGIN of the
+  object, or inside it if SOLID. Returns 0 if none.
+*/
+static int
+sdf_column_range(const struct sdf_node *shape, float margin, int solid,
+                 float px, float pz, int32_t *y0, int32_t *y1)
+{
+  float lo, hi;
+
+  if (!isinf(shape->bound_r))
+  {
+    float r = shape->bound_r + margin;
+    float dx = px - shape->bound_c[0];
+    float dz = pz - shape->bound_c[2];
+    float h2 = r*r - dx*dx - dz*dz;
+    float h;
+    if (h2 < 0.0f)
+      return 0;
+    h = sqrtf(h2);
+    lo = shape->bound_c[1] - h;
+    hi = shape->bound_c[1] + h;
+  }
+  else if (shape->op == SDF_PLANE)
+  {
+    /*
+      n.p - d is linear in y, so -margin <= n.p - d <= margin is an
+      interval (a half-line for a solid half-space).
+    */
+    const float *n = shape->u.plane.n;
+    float d0 = n[0]*px + n[2]*pz - shape->u.plane.d;
+    float d_lo = (solid ? -INFINITY : -margin);
+    if (fabsf(n[1]) < 1e-6f)
+    {
+      if (d0 > margin || d0 < d_lo)
+        return 0;
+      lo = 0.0f;
+      hi = (float)(LEDS_Y-1);
+    }
+    else
+    {
+      lo = (d_lo - d0)/n[1];
+      hi = (margin - d0)/n[1];
+      if (lo > hi)
+      {
+        float tmp = lo;
+        lo = hi;
+        hi = tmp;
+      }
+    }
+  }
+  else
+  {
+    lo = 0.0f;
+    hi = (float)(LEDS_Y-1);
+  }
+
+  *y0 = (lo <= 0.0f ? 0 : (int32_t)ceilf(lo));
+  *y1 = (hi >= (float)(LEDS_Y-1) ? LEDS_Y-1 : (int32_t)floorf(hi));
+  return *y0 <= *y1;
+}
+
+
+static inline void
+sdf_addpix(frame_t *f, uint32_t x, uint32_t y, uint32_t a,
+           const struct sdf_object *o, float cov)
+{
+  uint8_t *p = (*f)[y+x*LEDS_Y+a*(LEDS_Y*LEDS_X)];
+  uint32_t r = p[0] + (uint32_t)(cov*(float)o->r + 0.5f);
+  uint32_t g = p[1] + (uint32_t)(cov*(float)o->g + 0.5f);
+  uint32_t b = p[2] + (uint32_t)(cov*(float)o->b + 0.5f);
+  p[0] = (r > 255 ? 255 : r);
+  p[1] = (g > 255 ? 255 : g);
+  p[2] = (b > 255 ? 255 : b);
+}
+
+
+static void
+sdf_render_object(const struct sdf_object *o, frame_t *f)
+{
+  const struct torus_tables *t = torus_tables();
+  const struct sdf_node *shape = o->shape;
+  /* How far outside the surface a voxel can still get some colour. */
+  float margin = o->thickness + 0.5f*o->aa;
+  struct sdf_bounds b;
+  uint32_t i, x;
+
+  if (!sdf_bounds(shape->bound_c, shape->bound_r + margin, &b))
+    return;
+  for (i = 0; i < b.a_count; ++i)
+  {
+    uint32_t a = b.a_first + i;
+    if (a >= LEDS_TANG)
+      a -= LEDS_TANG;
+    for (x = b.x0; x <= b.x1; ++x)
+    {
+      struct torus_xz p = t->rect[a][x];
+      int32_t y, y0, y1;
+
+      if (!sdf_column_range(shape, margin, o->thickness <= 0.0f,
+                            p.x, p.z, &y0, &y1))
+        continue;
+      for (y = y0; y <= y1; ++y)
+      {
+        float d = sdf_eval(shape, p.x, (float)y, p.z);
+        float cov;
+        if (o->thickness > 0.0f)
+          d = fabsf(d) - o->thickness;
+        /* Linear ramp from 1 at -aa/2 to 0 at +aa/2. */
+        cov = 0.5f - d/o->aa;
+        if (cov <= 0.0f)
+          continue;
+        sdf_addpix(f, x, y, a, o, (cov > 1.0f ? 1.0f : cov));
+      }
+    }
+  }
+}
+
+
+/* Draw all objects, adding their colours (saturating) to the frame. */
+void
+sdf_render(const struct sdf_scene *s, frame_t *f)
+{
+  uint32_t i;
+
+  for (i = 0; i < s->num_objects; ++i)
+    sdf_render_object(&s->objects[i], f);
+}
@@ -0,0 +1,90 @@
+#ifndef SDF_H
+#define SDF_H
+
+#include "ledtorus_anim.h"
+
+/*
+  Voxelisation of shapes given by signed distance functions (SDF).
+
+  Coordinates are those of torus_polar2rect() in the horizontal plane, and
+  the LED row for y, so that one unit is the radial/vertical LED spacing.
+
+  Build a scene with the constructors, which take nodes from the scene's
+  fixed-size pool (and return NULL when it is full; NULL arguments give
+  NULL, and sdf_add_object() ignores NULL, so a full scene just draws less).
+  Then sdf_render() draws each object, only visiting the voxels within its
+  bounds.
+*/
+
+#define SDF_MAX_NODES 128
+#define SDF_MAX_OBJECTS 32
+
+enum sdf_op {
+  SDF_SPHERE, SDF_PLANE, SDF_BOX, SDF_CAPSULE, SDF_TORUS,
+  SDF_UNION, SDF_INTERSECT, SDF_SUBTRACT
+};
+
+struct sdf_node {
+  enum sdf_op op;
+  union {
+    struct { float c[3], r; } sphere;
+    /* Points p with n.p = d; n is of unit length. */
+    struct { float n[3], d; } plane;
+    /* Axis-aligned, with half side lengths h. */
+    struct { float c[3], h[3]; } box;
+    struct { float a[3], b[3], r; } capsule;
+    /* Around a vertical axis through c. */
+    struct { float c[3], R, r; } torus;
+    struct { const struct sdf_node *a, *b; } csg;
+  } u;
+  /* Bounding sphere; radius INFINITY if unbounded. */
+  float bound_c[3], bound_r;
+};
+
+struct sdf_object {
+  const struct sdf_node *shape;
+  uint8_t r, g, b;
+  /* If > 0, draw only a shell of this half-thickness around the surface. */
+  float thickness;
+  /* Width of the antialiasing ramp across the surface. */
+  float aa;
+};
+
+struct sdf_scene {
+  uint32_t num_nodes, num_objects;
+  struct sdf_node nodes[SDF_MAX_NODES];
+  struct sdf_object objects[SDF_MAX_OBJECTS];
+};
+
+extern void sdf_scene_init(struct sdf_scene *s);
+extern const struct sdf_node *sdf_sphere(struct sdf_scene *s,
+                                         float x, float y, float z, float r);
+extern const struct sdf_node *sdf_plane(struct sdf_scene *s,
+                                        float nx, float ny, float nz,
+                                        float x0, float y0, float z0);
+extern const struct sdf_node *sdf_box(struct sdf_scene *s,
+                                      float x, float y, float z,
+                                      float hx, float hy, float hz);
+extern const struct sdf_node *sdf_capsule(struct sdf_scene *s,
+                                          float ax, float ay, float az,
+                                          float bx, float by, float bz,
+                                          float r);
+extern const struct sdf_node *sdf_torus(struct sdf_scene *s,
+                                        float x, float y, float z,
+                                        float R, float r);
+extern const struct sdf_node *sdf_union(struct sdf_scene *s,
+                                        const struct sdf_node *a,
+                                        const struct sdf_node *b);
+extern const struct sdf_node *sdf_intersect(struct sdf_scene *s,
+                                            const struct sdf_node *a,
+                                            const struct sdf_node *b);
+extern const struct sdf_node *sdf_subtract(struct sdf_scene *s,
+                                           const struct sdf_node *a,
+                                           const struct sdf_node *b);
+extern void sdf_add_object(struct sdf_scene *s, const struct sdf_node *shape,
+                           uint8_t r, uint8_t g, uint8_t b,
+                           float thickness, float aa);
+extern float sdf_eval(const struct sdf_node *n, float x, float y, float z);
+extern void sdf_render(const struct sdf_scene *s, frame_t *f);
+
+#endif  /* SDF_H */
@@ -64,6 +64,71 @@ K(uint32_t a, uint32_t A[3], uint32_t i, uint32_t j, uint32_t k, float u, float
 }
 
 
+/* Fixed-point version of K(), in Q16.16. */
+static inline fix16_t
+K_fix(uint32_t a, uint32_t A[3], uint32_t i, uint32_t j, uint32_t k,
+      fix16_t u, fix16_t v, fix16_t w)
+{
+  /* (A[0]+A[1]+A[2])/6 */
+  static const fix16_t corner_s[4] = {0, 10923, 21845, 32768};
+  fix16_t s = corner_s[A[0]+A[1]+A[2]];
+  fix16_t x = u-(fix16_t)A[0]*FIX16_ONE+s;
+  fix16_t y = v-(fix16_t)A[1]*FIX16_ONE+s;
+  fix16_t z = w-(fix16_t)A[2]*FIX16_ONE+s;
+  /* 0.6 */
+  fix16_t t = 39322-fix16_mul(x,x)-fix16_mul(y,y)-fix16_mul(z,z);
+  uint32_t h = shuffle(i+A[0], j+A[1], k+A[2]);
+  A[a]++;
+  if (t < 0)
+    return 0;
+  uint32_t b5 = h>>5 & 1;
+  uint32_t b4 = h>>4 & 1;
+  uint32_t b3 = h>>3 & 1;
+  uint32_t b2= h>>2 & 1;
+  uint32_t b = h & 3;
+  fix16_t p = (b==1 ? x : (b==2 ? y : z));
+  fix16_t q = (b==1 ? y : (b==2 ? z : x));
+  fix16_t r = (b==1 ? z : (b==2 ? x : y));
+  p = (b5==b3 ? -p : p);
+  q = (b5==b4 ? -q : q);
+  r = (b5!=(b4^b3) ? -r : r);
+  t = fix16_mul(t, t);
+  t = fix16_mul(t, t);
+  return (fix16_t)((25 * (int64_t)t * (p + (b==0 ? q+r : (b2==0 ? q : r))))
+                   >> 16);
+}
+
+
+/*
+  Fixed-point simplex noise, in and out in Q16.16. The result is within
+  about 1e-3 of the float version.
+*/
+fix16_t
+simplex_noise_3d_fix(fix16_t x, fix16_t y, fix16_t z)
+{
+  fix16_t s, u, v, w;
+  int32_t i, j, k;
+  uint32_t hi, lo;
+  uint32_t A[3];
+  s = (fix16_t)(((int64_t)x+y+z)/3);
+  /* Arithmetic right shift, so this is floor(). */
+  i = (x+s) >> 16;
+  j = (y+s) >> 16;
+  k = (z+s) >> 16;
+  s = (fix16_t)(((int64_t)i+j+k)*FIX16_ONE/6);
+  u = x-i*FIX16_ONE+s;
+  v = y-j*FIX16_ONE+s;
+  w = z-k*FIX16_ONE+s;
+  A[0] = A[1] = A[2] = 0;
+  hi = (u>=w ? (u>=v ? 0 : 1) : (v>=w ? 1 : 2));
+  lo = (u<w ? (u<v ? 0 : 1) : (v<w ? 1 : 2));
+  return K_fix(hi, A, i, j, k, u, v, w) +
+    K_fix(3-hi-lo, A, i, j, k, u, v, w) +
+    K_fix(lo, A, i, j, k, u, v, w) +
+    K_fix(0, A, i, j, k, u, v, w);
+}
+
+
 float
 simplex_noise_3d(float x, float y, float z)
 {
@@ -72,6 +137,10 @@ simplex_noise_3d(float x, float y, float z)
   uint32_t ix, jx, kx;
   uint32_t hi, lo;
   uint32_t A[3];
+  if (USE_FIXED_POINT)
+    return fix16_to_float(simplex_noise_3d_fix(fix16_from_float(x),
+                                               fix16_from_float(y),
+                                               fix16_from_float(z)));
   s = (x+y+z)/3;
   i = floorf(x+s);
   j = floorf(y+s);
@@ -91,3 +160,325 @@ simplex_noise_3d(float x, float y, float z)
     K(lo, A, ix, jx, kx, u, v, w) +
     K(0, A, ix, jx, kx, u, v, w);
 }
+
+
+/*
+  K() with the gradient: adds d/d(u,v,w) of the corner's contribution to G.
+  The contribution is 25*t**4*L, with L linear in (x,y,z) and
+  t = 0.6 - (x*x+y*y+z*z).
+*/
+static inline float
+K_grad(uint32_t a, uint32_t A[3], uint32_t i, uint32_t j, uint32_t k,
+       float u, float v, float w, float G[3])
+{
+  float s = (float)(A[0]+A[1]+A[2])/6.f;
+  float x = u-(float)A[0]+s;
+  float y = v-(float)A[1]+s;
+  float z = w-(float)A[2]+s;
+  float t = .6f-x*x-y*y-z*z;
+  uint32_t h = shuffle(i+A[0], j+A[1], k+A[2]);
+  A[a]++;
+  if (t < 0)
+    return 0;
+  uint32_t b5 = h>>5 & 1;
+  uint32_t b4 = h>>4 & 1;
+  uint32_t b3 = h>>3 & 1;
+  uint32_t b2= h>>2 & 1;
+  uint32_t b = h & 3;
+  /* Coefficients of p, q, r in L. */
+  float cp = (b5==b3 ? -1.0f : 1.0f);
+  float cq = (b==0 || b2==0 ? (b5==b4 ? -1.0f : 1.0f) : 0.0f);
+  float cr = (b==0 || b2!=0 ? (b5!=(b4^b3) ? -1.0f : 1.0f) : 0.0f);
+  /* Same as L in K(). */
+  float gx, gy, gz;
+  if (b==1)
+  {
+    gx = cp; gy = cq; gz = cr;
+  }
+  else if (b==2)
+  {
+    gx = cr; gy = cp; gz = cq;
+  }
+  else
+  {
+    gx = cq; gy = cr; gz = cp;
+  }
+  float L = gx*x + gy*y + gz*z;
+  float t2 = t*t;
+  float t3 = t2*t;
+  /* d/dx (t**4*L) = -8*x*t**3*L + t**4*gx */
+  float m = -8.0f*t3*L;
+  G[0] += 25.0f * (m*x + t2*t2*gx);
+  G[1] += 25.0f * (m*y + t2*t2*gy);
+  G[2] += 25.0f * (m*z + t2*t2*gz);
+  return 25.0f * t2 * t2 * L;
+}
+
+
+/*
+  simplex_noise_3d(), also returning the analytic gradient in GRAD[0..2].
+  Cheaper than the 6 extra evaluations of finite differences, and exact.
+  This is always float, also with USE_FIXED_POINT.
+*/
+float
+simplex_noise_3d_grad(float x, float y, float z, float grad[3])
+{
+  float s, u, v, w;
+  float i, j, k;
+  uint32_t ix, jx, kx;
+  uint32_t hi, lo;
+  uint32_t A[3];
+  float res;
+  s = (x+y+z)/3;
+  i = floorf(x+s);
+  j = floorf(y+s);
+  k = floorf(z+s);
+  s = (i+j+k)/6.f;
+  u = x-i+s;
+  v = y-j+s;
+  w = z-k+s;
+  A[0] = A[1] = A[2] = 0;
+  hi = (u>=w ? (u>=v ? 0 : 1) : (v>=w ? 1 : 2));
+  lo = (u<w ? (u<v ? 0 : 1) : (v<w ? 1 : 2));
+  ix = (uint32_t)i;
+  jx = (uint32_t)j;
+  kx = (uint32_t)k;
+  grad[0] = grad[1] = grad[2] = 0.0f;
+  /*
+    The skew to (u,v,w) is piecewise a translation, so the gradient with
+    respect to (x,y,z) is the same.
+  */
+  res = K_grad(hi, A, ix, jx, kx, u, v, w, grad);
+  res += K_grad(3-hi-lo, A, ix, jx, kx, u, v, w, grad);
+  res += K_grad(lo, A, ix, jx, kx, u, v, w, grad);
+  res += K_grad(0, A, ix, jx, kx, u, v, w, grad);
+  return res;
+}
+
+
+/*
+  Batch version, evaluating N points per call.
+
+  The scalar code above is full of data-dependent branches and table
+  lookups, which prevent vectorisation. The kernel below computes the same
+  thing branch-free, so that the compiler can turn the loop into SIMD code:
+
+   - The corner selection is done with comparisons and selects.
+   - The 8-entry lookup in shuffle4() is written as the multilinear
+     polynomial in the three index bits that has the same values. With the
+     bits as 0/-1 masks, it needs only and/add; no gathers.
+   - floorf() is done by conversion to int, which SSE2 can vectorise.
+
+  The kernel is compiled once per instruction set, and the best one for the
+  CPU is picked at run time. Nothing in it relies on floating-point
+  exceptions, and telling GCC so is needed for it to if-convert the loop.
+  Contraction into FMA is off, so that every variant gives the same bits
+  as the scalar code and frames do not depend on the CPU (the golden
+  hashes of make check rely on this).
+*/
+
+#pragma GCC push_options
+#pragma GCC optimize ("no-trapping-math", "fp-contract=off")
+
+/* Coefficients of seed(a,b,c) = noise_seeds[a<<2|b<<1|c] as a polynomial. */
+#define SEED(n) ((int32_t)noise_seeds[n])
+#define C_0   SEED(0)
+#define C_C   (SEED(1) - SEED(0))
+#define C_B   (SEED(2) - SEED(0))
+#define C_A   (SEED(4) - SEED(0))
+#define C_BC  (SEED(3) - SEED(2) - SEED(1) + SEED(0))
+#define C_AC  (SEED(5) - SEED(4) - SEED(1) + SEED(0))
+#define C_AB  (SEED(6) - SEED(4) - SEED(2) + SEED(0))
+#define C_ABC (SEED(7) - SEED(6) - SEED(5) - SEED(3) + SEED(4) + SEED(2) + \
+               SEED(1) - SEED(0))
+
+static inline __attribute__((always_inline)) int32_t
+shuffle4_poly(int32_t i, int32_t j, int32_t k, uint32_t B)
+{
+  /* Bits as 0 or -1 masks. */
+  int32_t a = -((i >> B) & 1);
+  int32_t b = -((j >> B) & 1);
+  int32_t c = -((k >> B) & 1);
+  return C_0 + (C_A & a) + (C_B & b) + (C_C & c) + (C_AB & a & b) +
+    (C_AC & a & c) + (C_BC & b & c) + (C_ABC & a & b & c);
+}
+
+
+static inline __attribute__((always_inline)) float
+K_branchless(int32_t i, int32_t j, int32_t k, float u, float v, float w,
+             int32_t A0, int32_t A1, int32_t A2, float s)
+{
+  float x = u-(float)A0+s;
+  float y = v-(float)A1+s;
+  float z = w-(float)A2+s;
+  float t = .6f-x*x-y*y-z*z;
+  int32_t si = i+A0, sj = j+A1, sk = k+A2;
+  int32_t h = shuffle4_poly(si, sj, sk, 0) + shuffle4_poly(sj, sk, si, 1) +
+    shuffle4_poly(sk, si, sj, 2) + shuffle4_poly(si, sj, sk, 3) +
+    shuffle4_poly(sj, sk, si, 4) + shuffle4_poly(sk, si, sj, 5) +
+    shuffle4_poly(si, sj, sk, 6) + shuffle4_poly(sj, sk, si, 7);
+  int32_t b5 = h>>5 & 1;
+  int32_t b4 = h>>4 & 1;
+  int32_t b3 = h>>3 & 1;
+  int32_t b2 = h>>2 & 1;
+  int32_t b = h & 3;
+  float p = (b==1 ? x : (b==2 ? y : z));
+  float q = (b==1 ? y : (b==2 ? z : x));
+  float r = (b==1 ? z : (b==2 ? x : y));
+  p *= (b5==b3 ? -1.0f : 1.0f);
+  q *= (b5==b4 ? -1.0f : 1.0f);
+  r *= (b5!=(b4^b3) ? -1.0f : 1.0f);
+  t = (t < 0.0f ? 0.0f : t);
+  t *= t;
+  return 25.0f * t * t * (p + (b==0 ? q+r : (b2==0 ? q : r)));
+}
+
+
+static inline __attribute__((always_inline)) float
+floor_branchless(float x)
+{
+  float t = (float)(int32_t)x;
+  return t - (t > x ? 1.0f : 0.0f);
+}
+
+
+static inline __attribute__((always_inline)) void
+simplex_noise_3d_kernel(const float *restrict xs, const float *restrict ys,
+                        const float *restrict zs, float *restrict out,
+                        size_t n)
+{
+  size_t m;
+
+  for (m = 0; m < n; ++m)
+  {
+    float x = xs[m], y = ys[m], z = zs[m];
+    float s = (x+y+z)/3;
+    float i = floor_branchless(x+s);
+    float j = floor_branchless(y+s);
+    float k = floor_branchless(z+s);
+    s = (i+j+k)/6.f;
+    float u = x-i+s;
+    float v = y-j+s;
+    float w = z-k+s;
+    int32_t ix = (int32_t)i;
+    int32_t jx = (int32_t)j;
+    int32_t kx = (int32_t)k;
+    int32_t hi = (u>=w ? (u>=v ? 0 : 1) : (v>=w ? 1 : 2));
+    int32_t lo = (u<w ? (u<v ? 0 : 1) : (v<w ? 1 : 2));
+    /* The corners are 0, e_hi, 1-e_lo and 1, as visited by the scalar K(). */
+    out[m] = K_branchless(ix, jx, kx, u, v, w, 0, 0, 0, 0.0f) +
+      K_branchless(ix, jx, kx, u, v, w, hi==0, hi==1, hi==2, 1/6.f) +
+      K_branchless(ix, jx, kx, u, v, w, lo!=0, lo!=1, lo!=2, 2/6.f) +
+      K_branchless(ix, jx, kx, u, v, w, 1, 1, 1, 3/6.f);
+  }
+}
+
+
+static void
+simplex_noise_3d_n_generic(const float *xs, const float *ys, const float *zs,
+                           float *out, size_t n)
+{
+  simplex_noise_3d_kernel(xs, ys, zs, out, n);
+}
+
+
+static int
+impl_always(void)
+{
+  return 1;
+}
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+static __attribute__((target("avx2"))) void
+simplex_noise_3d_n_avx2(const float *xs, const float *ys, const float *zs,
+                        float *out, size_t n)
+{
+  simplex_noise_3d_kernel(xs, ys, zs, out, n);
+}
+
+
+static __attribute__((target("avx512f"))) void
+simplex_noise_3d_n_avx512(const float *xs, const float *ys, const float *zs,
+                          float *out, size_t n)
+{
+  simplex_noise_3d_kernel(xs, ys, zs, out, n);
+}
+
+
+static int
+impl_have_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+
+static int
+impl_have_avx512(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+
+#pragma GCC pop_options
+
+
+/* Best first. */
+const struct simplex_noise_impl simplex_noise_impls[] = {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  { "avx512", impl_have_avx512, simplex_noise_3d_n_avx512 },
+  { "avx2", impl_have_avx2, simplex_noise_3d_n_avx2 },
+  { "sse2", impl_always, simplex_noise_3d_n_generic },
+#else
+  { "generic", impl_always, simplex_noise_3d_n_generic },
+#endif
+  { NULL, NULL, NULL }
+};
+
+
+static void
+simplex_noise_3d_n_select(const float *xs, const float *ys, const float *zs,
+                          float *out, size_t n);
+
+static void (*simplex_noise_3d_n_fn)(const float *, const float *,
+                                     const float *, float *, size_t) =
+  simplex_noise_3d_n_select;
+
+
+const struct simplex_noise_impl *
+simplex_noise_best_impl(void)
+{
+  const struct simplex_noise_impl *impl = simplex_noise_impls;
+  while (!impl->supported())
+    ++impl;
+  return impl;
+}
+
+
+static void
+simplex_noise_3d_n_select(const float *xs, const float *ys, const float *zs,
+                          float *out, size_t n)
+{
+  simplex_noise_3d_n_fn = simplex_noise_best_impl()->fn;
+  simplex_noise_3d_n_fn(xs, ys, zs, out, n);
+}
+
+
+void
+simplex_noise_3d_n(const float *x, const float *y, const float *z, float *out,
+                   size_t n)
+{
+  if (USE_FIXED_POINT)
+  {
+    size_t m;
+    for (m = 0; m < n; ++m)
+      out[m] = simplex_noise_3d(x[m], y[m], z[m]);
+    return;
+  }
+  simplex_noise_3d_n_fn(x, y, z, out, n);
+}
@@ -1 +1,19 @@
+#include <stddef.h>
+
+#include "fixpoint.h"
+
 extern float simplex_noise_3d(float x, float y, float z);
+extern fix16_t simplex_noise_3d_fix(fix16_t x, fix16_t y, fix16_t z);
+extern float simplex_noise_3d_grad(float x, float y, float z, float grad[3]);
+extern void simplex_noise_3d_n(const float *x, const float *y, const float *z,
+                               float *out, size_t n);
+
+/* The SIMD implementations of simplex_noise_3d_n(), for testing. */
+struct simplex_noise_impl {
+  const char *name;
+  int (*supported)(void);
+  void (*fn)(const float *x, const float *y, const float *z, float *out,
+             size_t n);
+};
+extern const struct simplex_noise_impl simplex_noise_impls[];
+extern const struct simplex_noise_impl *simplex_noise_best_impl(void);
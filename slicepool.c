@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "ledtorus_anim.h"
+#include "slicepool.h"
+
+
+/*
+  Intra-frame parallelism: a small persistent pool of threads that split the
+  tangential slices of one frame between them.
+
+  The range 0..LEDS_TANG-1 is cut into chunks of SLICE_CHUNK slices, which
+  the calling thread and the pool threads take from a shared counter until
+  none are left. Only one parallel_for_slices() can use the pool at a time;
+  a call made while the pool is busy (eg. from the frame-parallel workers)
+  just runs all slices itself, which is the right thing when the CPUs are
+  busy anyway.
+*/
+
+static struct slice_worker workers[SLICE_POOL_MAX];
+static pthread_t threads[SLICE_POOL_MAX];
+static uint32_t num_workers = 1;
+
+static pthread_mutex_t pool_busy = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* The current job, protected by pool_mutex. */
+static uint64_t job_generation;
+static slice_fn job_fn;
+static void *job_arg;
+static uint64_t job_seed;
+static uint32_t job_next_a;
+static uint32_t job_active;
+
+/* Used when the pool is busy or not started. */
+static __thread struct slice_worker inline_worker;
+static __thread uint8_t inline_scratch[SLICE_SCRATCH_SIZE]
+  __attribute__((aligned(64)));
+
+
+/* Process the chunk starting at slice A_BEGIN of the call with SEED. */
+static void
+run_chunk(slice_fn fn, void *arg, uint64_t seed, uint32_t a_begin,
+          struct slice_worker *w)
+{
+  uint32_t a_end = a_begin + SLICE_CHUNK;
+
+  if (a_end > LEDS_TANG)
+    a_end = LEDS_TANG;
+  w->rng_key =
+    ((anim_seed*0x9e3779b97f4a7c15ULL) ^ seed)*0xbf58476d1ce4e5b9ULL + a_begin;
+  w->rng_ready = 0;
+  (*fn)(arg, a_begin, a_end, w);
+}
+
+
+/* Take and process chunks until none are left. Called with pool_mutex held. */
+static void
+run_chunks(struct slice_worker *w)
+{
+  while (job_next_a < LEDS_TANG)
+  {
+    uint32_t a_begin = job_next_a;
+    slice_fn fn = job_fn;
+    void *arg = job_arg;
+    uint64_t seed = job_seed;
+
+    job_next_a = a_begin + SLICE_CHUNK;
+    pthread_mutex_unlock(&pool_mutex);
+    run_chunk(fn, arg, seed, a_begin, w);
+    pthread_mutex_lock(&pool_mutex);
+  }
+}
+
+
+static void *
+slice_thread(void *arg)
+{
+  struct slice_worker *w = arg;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool_mutex);
+  for (;;)
+  {
+    while (job_generation == seen)
+      pthread_cond_wait(&work_cond, &pool_mutex);
+    seen = job_generation;
+    ++job_active;
+    run_chunks(w);
+    if (--job_active == 0)
+      pthread_cond_signal(&done_cond);
+  }
+  return NULL;
+}
+
+
+static void
+worker_setup(struct slice_worker *w, uint32_t id, void *scratch)
+{
+  w->id = id;
+  w->scratch = scratch;
+}
+
+
+/* Start the pool with NUM_THREADS threads, including the calling one. */
+void
+slice_pool_init(uint32_t num_threads)
+{
+  uint32_t i;
+
+  if (num_threads > SLICE_POOL_MAX)
+    num_threads = SLICE_POOL_MAX;
+  for (i = 0; i < num_threads; ++i)
+  {
+    void *scratch = aligned_alloc(64, SLICE_SCRATCH_SIZE);
+    if (!scratch)
+      break;
+    worker_setup(&workers[i], i, scratch);
+    if (i > 0 && pthread_create(&threads[i], NULL, slice_thread, &workers[i]))
+    {
+      free(scratch);
+      break;
+    }
+    num_workers = i + 1;
+  }
+}
+
+
+/*
+  Run FN over all the slices on the calling thread, in the same chunks as
+  parallel_for_slices_seeded(), so with the same random numbers.
+*/
+void
+for_slices_serial(slice_fn fn, void *arg, uint64_t seed)
+{
+  uint32_t a;
+
+  worker_setup(&inline_worker, 0, inline_scratch);
+  for (a = 0; a < LEDS_TANG; a += SLICE_CHUNK)
+    run_chunk(fn, arg, seed, a, &inline_worker);
+}
+
+
+/*
+  Run FN over all the slices, spread over the pool. SEED tells calls apart
+  for slice_rng(), eg. the frame number.
+*/
+void
+parallel_for_slices_seeded(slice_fn fn, void *arg, uint64_t seed)
+{
+  if (num_workers <= 1 || pthread_mutex_trylock(&pool_busy) != 0)
+  {
+    for_slices_serial(fn, arg, seed);
+    return;
+  }
+
+  pthread_mutex_lock(&pool_mutex);
+  job_fn = fn;
+  job_arg = arg;
+  job_seed = seed;
+  job_next_a = 0;
+  job_active = 1;
+  ++job_generation;
+  pthread_cond_broadcast(&work_cond);
+  run_chunks(&workers[0]);
+  --job_active;
+  while (job_active > 0)
+    pthread_cond_wait(&done_cond, &pool_mutex);
+  pthread_mutex_unlock(&pool_mutex);
+
+  pthread_mutex_unlock(&pool_busy);
+}
+
+
+void
+parallel_for_slices(slice_fn fn, void *arg)
+{
+  parallel_for_slices_seeded(fn, arg, 0);
+}
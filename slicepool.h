@@ -0,0 +1,59 @@
+#ifndef SLICEPOOL_H
+#define SLICEPOOL_H
+
+#include <stdint.h>
+
+#include "rng.h"
+
+/* Upper limit on worker threads, for per-worker arrays in the callers. */
+#define SLICE_POOL_MAX 64
+/* Bytes of private scratch memory for each worker. */
+#define SLICE_SCRATCH_SIZE 65536
+/*
+  The slices are handed out in chunks of this many, whatever the number of
+  threads, so that what depends on the chunks (eg. slice_rng()) does not
+  depend on -j.
+*/
+#define SLICE_CHUNK 8
+
+struct slice_worker {
+  /* 0 <= id < SLICE_POOL_MAX; unique among the workers of one call. */
+  uint32_t id;
+  /* SLICE_SCRATCH_SIZE bytes, 64-byte aligned (a full AVX-512 vector). */
+  void *scratch;
+  /*
+    Private random numbers, use them through slice_rng(). They are reseeded
+    for each chunk from anim_seed, the seed of the call and the first slice
+    of the chunk, so they are the same whichever thread runs the chunk.
+  */
+  struct rng rng;
+  uint64_t rng_key;
+  int rng_ready;
+};
+
+/* Process tangential slices A_BEGIN <= a < A_END. */
+typedef void (*slice_fn)(void *arg, uint32_t a_begin, uint32_t a_end,
+                         struct slice_worker *w);
+
+extern void slice_pool_init(uint32_t num_threads);
+extern void parallel_for_slices(slice_fn fn, void *arg);
+extern void parallel_for_slices_seeded(slice_fn fn, void *arg, uint64_t seed);
+extern void for_slices_serial(slice_fn fn, void *arg, uint64_t seed);
+
+
+/*
+  The random numbers of the current chunk; seeded on first use, as most
+  jobs do not need them.
+*/
+static inline struct rng *
+slice_rng(struct slice_worker *w)
+{
+  if (!w->rng_ready)
+  {
+    rng_seed(&w->rng, w->rng_key);
+    w->rng_ready = 1;
+  }
+  return &w->rng;
+}
+
+#endif  /* SLICEPOOL_H */
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "snapshot.h"
+
+
+const char *checkpoint_dir = NULL;
+uint32_t checkpoint_interval = 0;
+
+
+#define SNAPSHOT_MAGIC "LTSNAP02"
+
+struct snapshot_header {
+  char magic[8];
+  char name[32];
+  uint64_t state_size;
+  /*
+    The checkpoint is only valid for the same build (the layout and the
+    logic of the state can change without its size changing), seed and
+    arithmetic.
+  */
+  uint64_t build_id;
+  uint64_t seed;
+  uint32_t fixed_point;
+  uint32_t frame;
+};
+
+
+static uint64_t snapshot_build_id_value;
+
+/*
+  Hash of the running executable, or failing that of the compile time
+  (all the sources are compiled together, so it changes with any of them).
+*/
+static void
+snapshot_compute_build_id(void)
+{
+  static const char fallback[] = __DATE__ " " __TIME__;
+  uint64_t h = 0xcbf29ce484222325ULL;
+  unsigned char buf[65536];
+  size_t i, n;
+  FILE *fp;
+
+  if ((fp = fopen("/proc/self/exe", "rb")))
+  {
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+      for (i = 0; i < n; ++i)
+        h = (h ^ buf[i])*0x100000001b3ULL;
+    fclose(fp);
+  }
+  else
+  {
+    for (i = 0; fallback[i]; ++i)
+      h = (h ^ (unsigned char)fallback[i])*0x100000001b3ULL;
+  }
+  snapshot_build_id_value = h;
+}
+
+
+static uint64_t
+snapshot_build_id(void)
+{
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+  pthread_once(&once, snapshot_compute_build_id);
+  return snapshot_build_id_value;
+}
+
+
+static void
+snapshot_header_fill(struct snapshot_header *h, const struct ledtorus_anim *anim,
+                     uint32_t frame)
+{
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic));
+  strncpy(h->name, anim->name, sizeof(h->name) - 1);
+  h->state_size = anim->state_size;
+  h->build_id = snapshot_build_id();
+  h->seed = anim_seed;
+  h->fixed_point = USE_FIXED_POINT;
+  h->frame = frame;
+}
+
+
+/*
+  Write the state DATA of ANIM, taken just before rendering FRAME, to PATH.
+  The file is written under a temporary name and renamed into place, so that
+  other processes never see a partial one. Returns non-zero on error.
+*/
+int
+snapshot_save(const char *path, const struct ledtorus_anim *anim,
+              const union anim_data *data, uint32_t frame)
+{
+  struct snapshot_header h;
+  char tmp[4096];
+  FILE *fp;
+  int err;
+
+  snapshot_header_fill(&h, anim, frame);
+  if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp%ld", path, (long)getpid()) >=
+      sizeof(tmp))
+    return 1;
+  if (!(fp = fopen(tmp, "wb")))
+  {
+    fprintf(stderr, "Warning: cannot write checkpoint '%s'\n", tmp);
+    return 1;
+  }
+  err = fwrite(&h, sizeof(h), 1, fp) != 1;
+  if (anim->state_size)
+    err |= fwrite(data, anim->state_size, 1, fp) != 1;
+  err |= fclose(fp) != 0;
+  if (!err)
+    err = rename(tmp, path) != 0;
+  if (err)
+  {
+    fprintf(stderr, "Warning: failed to write checkpoint '%s'\n", path);
+    unlink(tmp);
+  }
+  return err;
+}
+
+
+/*
+  Load the state for FRAME saved by snapshot_save() into DATA, which must be
+  initialised by the animation's init() first. Returns non-zero, leaving
+  DATA alone, if the file cannot be read or was saved for another frame,
+  animation, build, seed or arithmetic.
+*/
+int
+snapshot_load(const char *path, const struct ledtorus_anim *anim,
+              union anim_data *data, uint32_t frame)
+{
+  struct snapshot_header h, expect;
+  void *buf = NULL;
+  FILE *fp;
+  int err;
+
+  if (!(fp = fopen(path, "rb")))
+    return 1;
+  err = fread(&h, sizeof(h), 1, fp) != 1;
+  snapshot_header_fill(&expect, anim, frame);
+  err = err || memcmp(&h, &expect, sizeof(h)) != 0;
+  if (!err && anim->state_size)
+  {
+    buf = malloc(anim->state_size);
+    err = !buf || fread(buf, anim->state_size, 1, fp) != 1;
+  }
+  fclose(fp);
+  if (!err && anim->state_size)
+    memcpy(data, buf, anim->state_size);
+  free(buf);
+  return err;
+}
+
+
+static int
+checkpoint_enabled(const struct ledtorus_anim *anim)
+{
+  return checkpoint_dir && !(anim->flags & (ANIM_STATELESS|ANIM_SEEKABLE));
+}
+
+
+/* The file name up to the frame number. */
+static int
+checkpoint_prefix(char *buf, size_t size, const struct ledtorus_anim *anim)
+{
+  return (size_t)snprintf(buf, size, "%s-%llu%s-", anim->name,
+                          (unsigned long long)anim_seed,
+                          USE_FIXED_POINT ? "-fixed" : "") >= size;
+}
+
+
+/*
+  Called before rendering FRAME: every checkpoint_interval frames, save a
+  checkpoint, unless there is one already.
+*/
+void
+checkpoint_maybe_save(const struct ledtorus_anim *anim,
+                      const union anim_data *data, uint32_t frame)
+{
+  char prefix[256], path[4096];
+
+  if (!checkpoint_enabled(anim) || !checkpoint_interval || frame == 0 ||
+      frame % checkpoint_interval)
+    return;
+  if (checkpoint_prefix(prefix, sizeof(prefix), anim) ||
+      (size_t)snprintf(path, sizeof(path), "%s/%s%u.snap", checkpoint_dir,
+                       prefix, frame) >= sizeof(path))
+    return;
+  if (access(path, F_OK) == 0)
+    return;
+  snapshot_save(path, anim, data, frame);
+}
+
+
+/*
+  Restore the latest checkpoint of ANIM at or before FRAME into DATA (set up
+  by init()). Returns the frame it is for, or 0 if none was found, leaving
+  DATA as it was.
+*/
+uint32_t
+checkpoint_restore(const struct ledtorus_anim *anim, union anim_data *data,
+                   uint32_t frame)
+{
+  char prefix[256], path[4096];
+  size_t prefix_len;
+  struct dirent *de;
+  uint32_t best = 0;
+  DIR *dir;
+
+  if (!checkpoint_enabled(anim) || checkpoint_prefix(prefix, sizeof(prefix), anim))
+    return 0;
+  if (!(dir = opendir(checkpoint_dir)))
+    return 0;
+  prefix_len = strlen(prefix);
+  while ((de = readdir(dir)))
+  {
+    char *end;
+    unsigned long n;
+
+    if (strncmp(de->d_name, prefix, prefix_len) != 0)
+      continue;
+    n = strtoul(de->d_name + prefix_len, &end, 10);
+    if (end == de->d_name + prefix_len || strcmp(end, ".snap") != 0)
+      continue;
+    if (n <= frame && n > best)
+      best = n;
+  }
+  closedir(dir);
+
+  if (best == 0 ||
+      (size_t)snprintf(path, sizeof(path), "%s/%s%u.snap", checkpoint_dir,
+                       prefix, best) >= sizeof(path))
+    return 0;
+  if (snapshot_load(path, anim, data, best))
+  {
+    fprintf(stderr, "Warning: cannot restore checkpoint '%s'\n", path);
+    return 0;
+  }
+  return best;
+}
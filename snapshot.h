@@ -0,0 +1,36 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "ledtorus_anim.h"
+
+/*
+  Checkpoints of animation state, so that frame N of a simulation can be
+  rendered without simulating frames 0..N-1 first.
+
+  The state of an animation is its union anim_data (state_size bytes, which
+  includes its random number generator); it holds no pointers except in
+  ANIM_SEEKABLE animations, which are never checkpointed. A checkpoint for
+  frame N is the state just before rendering frame N, and is stored as
+
+    CHECKPOINT_DIR/<name>-<seed>[-fixed]-<N>.snap
+
+  so that several processes can share one directory. Checkpoints are only
+  resumed by the same build of ledtorus_anim that wrote them; others are
+  ignored.
+*/
+
+/* Directory of the checkpoints, NULL for none. */
+extern const char *checkpoint_dir;
+/* Write a checkpoint every this many frames while rendering, 0 for never. */
+extern uint32_t checkpoint_interval;
+
+extern int snapshot_save(const char *path, const struct ledtorus_anim *anim,
+                         const union anim_data *data, uint32_t frame);
+extern int snapshot_load(const char *path, const struct ledtorus_anim *anim,
+                         union anim_data *data, uint32_t frame);
+extern void checkpoint_maybe_save(const struct ledtorus_anim *anim,
+                                  const union anim_data *data, uint32_t frame);
+extern uint32_t checkpoint_restore(const struct ledtorus_anim *anim,
+                                   union anim_data *data, uint32_t frame);
+
+#endif  /* SNAPSHOT_H */
@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "splat.h"
+
+
+/* Points are splatted in batches of this many. */
+#define SPLAT_CHUNK 64
+
+
+/*
+  As in particles.c, the loops select with ?: and need GCC to know that
+  nothing traps in order to vectorise.
+*/
+#pragma GCC push_options
+#pragma GCC optimize ("no-trapping-math")
+
+
+void
+splat_clear(struct splat_buffer *b)
+{
+  memset(b->v, 0, sizeof(b->v));
+}
+
+
+/*
+  Add N points, with colours (R[i], G[i], BL[i]) at (X[i], Y[i], A[i]). The
+  tangential coordinate is wrapped into 0..LEDS_TANG-1, but should be at most
+  one turn outside of it.
+
+  For each chunk of points, one vectorised loop computes the indices and
+  weights of the two neighbouring voxels along each axis. Neighbours outside
+  the torus get weight 0 (and a clamped index), so that the scatter loop
+  that follows has no branches.
+*/
+void
+splat_points(struct splat_buffer *b, const float *x, const float *y,
+             const float *a, const float *r, const float *g, const float *bl,
+             uint32_t n)
+{
+  int32_t ix[2][SPLAT_CHUNK], iy[2][SPLAT_CHUNK], ia[2][SPLAT_CHUNK];
+  float wx[2][SPLAT_CHUNK], wy[2][SPLAT_CHUNK], wa[2][SPLAT_CHUNK];
+  uint32_t base, i;
+
+  for (base = 0; base < n; base += SPLAT_CHUNK)
+  {
+    uint32_t m = (n - base < SPLAT_CHUNK ? n - base : SPLAT_CHUNK);
+    const float *px = x + base, *py = y + base, *pa = a + base;
+
+    for (i = 0; i < m; ++i)
+    {
+      /* Clamp, so that the conversions below are defined. */
+      float xf = (px[i] < -2.0f ? -2.0f :
+                  (px[i] > (float)(LEDS_X+1) ? (float)(LEDS_X+1) : px[i]));
+      float yf = (py[i] < -2.0f ? -2.0f :
+                  (py[i] > (float)(LEDS_Y+1) ? (float)(LEDS_Y+1) : py[i]));
+      float af = (pa[i] < -(float)LEDS_TANG ? -(float)LEDS_TANG :
+                  (pa[i] > (float)(2*LEDS_TANG-1) ? (float)(2*LEDS_TANG-1) :
+                   pa[i]));
+      /* floor() by truncation of a positive number. */
+      int32_t x0 = (int32_t)(xf + 4.0f) - 4;
+      int32_t y0 = (int32_t)(yf + 4.0f) - 4;
+      int32_t a0 = (int32_t)(af + (float)LEDS_TANG) - LEDS_TANG;
+      int32_t a1;
+      float fx = xf - (float)x0, fy = yf - (float)y0, fa = af - (float)a0;
+
+      a0 += (a0 < 0 ? LEDS_TANG : 0);
+      a0 -= (a0 >= LEDS_TANG ? LEDS_TANG : 0);
+      a1 = (a0 == LEDS_TANG-1 ? 0 : a0 + 1);
+
+      wx[0][i] = (x0 >= 0 && x0 < LEDS_X ? 1.0f - fx : 0.0f);
+      wx[1][i] = (x0 >= -1 && x0 < LEDS_X-1 ? fx : 0.0f);
+      wy[0][i] = (y0 >= 0 && y0 < LEDS_Y ? 1.0f - fy : 0.0f);
+      wy[1][i] = (y0 >= -1 && y0 < LEDS_Y-1 ? fy : 0.0f);
+      wa[0][i] = 1.0f - fa;
+      wa[1][i] = fa;
+      ix[0][i] = (x0 < 0 ? 0 : (x0 > LEDS_X-1 ? LEDS_X-1 : x0))*LEDS_Y;
+      ix[1][i] = (x0 < -1 ? 0 : (x0 > LEDS_X-2 ? LEDS_X-1 : x0 + 1))*LEDS_Y;
+      iy[0][i] = (y0 < 0 ? 0 : (y0 > LEDS_Y-1 ? LEDS_Y-1 : y0));
+      iy[1][i] = (y0 < -1 ? 0 : (y0 > LEDS_Y-2 ? LEDS_Y-1 : y0 + 1));
+      ia[0][i] = a0*(LEDS_Y*LEDS_X);
+      ia[1][i] = a1*(LEDS_Y*LEDS_X);
+    }
+
+    for (i = 0; i < m; ++i)
+    {
+      float cr = r[base+i], cg = g[base+i], cb = bl[base+i];
+      uint32_t j;
+
+      for (j = 0; j < 8; ++j)
+      {
+        uint32_t jx = j & 1, jy = (j >> 1) & 1, ja = j >> 2;
+        float w = wx[jx][i]*wy[jy][i]*wa[ja][i];
+        float *v = b->v[ix[jx][i] + iy[jy][i] + ia[ja][i]];
+        v[0] += w*cr;
+        v[1] += w*cg;
+        v[2] += w*cb;
+      }
+    }
+  }
+}
+
+
+void
+splat_point(struct splat_buffer *b, float x, float y, float a,
+            float r, float g, float bl)
+{
+  splat_points(b, &x, &y, &a, &r, &g, &bl, 1);
+}
+
+
+/*
+  Convert the buffer to a frame. Values up to KNEE are linear; above it they
+  roll off smoothly towards full brightness (a rational shoulder, continuous
+  in value and slope), so that piles of overlapping points keep some
+  gradation instead of clipping flat. KNEE >= 1 just clips.
+*/
+void
+splat_tonemap(const struct splat_buffer *b, frame_t *f, float knee)
+{
+  const float *v = &b->v[0][0];
+  uint8_t *out = &(*f)[0][0];
+  const uint32_t n = LEDS_Y*LEDS_X*LEDS_TANG*3;
+  uint32_t i;
+
+  if (knee >= 1.0f)
+  {
+    for (i = 0; i < n; ++i)
+    {
+      float c = v[i];
+      c = (c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c));
+      out[i] = (uint8_t)(255.0f*c + 0.5f);
+    }
+  }
+  else
+  {
+    const float span = 1.0f - knee;
+    const float inv_span = 1.0f/span;
+
+    for (i = 0; i < n; ++i)
+    {
+      float c = v[i];
+      float t = (c - knee)*inv_span;
+      float rolled = knee + span*t/(1.0f + t);
+      c = (c < 0.0f ? 0.0f : (c > knee ? rolled : c));
+      out[i] = (uint8_t)(255.0f*c + 0.5f);
+    }
+  }
+}
+
+
+#pragma GCC pop_options
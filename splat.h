@@ -0,0 +1,51 @@
+#ifndef SPLAT_H
+#define SPLAT_H
+
+#include "ledtorus_anim.h"
+
+/*
+  Antialiased drawing of points between the LEDs.
+
+  A point at fractional (x, y, a) is spread over the 8 surrounding voxels
+  with trilinear weights, wrapping around tangentially. Points are added up
+  in a float buffer, so overlapping points brighten instead of overwriting
+  each other, and the result is converted to a frame_t in a single pass at
+  the end.
+
+  Coordinates are those of setpix(): x radial, y the LED row (0 at the top),
+  a the tangential slice. Colours are linear RGB with 1.0 for full
+  brightness.
+*/
+
+struct splat_buffer {
+  float v[LEDS_Y*LEDS_X*LEDS_TANG][3];
+};
+
+
+/*
+  One channel of HSV to RGB without branches, so that loops over it
+  vectorise: N is 5, 3, 1 for R, G, B, H6 is the hue times 6, and C is
+  value*saturation. The same as the case analysis in hsv2rgb_f().
+*/
+static inline float
+splat_hsv_channel(float n, float h6, float v, float c)
+{
+  float k = n + h6;
+  float t;
+
+  k -= (k >= 6.0f ? 6.0f : 0.0f);
+  t = (k < 4.0f - k ? k : 4.0f - k);
+  t = (t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t));
+  return v - c*t;
+}
+
+extern void splat_clear(struct splat_buffer *b);
+extern void splat_point(struct splat_buffer *b, float x, float y, float a,
+                        float r, float g, float bl);
+extern void splat_points(struct splat_buffer *b, const float *x,
+                         const float *y, const float *a, const float *r,
+                         const float *g, const float *bl, uint32_t n);
+extern void splat_tonemap(const struct splat_buffer *b, frame_t *f,
+                          float knee);
+
+#endif  /* SPLAT_H */
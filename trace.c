@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+
+/*
+  Simple event tracing, written in the Chrome trace-event JSON format (load
+  the file in chrome://tracing or https://ui.perfetto.dev).
+
+  Tracing is enabled by setting the environment variable LEDTORUS_TRACE to
+  the name of the trace file. Both ledtorus_anim and the viewer use
+  CLOCK_MONOTONIC timestamps and append to the same file, so running
+
+    LEDTORUS_TRACE=/tmp/trace.json ./ledtorus_anim 5 | ./ledtorus-viewer
+
+  gives one trace of the whole pipeline on a common time axis. Each event is
+  a single write() to a file opened with O_APPEND, which keeps events from
+  the two processes (and from the different threads) from being interleaved.
+  The closing ']' is left out, which the trace format explicitly allows.
+*/
+
+int trace_enabled = 0;
+static int trace_fd = -1;
+static int trace_pid;
+
+
+uint64_t
+trace_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+
+static int
+trace_tid(void)
+{
+  return (int)syscall(SYS_gettid);
+}
+
+
+static void
+trace_put(const char *buf, int len)
+{
+  if (len <= 0)
+    return;
+  while (len > 0)
+  {
+    ssize_t res = write(trace_fd, buf, len);
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      /* Do not let a broken trace file take down the program. */
+      trace_enabled = 0;
+      return;
+    }
+    buf += res;
+    len -= res;
+  }
+}
+
+
+static void
+trace_meta(int tid, const char *what, const char *name)
+{
+  char buf[256];
+  int len = snprintf(buf, sizeof(buf),
+                     "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"name\":\"%s\"}},\n",
+                     what, trace_pid, tid, name);
+  trace_put(buf, len);
+}
+
+
+void
+trace_init(const char *process_name)
+{
+  const char *filename = getenv("LEDTORUS_TRACE");
+
+  if (!filename || !*filename)
+    return;
+
+  /* Whoever creates the file writes the opening bracket. */
+  trace_fd = open(filename, O_WRONLY|O_APPEND|O_CREAT|O_EXCL, 0666);
+  if (trace_fd >= 0)
+  {
+    if (write(trace_fd, "[\n", 2) != 2)
+    {
+      close(trace_fd);
+      trace_fd = -1;
+    }
+  }
+  else if (errno == EEXIST)
+    trace_fd = open(filename, O_WRONLY|O_APPEND);
+  if (trace_fd < 0)
+  {
+    fprintf(stderr, "Warning: cannot open trace file '%s': %s\n",
+            filename, strerror(errno));
+    return;
+  }
+
+  trace_pid = getpid();
+  trace_enabled = 1;
+  trace_meta(0, "process_name", process_name);
+  trace_meta(trace_tid(), "thread_name", "main");
+  trace_meta(TRACE_TID_GPU, "thread_name", "GPU");
+}
+
+
+void
+trace_thread_name(const char *name)
+{
+  if (!trace_enabled)
+    return;
+  trace_meta(trace_tid(), "thread_name", name);
+}
+
+
+void
+trace_span_tid(int tid, const char *name, uint64_t start_ns, uint64_t end_ns,
+               uint64_t frame_id)
+{
+  char buf[256];
+  int len;
+
+  if (!trace_enabled)
+    return;
+  len = snprintf(buf, sizeof(buf),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                 "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}},\n",
+                 name, trace_pid, tid, (double)start_ns/1000.0,
+                 (double)(end_ns - start_ns)/1000.0,
+                 (unsigned long long)frame_id);
+  trace_put(buf, len);
+}
+
+
+void
+trace_span(const char *name, uint64_t start_ns, uint64_t end_ns,
+           uint64_t frame_id)
+{
+  if (!trace_enabled)
+    return;
+  trace_span_tid(trace_tid(), name, start_ns, end_ns, frame_id);
+}
+
+
+void
+trace_counter(const char *name, uint64_t ts_ns, double value)
+{
+  char buf[256];
+  int len;
+
+  if (!trace_enabled)
+    return;
+  len = snprintf(buf, sizeof(buf),
+                 "{\"name\":\"%s\",\"ph\":\"C\",\"pid\":%d,\"tid\":%d,"
+                 "\"ts\":%.3f,\"args\":{\"value\":%.3f}},\n",
+                 name, trace_pid, trace_tid(), (double)ts_ns/1000.0, value);
+  trace_put(buf, len);
+}
+
+
+/*
+  Flow arrow following one frame from the generator to the screen. The start
+  is emitted when the frame is finished in ledtorus_anim, the finish when the
+  viewer swaps it onto the display; both bind to the enclosing span.
+*/
+void
+trace_flow(int finish, uint64_t ts_ns, uint64_t frame_id)
+{
+  char buf[256];
+  int len;
+
+  if (!trace_enabled)
+    return;
+  len = snprintf(buf, sizeof(buf),
+                 "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%s\","
+                 "%s\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%.3f},\n",
+                 finish ? "f" : "s", finish ? "\"bp\":\"e\"," : "",
+                 (unsigned long long)frame_id, trace_pid, trace_tid(),
+                 (double)ts_ns/1000.0);
+  trace_put(buf, len);
+}
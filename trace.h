@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+  Stamp placed by ledtorus_anim in the padding at the end of each frame, so
+  that the viewer can tell which generated frame it is showing and when that
+  frame was finished. Streams from older generators have all-zero padding,
+  so check the magic before using the rest.
+*/
+#define FRAME_STAMP_MAGIC 0x4d54534cu
+
+struct frame_stamp {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t frame_id;
+  /* CLOCK_MONOTONIC time at which rendering of the frame completed. */
+  uint64_t done_ns;
+};
+
+/* Pseudo thread id used for spans measured on the GPU. */
+#define TRACE_TID_GPU 1
+
+extern int trace_enabled;
+
+extern void trace_init(const char *process_name);
+extern uint64_t trace_now(void);
+extern void trace_thread_name(const char *name);
+extern void trace_span(const char *name, uint64_t start_ns, uint64_t end_ns,
+                       uint64_t frame_id);
+extern void trace_span_tid(int tid, const char *name, uint64_t start_ns,
+                           uint64_t end_ns, uint64_t frame_id);
+extern void trace_counter(const char *name, uint64_t ts_ns, double value);
+extern void trace_flow(int finish, uint64_t ts_ns, uint64_t frame_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* TRACE_H */
@@ -0,0 +1,1014 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "vm.h"
+#include "palette.h"
+#include "planar.h"
+#include "simplex_noise.h"
+#include "slicepool.h"
+#include "splat.h"
+
+
+const char *vm_shader_file = NULL;
+
+const char vm_default_shader[] =
+  "# Rainbow rings, broken up by slowly moving noise.\n"
+  "n = noise(rect_x*0.12, y*0.12 + t*0.25, rect_z*0.12)\n"
+  "hsv(fract(a/205 + t*0.05 + n*0.25), 0.85, clamp(n*0.8 + 0.45, 0, 1))\n";
+
+
+enum vm_op {
+  VM_CONST, VM_MOV,
+  VM_ADD, VM_SUB, VM_MUL, VM_DIV,
+  /* With the constant k as the second operand, or the first (R...). */
+  VM_ADDK, VM_SUBK, VM_RSUBK, VM_MULK, VM_DIVK, VM_RDIVK,
+  VM_NEG, VM_ABS, VM_FLOOR, VM_FRACT, VM_SQRT, VM_SIN, VM_COS,
+  VM_MIN, VM_MAX, VM_STEP, VM_CLAMP, VM_MIX, VM_NOISE,
+  /* Pseudo-ops of the parser, never emitted. */
+  VM_RGB, VM_HSV, VM_PALETTE
+};
+
+static const char *const vm_input_names[] = {
+  "x", "y", "a", "rect_x", "rect_z", "t", "frame"
+};
+#define VM_NUM_INPUTS (sizeof(vm_input_names)/sizeof(vm_input_names[0]))
+
+static const struct {
+  const char *name;
+  enum vm_op op;
+  uint32_t args;
+} vm_functions[] = {
+  { "sin", VM_SIN, 1 }, { "cos", VM_COS, 1 }, { "abs", VM_ABS, 1 },
+  { "floor", VM_FLOOR, 1 }, { "fract", VM_FRACT, 1 }, { "sqrt", VM_SQRT, 1 },
+  { "min", VM_MIN, 2 }, { "max", VM_MAX, 2 }, { "step", VM_STEP, 2 },
+  { "clamp", VM_CLAMP, 3 }, { "mix", VM_MIX, 3 }, { "noise", VM_NOISE, 3 },
+  { "rgb", VM_RGB, 3 }, { "hsv", VM_HSV, 3 }, { "palette", VM_PALETTE, 1 }
+};
+
+
+/*
+  The VM registers, and the colour of the batch, in the scratch memory of a
+  slice worker.
+*/
+struct vm_scratch {
+  float reg[VM_MAX_REGS][VM_BATCH];
+  uint8_t r[VM_BATCH], g[VM_BATCH], b[VM_BATCH];
+};
+typedef char vm_scratch_fits[
+  sizeof(struct vm_scratch) <= SLICE_SCRATCH_SIZE ? 1 : -1];
+
+
+/* Compiler. */
+
+#define VM_MAX_NODES 1024
+#define VM_MAX_VARS 32
+#define VM_MAX_STATEMENTS 128
+/* Nesting of parentheses, unary minus and calls in one expression. */
+#define VM_MAX_DEPTH 64
+
+enum vm_node_kind { VM_NODE_NUM, VM_NODE_REG, VM_NODE_OP };
+
+struct vm_node {
+  enum vm_node_kind kind;
+  enum vm_op op;
+  float value;
+  /* VM_NODE_REG: an input or variable register. */
+  uint32_t reg;
+  int32_t arg[3];
+};
+
+struct vm_compiler {
+  const char *name;
+  const char *src, *pos;
+  /* Position of the current token, for error messages. */
+  const char *tok_start;
+  uint32_t line;
+  const char *line_start;
+  int error;
+  /*
+    Current nesting of vm_parse_unary(), which every parenthesis, call
+    and unary minus goes through.
+  */
+  uint32_t depth;
+
+  struct vm_node nodes[VM_MAX_NODES];
+  uint32_t num_nodes;
+  char vars[VM_MAX_VARS][32];
+  uint32_t num_vars;
+  /* Statements: the variable assigned (-1 for the output), the node. */
+  int32_t stmt_var[VM_MAX_STATEMENTS];
+  int32_t stmt_node[VM_MAX_STATEMENTS];
+  uint32_t num_statements;
+
+  struct vm_program *p;
+  /* Next free temporary register. */
+  uint32_t sp;
+};
+
+
+static void
+vm_error(struct vm_compiler *cc, const char *msg, const char *arg)
+{
+  if (cc->error)
+    return;
+  cc->error = 1;
+  fprintf(stderr, "%s:%u:%u: %s%s%s\n", cc->name, cc->line,
+          (uint32_t)(cc->tok_start - cc->line_start) + 1, msg,
+          arg ? " " : "", arg ? arg : "");
+}
+
+
+/* Skip blanks and comments, but not newlines, which end statements. */
+static void
+vm_skip(struct vm_compiler *cc)
+{
+  for (;;)
+  {
+    while (*cc->pos == ' ' || *cc->pos == '\t' || *cc->pos == '\r')
+      ++cc->pos;
+    if (*cc->pos != '#')
+      break;
+    while (*cc->pos && *cc->pos != '\n')
+      ++cc->pos;
+  }
+  cc->tok_start = cc->pos;
+}
+
+
+static int
+vm_accept(struct vm_compiler *cc, char c)
+{
+  vm_skip(cc);
+  if (*cc->pos != c)
+    return 0;
+  ++cc->pos;
+  return 1;
+}
+
+
+static void
+vm_expect(struct vm_compiler *cc, char c)
+{
+  char what[4] = { '\'', c, '\'', '\0' };
+
+  if (!vm_accept(cc, c))
+    vm_error(cc, "expected", what);
+}
+
+
+/* Read an identifier into BUF; returns 0 if there is none. */
+static int
+vm_ident(struct vm_compiler *cc, char *buf, size_t size)
+{
+  size_t len = 0;
+
+  vm_skip(cc);
+  if (!isalpha((unsigned char)*cc->pos) && *cc->pos != '_')
+    return 0;
+  while (isalnum((unsigned char)*cc->pos) || *cc->pos == '_')
+  {
+    if (len + 1 < size)
+      buf[len++] = *cc->pos;
+    ++cc->pos;
+  }
+  buf[len] = '\0';
+  return 1;
+}
+
+
+static int32_t
+vm_node_new(struct vm_compiler *cc, enum vm_node_kind kind)
+{
+  struct vm_node *n;
+
+  if (cc->num_nodes >= VM_MAX_NODES)
+  {
+    vm_error(cc, "program too long", NULL);
+    return -1;
+  }
+  n = &cc->nodes[cc->num_nodes];
+  memset(n, 0, sizeof(*n));
+  n->kind = kind;
+  n->arg[0] = n->arg[1] = n->arg[2] = -1;
+  return cc->num_nodes++;
+}
+
+
+static int32_t
+vm_node_num(struct vm_compiler *cc, float value)
+{
+  int32_t i = vm_node_new(cc, VM_NODE_NUM);
+
+  if (i >= 0)
+    cc->nodes[i].value = value;
+  return i;
+}
+
+
+/* The operation of the VM on scalars, for constant folding. */
+static float
+vm_fold(enum vm_op op, float a, float b, float c)
+{
+  switch (op)
+  {
+  case VM_ADD: return a + b;
+  case VM_SUB: return a - b;
+  case VM_MUL: return a * b;
+  case VM_DIV: return a / b;
+  case VM_NEG: return -a;
+  case VM_ABS: return fabsf(a);
+  case VM_FLOOR: return floorf(a);
+  case VM_FRACT: return a - floorf(a);
+  case VM_SQRT: return sqrtf(a);
+  case VM_SIN: return sinf(a);
+  case VM_COS: return cosf(a);
+  case VM_MIN: return a < b ? a : b;
+  case VM_MAX: return a > b ? a : b;
+  case VM_STEP: return b >= a ? 1.0f : 0.0f;
+  case VM_CLAMP: return a < b ? b : (a > c ? c : a);
+  case VM_MIX: return a + (b - a)*c;
+  case VM_NOISE: return simplex_noise_3d(a, b, c);
+  default: return 0.0f;
+  }
+}
+
+
+/* An operation node, folded to a number if all arguments are numbers. */
+static int32_t
+vm_node_op(struct vm_compiler *cc, enum vm_op op, uint32_t nargs,
+           const int32_t *args)
+{
+  float v[3] = { 0.0f, 0.0f, 0.0f };
+  int constant = op < VM_RGB;
+  uint32_t i;
+  int32_t n;
+
+  for (i = 0; i < nargs; ++i)
+  {
+    if (args[i] < 0)
+      return -1;
+    if (cc->nodes[args[i]].kind == VM_NODE_OP &&
+        cc->nodes[args[i]].op >= VM_RGB)
+    {
+      vm_error(cc, "a colour cannot be used in an expression", NULL);
+      return -1;
+    }
+    if (cc->nodes[args[i]].kind == VM_NODE_NUM)
+      v[i] = cc->nodes[args[i]].value;
+    else
+      constant = 0;
+  }
+  if (constant)
+    return vm_node_num(cc, vm_fold(op, v[0], v[1], v[2]));
+  if ((n = vm_node_new(cc, VM_NODE_OP)) < 0)
+    return -1;
+  cc->nodes[n].op = op;
+  for (i = 0; i < nargs; ++i)
+    cc->nodes[n].arg[i] = args[i];
+  return n;
+}
+
+
+static int32_t vm_parse_expr(struct vm_compiler *cc);
+
+
+static int32_t
+vm_parse_primary(struct vm_compiler *cc)
+{
+  const char *start;
+  char name[32];
+  int32_t args[3];
+  uint32_t i;
+
+  vm_skip(cc);
+  if (isdigit((unsigned char)*cc->pos) || *cc->pos == '.')
+  {
+    char *end;
+    float value = strtof(cc->pos, &end);
+
+    if (end == cc->pos)
+    {
+      vm_error(cc, "bad number", NULL);
+      return -1;
+    }
+    cc->pos = end;
+    return vm_node_num(cc, value);
+  }
+  if (vm_accept(cc, '('))
+  {
+    int32_t n = vm_parse_expr(cc);
+    vm_expect(cc, ')');
+    return n;
+  }
+  start = cc->pos;
+  if (!vm_ident(cc, name, sizeof(name)))
+  {
+    vm_error(cc, "expected an expression", NULL);
+    return -1;
+  }
+
+  if (vm_accept(cc, '('))
+  {
+    for (i = 0; i < sizeof(vm_functions)/sizeof(vm_functions[0]); ++i)
+      if (0 == strcmp(name, vm_functions[i].name))
+        break;
+    if (i == sizeof(vm_functions)/sizeof(vm_functions[0]))
+    {
+      cc->tok_start = start;
+      vm_error(cc, "unknown function", name);
+      return -1;
+    }
+    {
+      uint32_t j, nargs = vm_functions[i].args;
+
+      for (j = 0; j < nargs; ++j)
+      {
+        if (j > 0)
+          vm_expect(cc, ',');
+        args[j] = vm_parse_expr(cc);
+      }
+      vm_expect(cc, ')');
+      if (cc->error)
+        return -1;
+      return vm_node_op(cc, vm_functions[i].op, nargs, args);
+    }
+  }
+
+  for (i = 0; i < VM_NUM_INPUTS; ++i)
+  {
+    if (0 == strcmp(name, vm_input_names[i]))
+    {
+      int32_t n = vm_node_new(cc, VM_NODE_REG);
+      if (n >= 0)
+        cc->nodes[n].reg = i;
+      return n;
+    }
+  }
+  for (i = 0; i < cc->num_vars; ++i)
+  {
+    if (0 == strcmp(name, cc->vars[i]))
+    {
+      int32_t n = vm_node_new(cc, VM_NODE_REG);
+      if (n >= 0)
+        cc->nodes[n].reg = VM_NUM_INPUTS + i;
+      return n;
+    }
+  }
+  cc->tok_start = start;
+  vm_error(cc, "unknown variable", name);
+  return -1;
+}
+
+
+/*
+  Enter a level of nesting, to be left with --cc->depth. Returns zero, with
+  an error, if that is too deep: the recursion would otherwise overflow the
+  stack before any node limit is reached.
+*/
+static int
+vm_enter(struct vm_compiler *cc)
+{
+  if (cc->depth >= VM_MAX_DEPTH)
+  {
+    vm_error(cc, "expression too deeply nested", NULL);
+    return 0;
+  }
+  ++cc->depth;
+  return 1;
+}
+
+
+static int32_t
+vm_parse_unary(struct vm_compiler *cc)
+{
+  int32_t res;
+
+  if (!vm_enter(cc))
+    return -1;
+  if (vm_accept(cc, '-'))
+  {
+    int32_t arg = vm_parse_unary(cc);
+    res = vm_node_op(cc, VM_NEG, 1, &arg);
+  }
+  else
+    res = vm_parse_primary(cc);
+  --cc->depth;
+  return res;
+}
+
+
+static int32_t
+vm_parse_term(struct vm_compiler *cc)
+{
+  int32_t args[2];
+
+  args[0] = vm_parse_unary(cc);
+  while (!cc->error)
+  {
+    enum vm_op op;
+
+    if (vm_accept(cc, '*'))
+      op = VM_MUL;
+    else if (vm_accept(cc, '/'))
+      op = VM_DIV;
+    else
+      break;
+    args[1] = vm_parse_unary(cc);
+    args[0] = vm_node_op(cc, op, 2, args);
+  }
+  return args[0];
+}
+
+
+static int32_t
+vm_parse_expr(struct vm_compiler *cc)
+{
+  int32_t args[2];
+
+  args[0] = vm_parse_term(cc);
+  while (!cc->error)
+  {
+    enum vm_op op;
+
+    if (vm_accept(cc, '+'))
+      op = VM_ADD;
+    else if (vm_accept(cc, '-'))
+      op = VM_SUB;
+    else
+      break;
+    args[1] = vm_parse_term(cc);
+    args[0] = vm_node_op(cc, op, 2, args);
+  }
+  return args[0];
+}
+
+
+/* Parse one statement, up to and including the newline or ';' after it. */
+static void
+vm_parse_statement(struct vm_compiler *cc)
+{
+  const char *start;
+  char name[32];
+  int32_t var = -1, n;
+  uint32_t i;
+
+  vm_skip(cc);
+  start = cc->pos;
+  if (vm_ident(cc, name, sizeof(name)) && vm_accept(cc, '='))
+  {
+    cc->tok_start = start;
+    for (i = 0; i < VM_NUM_INPUTS; ++i)
+      if (0 == strcmp(name, vm_input_names[i]))
+        vm_error(cc, "cannot assign to input", name);
+    for (i = 0; i < cc->num_vars; ++i)
+      if (0 == strcmp(name, cc->vars[i]))
+        break;
+    if (i == cc->num_vars)
+    {
+      if (cc->num_vars >= VM_MAX_VARS)
+        vm_error(cc, "too many variables", NULL);
+      else
+        strcpy(cc->vars[cc->num_vars], name);
+    }
+    var = i;
+  }
+  else
+    cc->pos = start;
+
+  /* The variable is only known from the next statement on. */
+  n = vm_parse_expr(cc);
+  if (var >= 0 && (uint32_t)var == cc->num_vars && !cc->error)
+    ++cc->num_vars;
+  if (cc->error)
+    return;
+  if (var < 0 && (cc->nodes[n].kind != VM_NODE_OP ||
+                  cc->nodes[n].op < VM_RGB))
+  {
+    vm_error(cc, "expected a variable assignment or rgb(), hsv() or "
+             "palette()", NULL);
+    return;
+  }
+  if (var >= 0 && cc->nodes[n].kind == VM_NODE_OP &&
+      cc->nodes[n].op >= VM_RGB)
+  {
+    vm_error(cc, "a colour cannot be assigned", NULL);
+    return;
+  }
+  if (cc->num_statements >= VM_MAX_STATEMENTS)
+  {
+    vm_error(cc, "too many statements", NULL);
+    return;
+  }
+  cc->stmt_var[cc->num_statements] = var;
+  cc->stmt_node[cc->num_statements] = n;
+  ++cc->num_statements;
+
+  vm_skip(cc);
+  if (*cc->pos == ';' || *cc->pos == '\n')
+    ++cc->pos;
+  else if (*cc->pos)
+    vm_error(cc, "expected end of statement", NULL);
+}
+
+
+/* Code generation. */
+
+static void
+vm_emit(struct vm_compiler *cc, enum vm_op op, uint32_t dst, uint32_t a,
+        uint32_t b, uint32_t c, float k)
+{
+  struct vm_program *p = cc->p;
+  struct vm_insn *in;
+
+  if (p->len >= VM_MAX_CODE)
+  {
+    vm_error(cc, "program too long", NULL);
+    return;
+  }
+  in = &p->code[p->len++];
+  in->op = op;
+  in->dst = dst;
+  in->a = a;
+  in->b = b;
+  in->c = c;
+  in->k = k;
+}
+
+
+static uint32_t
+vm_temp_base(const struct vm_compiler *cc)
+{
+  return VM_NUM_INPUTS + cc->num_vars;
+}
+
+
+static uint32_t
+vm_alloc(struct vm_compiler *cc)
+{
+  if (cc->sp >= VM_MAX_REGS)
+  {
+    vm_error(cc, "expression too complex", NULL);
+    return VM_MAX_REGS - 1;
+  }
+  if (cc->sp + 1 > cc->p->num_regs)
+    cc->p->num_regs = cc->sp + 1;
+  return cc->sp++;
+}
+
+
+/* Temporaries are freed in the reverse order of allocation. */
+static void
+vm_free(struct vm_compiler *cc, uint32_t reg)
+{
+  if (reg >= vm_temp_base(cc) && reg + 1 == cc->sp)
+    --cc->sp;
+}
+
+
+/* Generate code for node N; returns the register holding its value. */
+static uint32_t
+vm_gen(struct vm_compiler *cc, int32_t n)
+{
+  const struct vm_node *node = &cc->nodes[n];
+  uint32_t r[3] = { 0, 0, 0 }, dst, i, nargs = 0;
+  enum vm_op op;
+
+  if (node->kind == VM_NODE_NUM)
+  {
+    dst = vm_alloc(cc);
+    vm_emit(cc, VM_CONST, dst, 0, 0, 0, node->value);
+    return dst;
+  }
+  if (node->kind == VM_NODE_REG)
+  {
+    if (node->reg < VM_NUM_INPUTS)
+      cc->p->inputs |= 1u << node->reg;
+    return node->reg;
+  }
+
+  op = node->op;
+  /* A binary operation with one constant operand uses an immediate. */
+  if (op >= VM_ADD && op <= VM_DIV)
+  {
+    const struct vm_node *l = &cc->nodes[node->arg[0]];
+    const struct vm_node *rn = &cc->nodes[node->arg[1]];
+    static const enum vm_op kop[4] = { VM_ADDK, VM_SUBK, VM_MULK, VM_DIVK };
+    static const enum vm_op rkop[4] = { VM_ADDK, VM_RSUBK, VM_MULK, VM_RDIVK };
+
+    if (rn->kind == VM_NODE_NUM || l->kind == VM_NODE_NUM)
+    {
+      int right = rn->kind == VM_NODE_NUM;
+      uint32_t a = vm_gen(cc, node->arg[right ? 0 : 1]);
+
+      vm_free(cc, a);
+      dst = vm_alloc(cc);
+      vm_emit(cc, right ? kop[op - VM_ADD] : rkop[op - VM_ADD], dst, a, 0, 0,
+              right ? rn->value : l->value);
+      return dst;
+    }
+  }
+
+  while (nargs < 3 && node->arg[nargs] >= 0)
+  {
+    r[nargs] = vm_gen(cc, node->arg[nargs]);
+    ++nargs;
+  }
+  if (op == VM_NOISE)
+  {
+    uint32_t low;
+
+    /*
+      simplex_noise_3d_n() must not write over its arguments, so the result
+      goes above them and is then moved down where they were.
+    */
+    dst = vm_alloc(cc);
+    vm_emit(cc, op, dst, r[0], r[1], r[2], 0.0f);
+    low = dst;
+    for (i = 0; i < nargs; ++i)
+      if (r[i] >= vm_temp_base(cc) && r[i] < low)
+        low = r[i];
+    if (low < dst)
+    {
+      cc->sp = low;
+      low = vm_alloc(cc);
+      vm_emit(cc, VM_MOV, low, dst, 0, 0, 0.0f);
+    }
+    return low;
+  }
+  for (i = nargs; i-- > 0; )
+    vm_free(cc, r[i]);
+  dst = vm_alloc(cc);
+  vm_emit(cc, op, dst, r[0], r[1], r[2], 0.0f);
+  return dst;
+}
+
+
+static void
+vm_gen_program(struct vm_compiler *cc)
+{
+  struct vm_program *p = cc->p;
+  uint32_t s, i;
+
+  p->num_regs = vm_temp_base(cc);
+  cc->sp = vm_temp_base(cc);
+  for (s = 0; s < cc->num_statements && !cc->error; ++s)
+  {
+    const struct vm_node *node = &cc->nodes[cc->stmt_node[s]];
+    int32_t var = cc->stmt_var[s];
+
+    if (var < 0)
+    {
+      if (s + 1 != cc->num_statements)
+      {
+        vm_error(cc, "the colour must be the last statement", NULL);
+        return;
+      }
+      p->output = node->op == VM_RGB ? VM_OUT_RGB :
+        node->op == VM_HSV ? VM_OUT_HSV : VM_OUT_PALETTE;
+      for (i = 0; i < 3 && node->arg[i] >= 0; ++i)
+        p->out[i] = vm_gen(cc, node->arg[i]);
+      return;
+    }
+    else
+    {
+      uint32_t reg = VM_NUM_INPUTS + var;
+      uint32_t r = vm_gen(cc, cc->stmt_node[s]);
+
+      if (r != reg)
+      {
+        struct vm_insn *last = p->len ? &p->code[p->len - 1] : NULL;
+
+        /* Retarget the instruction computing the value, if there is one. */
+        if (r >= vm_temp_base(cc) && last && last->dst == r &&
+            last->op != VM_NOISE)
+          last->dst = reg;
+        else
+          vm_emit(cc, VM_MOV, reg, r, 0, 0, 0.0f);
+      }
+      vm_free(cc, r);
+    }
+  }
+  if (!cc->error)
+    vm_error(cc, "missing rgb(), hsv() or palette() at the end", NULL);
+}
+
+
+/*
+  Compile the shader SRC into P. NAME is used in error messages, which go to
+  stderr. Returns non-zero on error.
+*/
+int
+vm_compile(struct vm_program *p, const char *src, const char *name)
+{
+  struct vm_compiler *cc = calloc(1, sizeof(*cc));
+  int err;
+
+  if (!cc)
+    return 1;
+  memset(p, 0, sizeof(*p));
+  cc->name = name;
+  cc->src = cc->pos = cc->tok_start = cc->line_start = src;
+  cc->line = 1;
+  cc->p = p;
+  for (;;)
+  {
+    vm_skip(cc);
+    if (*cc->pos == '\n' || *cc->pos == ';')
+    {
+      if (*cc->pos == '\n')
+      {
+        ++cc->line;
+        cc->line_start = cc->pos + 1;
+      }
+      ++cc->pos;
+      continue;
+    }
+    if (!*cc->pos || cc->error)
+      break;
+    vm_parse_statement(cc);
+    if (cc->pos > cc->src && cc->pos[-1] == '\n')
+    {
+      ++cc->line;
+      cc->line_start = cc->pos;
+    }
+  }
+  if (!cc->error)
+    vm_gen_program(cc);
+  err = cc->error;
+  free(cc);
+  return err;
+}
+
+
+int
+vm_compile_file(struct vm_program *p, const char *filename)
+{
+  FILE *fp = fopen(filename, "r");
+  char *src;
+  long size;
+  int err;
+
+  if (!fp)
+  {
+    fprintf(stderr, "Error: cannot read shader '%s'\n", filename);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < 0 || !(src = malloc(size + 1)))
+  {
+    fclose(fp);
+    return 1;
+  }
+  size = fread(src, 1, size, fp);
+  src[size] = '\0';
+  fclose(fp);
+  err = vm_compile(p, src, filename);
+  free(src);
+  return err;
+}
+
+
+/* Interpreter. */
+
+/*
+  As in particles.c, the loops select with ?: and need GCC to know that
+  nothing traps in order to vectorise.
+*/
+#pragma GCC push_options
+#pragma GCC optimize ("no-trapping-math")
+
+
+static void
+vm_exec(const struct vm_program *p, float (*reg)[VM_BATCH], uint32_t n)
+{
+  uint32_t pc, i;
+
+  for (pc = 0; pc < p->len; ++pc)
+  {
+    const struct vm_insn *in = &p->code[pc];
+    float *d = reg[in->dst];
+    const float *a = reg[in->a], *b = reg[in->b], *c = reg[in->c];
+    float k = in->k;
+
+    switch ((enum vm_op)in->op)
+    {
+    case VM_CONST:
+      for (i = 0; i < n; ++i)
+        d[i] = k;
+      break;
+    case VM_MOV:
+      memmove(d, a, n*sizeof(*d));
+      break;
+    case VM_ADD:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] + b[i];
+      break;
+    case VM_SUB:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] - b[i];
+      break;
+    case VM_MUL:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] * b[i];
+      break;
+    case VM_DIV:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] / b[i];
+      break;
+    case VM_ADDK:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] + k;
+      break;
+    case VM_SUBK:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] - k;
+      break;
+    case VM_RSUBK:
+      for (i = 0; i < n; ++i)
+        d[i] = k - a[i];
+      break;
+    case VM_MULK:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] * k;
+      break;
+    case VM_DIVK:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] / k;
+      break;
+    case VM_RDIVK:
+      for (i = 0; i < n; ++i)
+        d[i] = k / a[i];
+      break;
+    case VM_NEG:
+      for (i = 0; i < n; ++i)
+        d[i] = -a[i];
+      break;
+    case VM_ABS:
+      for (i = 0; i < n; ++i)
+        d[i] = fabsf(a[i]);
+      break;
+    case VM_FLOOR:
+      for (i = 0; i < n; ++i)
+        d[i] = floorf(a[i]);
+      break;
+    case VM_FRACT:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] - floorf(a[i]);
+      break;
+    case VM_SQRT:
+      for (i = 0; i < n; ++i)
+        d[i] = sqrtf(a[i]);
+      break;
+    case VM_SIN:
+      for (i = 0; i < n; ++i)
+        d[i] = sinf(a[i]);
+      break;
+    case VM_COS:
+      for (i = 0; i < n; ++i)
+        d[i] = cosf(a[i]);
+      break;
+    case VM_MIN:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] < b[i] ? a[i] : b[i];
+      break;
+    case VM_MAX:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] > b[i] ? a[i] : b[i];
+      break;
+    case VM_STEP:
+      for (i = 0; i < n; ++i)
+        d[i] = b[i] >= a[i] ? 1.0f : 0.0f;
+      break;
+    case VM_CLAMP:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] < b[i] ? b[i] : (a[i] > c[i] ? c[i] : a[i]);
+      break;
+    case VM_MIX:
+      for (i = 0; i < n; ++i)
+        d[i] = a[i] + (b[i] - a[i])*c[i];
+      break;
+    case VM_NOISE:
+      simplex_noise_3d_n(a, b, c, d, n);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+
+/*
+  Fill the input registers for the N voxels from slice A0 on. The voxel
+  coordinates are always filled (they cost next to nothing); t and frame only
+  when the program uses them.
+*/
+static void
+vm_inputs(const struct vm_program *p, float (*reg)[VM_BATCH], uint32_t a0,
+          uint32_t n, uint32_t frame)
+{
+  const struct torus_tables *tab = torus_tables();
+  uint32_t i;
+
+  for (i = 0; i < n; ++i)
+  {
+    uint32_t a = a0 + i/(LEDS_X*LEDS_Y);
+    uint32_t x = (i/LEDS_Y) % LEDS_X;
+    uint32_t y = i % LEDS_Y;
+
+    reg[0][i] = (float)x;
+    reg[1][i] = (float)y;
+    reg[2][i] = (float)a;
+    reg[3][i] = tab->rect[a][x].x;
+    reg[4][i] = tab->rect[a][x].z;
+  }
+  if (p->inputs & (1u << 5))
+    for (i = 0; i < n; ++i)
+      reg[5][i] = (float)frame*(1.0f/25.0f);
+  if (p->inputs & (1u << 6))
+    for (i = 0; i < n; ++i)
+      reg[6][i] = (float)frame;
+}
+
+
+static inline uint8_t
+vm_byte(float v)
+{
+  v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+  return (uint8_t)(v*255.0f + 0.5f);
+}
+
+
+/* Convert the output registers of the batch to bytes in S->r/g/b. */
+static void
+vm_colour(const struct vm_program *p, struct vm_scratch *s, uint32_t n)
+{
+  const float *o0 = s->reg[p->out[0]], *o1 = s->reg[p->out[1]];
+  const float *o2 = s->reg[p->out[2]];
+  uint32_t i;
+
+  switch (p->output)
+  {
+  case VM_OUT_RGB:
+    for (i = 0; i < n; ++i)
+    {
+      s->r[i] = vm_byte(o0[i]);
+      s->g[i] = vm_byte(o1[i]);
+      s->b[i] = vm_byte(o2[i]);
+    }
+    break;
+  case VM_OUT_HSV:
+    for (i = 0; i < n; ++i)
+    {
+      float h = o0[i] - floorf(o0[i]);
+      float sat = o1[i] < 0.0f ? 0.0f : (o1[i] > 1.0f ? 1.0f : o1[i]);
+      float v = o2[i] < 0.0f ? 0.0f : (o2[i] > 1.0f ? 1.0f : o2[i]);
+      float h6 = h*6.0f, c = v*sat;
+
+      s->r[i] = vm_byte(splat_hsv_channel(5.0f, h6, v, c));
+      s->g[i] = vm_byte(splat_hsv_channel(3.0f, h6, v, c));
+      s->b[i] = vm_byte(splat_hsv_channel(1.0f, h6, v, c));
+    }
+    break;
+  case VM_OUT_PALETTE:
+    /* Mapped straight into the frame by vm_render_slices(). */
+    break;
+  }
+}
+
+#pragma GCC pop_options
+
+
+/*
+  Render slices A_BEGIN <= a < A_END of frame FRAME with program P, using
+  SCRATCH (SLICE_SCRATCH_SIZE bytes) for the registers.
+*/
+void
+vm_render_slices(const struct vm_program *p, frame_t *f, uint32_t frame,
+                 uint32_t a_begin, uint32_t a_end, void *scratch)
+{
+  static const struct palette_map map = { -INFINITY, 0.0f, 1.0f };
+  const struct palette *pal = palette_default();
+  struct vm_scratch *s = scratch;
+  uint32_t a;
+
+  for (a = a_begin; a < a_end; a += VM_SLICES)
+  {
+    uint32_t slices = a_end - a < VM_SLICES ? a_end - a : VM_SLICES;
+    uint32_t n = slices*LEDS_X*LEDS_Y;
+
+    vm_inputs(p, s->reg, a, n, frame);
+    vm_exec(p, s->reg, n);
+    if (p->output == VM_OUT_PALETTE)
+    {
+      palette_map(pal, &map, s->reg[p->out[0]], &(*f)[a*LEDS_X*LEDS_Y], n);
+      continue;
+    }
+    vm_colour(p, s, n);
+    planar_interleave_n((*f)[a*LEDS_X*LEDS_Y], s->r, s->g, s->b, n);
+  }
+}
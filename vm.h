@@ -0,0 +1,75 @@
+#ifndef VM_H
+#define VM_H
+
+#include "ledtorus_anim.h"
+
+/*
+  Voxel shaders.
+
+  A shader is a small program giving the colour of each voxel, compiled at
+  run time so that it can be changed without rebuilding:
+
+    # Rainbow rings through noise.
+    n = noise(rect_x*0.1, y*0.1 + t*0.3, rect_z*0.1)
+    hsv(a/205 + n*0.3, 0.9, clamp(n + 0.4, 0, 1))
+
+  Statements are separated by newlines or ';', and # starts a comment. Each
+  one assigns an expression to a variable, except the last one, which gives
+  the colour, as rgb(r, g, b), hsv(h, s, v) (all 0..1) or palette(i) (i 0..1
+  along the default palette, see palette.h). Expressions have numbers,
+  variables, + - * / and parentheses, the inputs
+
+    x, y, a         the voxel (x radial, y the LED row from the top, a the
+                    tangential slice)
+    rect_x, rect_z  its horizontal position, as torus_polar2rect()
+    t, frame        time in seconds (25 frames per second), frame number
+
+  and the functions sin, cos, abs, floor, fract, sqrt (one argument), min,
+  max, step(edge, v) (two), clamp(v, lo, hi), mix(a, b, w) and
+  noise(x, y, z) (simplex noise, -1..1).
+
+  Programs compile to register bytecode. Each register is a batch of
+  VM_BATCH voxels (VM_SLICES tangential slices), and each instruction is a
+  loop over the whole batch, so the interpreter overhead is paid once per
+  batch rather than once per voxel, and the loops vectorise.
+*/
+
+#define VM_SLICES 4
+#define VM_BATCH (VM_SLICES*LEDS_X*LEDS_Y)
+#define VM_MAX_REGS 64
+#define VM_MAX_CODE 256
+
+enum vm_output {
+  VM_OUT_RGB,
+  VM_OUT_HSV,
+  VM_OUT_PALETTE
+};
+
+struct vm_insn {
+  uint8_t op;
+  uint8_t dst, a, b, c;
+  float k;
+};
+
+struct vm_program {
+  struct vm_insn code[VM_MAX_CODE];
+  uint32_t len;
+  uint32_t num_regs;
+  /* Bit i set if input register i is used. */
+  uint32_t inputs;
+  enum vm_output output;
+  /* Registers of the arguments of the output. */
+  uint8_t out[3];
+};
+
+/* Shader file of the "shader" animation (ledtorus_anim --shader), or NULL. */
+extern const char *vm_shader_file;
+extern const char vm_default_shader[];
+
+extern int vm_compile(struct vm_program *p, const char *src, const char *name);
+extern int vm_compile_file(struct vm_program *p, const char *filename);
+extern void vm_render_slices(const struct vm_program *p, frame_t *f,
+                             uint32_t frame, uint32_t a_begin, uint32_t a_end,
+                             void *scratch);
+
+#endif  /* VM_H */
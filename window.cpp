@@ -92,6 +92,8 @@ void Window::keyPressEvent(QKeyEvent *e)
 {
     if (e->key() == Qt::Key_Escape)
         close();
+    else if (e->key() == Qt::Key_I)
+        glWidget->setInterpolation(!glWidget->interpolation());
     else
         QWidget::keyPressEvent(e);
 }